@@ -0,0 +1,91 @@
+#include <Arduino.h>
+#include <esp_task_wdt.h>
+#include "Boot.h"
+
+uint8_t BootSequencer::addStage(const char *name, uint16_t deps, boot_fn_t start, boot_fn_t ready) {
+  if(this->stageCount >= BOOT_MAX_STAGES) {
+    Serial.printf("Boot stage %s exceeds the maximum of %d stages\n", name, BOOT_MAX_STAGES);
+    return BOOT_MAX_STAGES;
+  }
+  boot_stage_t &stage = this->stages[this->stageCount];
+  stage.name = name;
+  stage.deps = deps;
+  stage.start = start;
+  stage.ready = ready;
+  stage.state = boot_states_t::pending;
+  return this->stageCount++;
+}
+bool BootSequencer::advance() {
+  bool progress = false;
+  for(uint8_t i = 0; i < this->stageCount; i++) {
+    boot_stage_t &stage = this->stages[i];
+    if(stage.state == boot_states_t::pending && (stage.deps & this->failMask) != 0) {
+      stage.state = boot_states_t::skipped;
+      this->failMask |= BOOT_DEP(i);
+      Serial.printf("Boot stage %s skipped because a stage it depends on failed\n", stage.name);
+      progress = true;
+      continue;
+    }
+    if(stage.state == boot_states_t::pending && (stage.deps & this->doneMask) == stage.deps) {
+      stage.startTime = millis();
+      stage.state = boot_states_t::running;
+      if(stage.start && !stage.start()) {
+        stage.readyTime = millis();
+        stage.state = boot_states_t::failed;
+        this->failMask |= BOOT_DEP(i);
+        Serial.printf("Boot stage %s failed in %lums\n", stage.name, (unsigned long)(stage.readyTime - stage.startTime));
+      }
+      progress = true;
+      esp_task_wdt_reset();
+    }
+    if(stage.state == boot_states_t::running && (!stage.ready || stage.ready())) {
+      stage.state = boot_states_t::ready;
+      progress = true;
+    }
+    if(stage.state == boot_states_t::ready && (this->doneMask & BOOT_DEP(i)) == 0) {
+      stage.readyTime = millis();
+      this->doneMask |= BOOT_DEP(i);
+      Serial.printf("Boot stage %s ready in %lums\n", stage.name, (unsigned long)(stage.readyTime - stage.startTime));
+    }
+  }
+  if(this->completeTime == 0 && this->isComplete()) this->completeTime = millis();
+  return progress;
+}
+void BootSequencer::begin() {
+  this->setupStart = millis();
+  // Run every stage that can complete now.  Anything still waiting on a readiness
+  // signal is picked up from the main loop.
+  while(this->advance());
+  this->setupEnd = millis();
+}
+void BootSequencer::loop() { if(this->completeTime == 0) this->advance(); }
+bool BootSequencer::isReady(uint8_t stage) { return stage < this->stageCount && (this->doneMask & BOOT_DEP(stage)) != 0; }
+// Boot is complete once every stage has either come up or failed.
+bool BootSequencer::isComplete() { return (this->doneMask | this->failMask) == (BOOT_DEP(this->stageCount) - 1); }
+void BootSequencer::markTransmit() { if(this->firstTransmit == 0) this->firstTransmit = millis(); }
+void BootSequencer::toJSON(JsonResponse &json) {
+  static const char *states[] = {"pending", "running", "ready", "failed", "skipped"};
+  json.addElem("setupStart", this->setupStart);
+  json.addElem("setupEnd", this->setupEnd);
+  json.addElem("complete", this->isComplete());
+  json.addElem("completeTime", this->completeTime);
+  json.addElem("firstTransmit", this->firstTransmit);
+  json.addElem("uptime", (uint32_t)millis());
+  json.beginArray("stages");
+  for(uint8_t i = 0; i < this->stageCount; i++) {
+    boot_stage_t &stage = this->stages[i];
+    json.beginObject();
+    json.addElem("name", stage.name);
+    json.addElem("state", states[static_cast<uint8_t>(stage.state)]);
+    json.beginArray("deps");
+    for(uint8_t j = 0; j < this->stageCount; j++) {
+      if(stage.deps & BOOT_DEP(j)) json.addElem(this->stages[j].name);
+    }
+    json.endArray();
+    json.addElem("start", stage.startTime);
+    json.addElem("ready", stage.readyTime);
+    json.addElem("duration", stage.readyTime >= stage.startTime && this->isReady(i) ? stage.readyTime - stage.startTime : (uint32_t)0);
+    json.endObject();
+  }
+  json.endArray();
+}
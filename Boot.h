@@ -0,0 +1,51 @@
+#include <Arduino.h>
+#include "WResp.h"
+#ifndef boot_h
+#define boot_h
+
+#define BOOT_MAX_STAGES 12
+#define BOOT_DEP(stage) (static_cast<uint16_t>(1) << (stage))
+
+enum class boot_states_t : uint8_t {
+  pending = 0,
+  running = 1,
+  ready = 2,
+  failed = 3,
+  skipped = 4
+};
+typedef bool (*boot_fn_t)();
+// A boot stage starts as soon as every stage in its dependency mask is ready.  If a
+// readiness function is supplied the stage stays running until it returns true so
+// later stages can wait on a signal (such as a network link) rather than a fixed delay.
+// A stage that fails is never treated as ready and the stages that depend on it are
+// skipped.
+struct boot_stage_t {
+  const char *name = nullptr;
+  uint16_t deps = 0;
+  boot_fn_t start = nullptr;
+  boot_fn_t ready = nullptr;
+  boot_states_t state = boot_states_t::pending;
+  uint32_t startTime = 0;
+  uint32_t readyTime = 0;
+};
+class BootSequencer {
+  protected:
+    boot_stage_t stages[BOOT_MAX_STAGES];
+    uint8_t stageCount = 0;
+    uint16_t doneMask = 0;
+    uint16_t failMask = 0;
+    bool advance();
+  public:
+    uint32_t setupStart = 0;
+    uint32_t setupEnd = 0;
+    uint32_t completeTime = 0;
+    uint32_t firstTransmit = 0;
+    uint8_t addStage(const char *name, uint16_t deps, boot_fn_t start, boot_fn_t ready = nullptr);
+    void begin();
+    void loop();
+    bool isReady(uint8_t stage);
+    bool isComplete();
+    void markTransmit();
+    void toJSON(JsonResponse &json);
+};
+#endif
@@ -22,13 +22,26 @@ bool ConfigFile::begin(const char* filename, bool readOnly) {
   this->_opened = true;
   return true;
 }
+bool ConfigFile::beginStream(Print *out) {
+  // Records are written straight to the output rather than a file.  This is used
+  // to stream backups to the client and to hash records.
+  this->writer = out;
+  this->readOnly = true;
+  this->_opened = out != nullptr;
+  return this->_opened;
+}
 void ConfigFile::end() {
-  if(this->isOpen()) {
+  if(this->isOpen() && !this->writer) {
     if(!this->readOnly) this->file.flush();
     this->file.close();
   }
+  this->writer = nullptr;
   this->_opened = false;
 }
+size_t ConfigFile::writeRaw(const uint8_t *buf, size_t len) {
+  if(this->writer) return this->writer->write(buf, len);
+  return this->file.write(buf, len);
+}
 bool ConfigFile::isOpen() { return this->_opened; }
 bool ConfigFile::seekChar(const char val) {
   if(!this->isOpen()) return false;
@@ -188,10 +201,10 @@ bool ConfigFile::writeString(const char *val, size_t len, const char tok) {
   if(!this->isOpen()) return false;
   int slen = strlen(val);
   if(slen > 0)
-    if(this->file.write((uint8_t *)val, slen) != slen) return false;
+    if(this->writeRaw((uint8_t *)val, slen) != slen) return false;
   // Now we need to pad the end of the string so that it is of a fixed length.
   while(slen < len - 1) {
-    this->file.write(' ');
+    this->writeChar(' ');
     slen++;
   }
   // 255 = len = 4 slen = 3
@@ -203,15 +216,15 @@ bool ConfigFile::writeVarString(const char *val, const char tok) {
   if(!this->isOpen()) return false;
   int slen = strlen(val);
   this->writeChar(CFG_TOK_QUOTE);
-  if(slen > 0) if(this->file.write((uint8_t *)val, slen) != slen) return false;
+  if(slen > 0) if(this->writeRaw((uint8_t *)val, slen) != slen) return false;
   this->writeChar(CFG_TOK_QUOTE);
   if(tok != CFG_TOK_NONE) return this->writeChar(tok);
   return true;
 }
 bool ConfigFile::writeChar(const char val) {
   if(!this->isOpen()) return false;
-  if(this->file.write(static_cast<uint8_t>(val)) == 1) return true;
-  return false;
+  uint8_t ch = static_cast<uint8_t>(val);
+  return this->writeRaw(&ch, 1) == 1;
 }
 bool ConfigFile::writeInt8(const int8_t val, const char tok) {
   char buff[5];
@@ -345,15 +358,45 @@ bool ShadeConfigFile::save(SomfyShadeController *s) {
   this->writeRepeaterRecord(s);
   return true;
 }
-bool ShadeConfigFile::backup(SomfyShadeController *s) {
+bool ShadeConfigFile::backup(SomfyShadeController *s, uint32_t since) {
+  // When a prior revision is supplied only the room, shade, and group records that changed
+  // after it are written.  The diff is prefixed with the revision range and the ids that
+  // currently exist so deleted records can be pruned.  The prefix also keeps a diff from
+  // being mistaken for a complete backup on restore.  A revision newer than the current one
+  // comes from before the NVS was cleared so a full backup is written instead.
+  bool diff = since > 0 && since <= s->configRevision;
+  uint8_t rooms = 0, shades = 0, groups = 0;
+  for(uint8_t i = 0; i < SOMFY_MAX_ROOMS; i++)
+    if(s->rooms[i].roomId != 0 && (!diff || s->roomRevs[i].revision > since)) rooms++;
+  for(uint8_t i = 0; i < SOMFY_MAX_SHADES; i++)
+    if(s->shades[i].getShadeId() != 255 && (!diff || s->shadeRevs[i].revision > since)) shades++;
+  for(uint8_t i = 0; i < SOMFY_MAX_GROUPS; i++)
+    if(s->groups[i].getGroupId() != 255 && (!diff || s->groupRevs[i].revision > since)) groups++;
+  if(diff) {
+    char buff[24];
+    snprintf(buff, sizeof(buff), "#diff,%u,%u", since, s->configRevision);
+    this->writeString(buff, strlen(buff) + 1, CFG_REC_END);
+    this->writeString("#rooms", 7, CFG_TOK_NONE);
+    for(uint8_t i = 0; i < SOMFY_MAX_ROOMS; i++)
+      if(s->rooms[i].roomId != 0) { this->writeSeparator(); this->writeUInt8(s->rooms[i].roomId, CFG_TOK_NONE); }
+    this->writeRecordEnd();
+    this->writeString("#shades", 8, CFG_TOK_NONE);
+    for(uint8_t i = 0; i < SOMFY_MAX_SHADES; i++)
+      if(s->shades[i].getShadeId() != 255) { this->writeSeparator(); this->writeUInt8(s->shades[i].getShadeId(), CFG_TOK_NONE); }
+    this->writeRecordEnd();
+    this->writeString("#groups", 8, CFG_TOK_NONE);
+    for(uint8_t i = 0; i < SOMFY_MAX_GROUPS; i++)
+      if(s->groups[i].getGroupId() != 255) { this->writeSeparator(); this->writeUInt8(s->groups[i].getGroupId(), CFG_TOK_NONE); }
+    this->writeRecordEnd();
+  }
   this->header.version = SHADE_HDR_VER;
   this->header.roomRecordSize = ROOM_REC_SIZE;
-  this->header.roomRecords = s->roomCount();
+  this->header.roomRecords = rooms;
   this->header.shadeRecordSize = SHADE_REC_SIZE;
   this->header.length = SHADE_HDR_SIZE;
-  this->header.shadeRecords = s->shadeCount();
+  this->header.shadeRecords = shades;
   this->header.groupRecordSize = GROUP_REC_SIZE;
-  this->header.groupRecords = s->groupCount();
+  this->header.groupRecords = groups;
   this->header.repeaterRecords = 1;
   this->header.repeaterRecordSize = REPEATER_REC_SIZE;
   this->header.settingsRecordSize = settings.calcSettingsRecSize();
@@ -362,17 +405,17 @@ bool ShadeConfigFile::backup(SomfyShadeController *s) {
   this->writeHeader();
   for(uint8_t i = 0; i < SOMFY_MAX_ROOMS; i++) {
     SomfyRoom *room = &s->rooms[i];
-    if(room->roomId != 0)
+    if(room->roomId != 0 && (!diff || s->roomRevs[i].revision > since))
       this->writeRoomRecord(room);
   }
   for(uint8_t i = 0; i < SOMFY_MAX_SHADES; i++) {
     SomfyShade *shade = &s->shades[i];
-    if(shade->getShadeId() != 255)
+    if(shade->getShadeId() != 255 && (!diff || s->shadeRevs[i].revision > since))
       this->writeShadeRecord(shade);
   }
   for(uint8_t i = 0; i < SOMFY_MAX_GROUPS; i++) {
     SomfyGroup *group = &s->groups[i];
-    if(group->getGroupId() != 255)
+    if(group->getGroupId() != 255 && (!diff || s->groupRevs[i].revision > since))
       this->writeGroupRecord(group);
   }
   this->writeRepeaterRecord(s);
@@ -381,6 +424,33 @@ bool ShadeConfigFile::backup(SomfyShadeController *s) {
   this->writeTransRecord(s->transceiver.config);
   return true;
 }
+uint32_t ShadeConfigFile::recordHash(SomfyRoom *room) {
+  ConfigHash hash;
+  ShadeConfigFile file;
+  file.configOnly = true;
+  file.beginStream(&hash);
+  file.writeRoomRecord(room);
+  file.end();
+  return hash.hash;
+}
+uint32_t ShadeConfigFile::recordHash(SomfyShade *shade) {
+  ConfigHash hash;
+  ShadeConfigFile file;
+  file.configOnly = true;
+  file.beginStream(&hash);
+  file.writeShadeRecord(shade);
+  file.end();
+  return hash.hash;
+}
+uint32_t ShadeConfigFile::recordHash(SomfyGroup *group) {
+  ConfigHash hash;
+  ShadeConfigFile file;
+  file.configOnly = true;
+  file.beginStream(&hash);
+  file.writeGroupRecord(group);
+  file.end();
+  return hash.hash;
+}
 bool ShadeConfigFile::validate() {
   this->readHeader();
   if(this->header.version < 1) {
@@ -936,7 +1006,7 @@ bool ShadeConfigFile::writeGroupRecord(SomfyGroup *group) {
   this->writeUInt8(group->sortOrder);
   this->writeBool(group->flipCommands);
   this->writeUInt8(group->roomId);
-  this->writeUInt16(group->lastRollingCode, CFG_REC_END);
+  this->writeUInt16(this->configOnly ? 0 : group->lastRollingCode, CFG_REC_END);
   return true;
 }
 bool ShadeConfigFile::writeRepeaterRecord(SomfyShadeController *s) {
@@ -973,8 +1043,11 @@ bool ShadeConfigFile::writeShadeRecord(SomfyShade *shade) {
     SomfyLinkedRemote *rem = &shade->linkedRemotes[j];
     this->writeUInt32(rem->getRemoteAddress());
   }
-  this->writeUInt16(shade->lastRollingCode);
-  if(shade->getShadeId() != 255) {
+  this->writeUInt16(this->configOnly ? 0 : shade->lastRollingCode);
+  if(shade->getShadeId() != 255 && this->configOnly) {
+    this->writeUInt8(shade->flags & ~(static_cast<uint8_t>(somfy_flags_t::Windy) | static_cast<uint8_t>(somfy_flags_t::Sunny) | static_cast<uint8_t>(somfy_flags_t::Lighted)));
+  }
+  else if(shade->getShadeId() != 255) {
     this->writeUInt8(shade->flags & 0xFF);
     this->writeFloat(shade->myPos, 5);
     this->writeFloat(shade->myTiltPos, 5);
@@ -1049,3 +1122,185 @@ bool ShadeConfigFile::writeTransRecord(transceiver_config_t &cfg) {
   return true;
 }
 bool ShadeConfigFile::exists() { return LittleFS.exists("/shades.cfg"); }
+/*********************************************************************
+ * ShadeConfigStream class members
+ ********************************************************************/
+bool ShadeConfigStream::begin(const char *filename) {
+  if(this->_opened) this->file.close();
+  strlcpy(this->filename, filename, sizeof(this->filename));
+  memset(this->hdrBuff, 0x00, sizeof(this->hdrBuff));
+  this->hdrLen = 0;
+  this->section = cfg_stream_sections_t::header;
+  this->records = 0;
+  this->recLen = 0;
+  this->loaded = 0;
+  this->expected = 0;
+  this->recordsRead = 0;
+  this->failed = false;
+  this->error[0] = '\0';
+  this->header = config_header_t();
+  this->file = LittleFS.open(filename, "w");
+  this->_opened = !!this->file;
+  if(!this->_opened) return this->fail("Unable to open restore file");
+  return true;
+}
+bool ShadeConfigStream::fail(const char *desc) {
+  if(!this->failed) {
+    Serial.printf("Restore upload rejected: %s\n", desc);
+    strlcpy(this->error, desc, sizeof(this->error));
+  }
+  this->failed = true;
+  if(this->_opened) {
+    this->file.close();
+    this->_opened = false;
+    LittleFS.remove(this->filename);
+  }
+  return false;
+}
+void ShadeConfigStream::abort() { this->fail("Upload aborted"); }
+bool ShadeConfigStream::isComplete() { return !this->failed && this->section == cfg_stream_sections_t::done; }
+bool ShadeConfigStream::parseHeader() {
+  // The header is a single comma separated record.  The fields present depend on the
+  // version so this must stay in step with ConfigFile::readHeader.
+  char *fields[20];
+  uint8_t n = 0;
+  char *tok = strtok(this->hdrBuff, ",\n");
+  while(tok && n < sizeof(fields)/sizeof(fields[0])) {
+    _trim(tok);
+    fields[n++] = tok;
+    tok = strtok(nullptr, ",\n");
+  }
+  uint8_t ndx = 0;
+  if(n < 4) return this->fail("Invalid header");
+  this->header.version = atoi(fields[ndx++]);
+  this->header.length = atoi(fields[ndx++]);
+  if(this->header.version >= 19) {
+    if(ndx + 2 > n) return this->fail("Invalid header");
+    this->header.roomRecordSize = atoi(fields[ndx++]);
+    this->header.roomRecords = atoi(fields[ndx++]);
+  }
+  if(ndx + 2 > n) return this->fail("Invalid header");
+  this->header.shadeRecordSize = atoi(fields[ndx++]);
+  this->header.shadeRecords = atoi(fields[ndx++]);
+  if(this->header.version > 10) {
+    if(ndx + 2 > n) return this->fail("Invalid header");
+    this->header.groupRecordSize = atoi(fields[ndx++]);
+    this->header.groupRecords = atoi(fields[ndx++]);
+  }
+  if(this->header.version >= 21) {
+    if(ndx + 2 > n) return this->fail("Invalid header");
+    this->header.repeaterRecordSize = atoi(fields[ndx++]);
+    this->header.repeaterRecords = atoi(fields[ndx++]);
+  }
+  if(this->header.version > 13) {
+    if(ndx + 3 > n) return this->fail("Invalid header");
+    this->header.settingsRecordSize = atoi(fields[ndx++]);
+    this->header.netRecordSize = atoi(fields[ndx++]);
+    this->header.transRecordSize = atoi(fields[ndx++]);
+    if(ndx < n) strlcpy(this->header.serverId, fields[ndx++], sizeof(this->header.serverId));
+  }
+  // These are the same checks ShadeConfigFile::validate makes before a restore.
+  if(this->header.version < 1) return this->fail("Invalid header version");
+  if(this->header.shadeRecordSize < 100) return this->fail("Invalid shade record size");
+  if(this->header.version > 10 && this->header.groupRecordSize < 100) return this->fail("Invalid group record size");
+  if(this->header.length != this->hdrLen) return this->fail("Header length mismatch");
+  this->expected = this->header.length + (this->header.shadeRecordSize * this->header.shadeRecords);
+  if(this->header.version > 10) this->expected += (this->header.groupRecordSize * this->header.groupRecords);
+  if(this->header.version >= 19) this->expected += (this->header.roomRecordSize * this->header.roomRecords);
+  if(this->header.version > 13) this->expected += this->header.settingsRecordSize + this->header.netRecordSize + this->header.transRecordSize;
+  if(this->header.version >= 21) this->expected += (this->header.repeaterRecordSize * this->header.repeaterRecords);
+  Serial.printf("Restore header version:%u rooms:%u shades:%u groups:%u expecting %u bytes\n", this->header.version, this->header.roomRecords, this->header.shadeRecords, this->header.groupRecords, this->expected);
+  return true;
+}
+void ShadeConfigStream::nextSection() {
+  this->records = 0;
+  while(this->records == 0 && this->section != cfg_stream_sections_t::done) {
+    this->section = static_cast<cfg_stream_sections_t>(static_cast<uint8_t>(this->section) + 1);
+    switch(this->section) {
+      case cfg_stream_sections_t::rooms:
+        if(this->header.version >= 19) this->records = this->header.roomRecords;
+        break;
+      case cfg_stream_sections_t::shades:
+        this->records = this->header.shadeRecords;
+        break;
+      case cfg_stream_sections_t::groups:
+        if(this->header.version > 10) this->records = this->header.groupRecords;
+        break;
+      case cfg_stream_sections_t::repeaters:
+        if(this->header.version >= 21) this->records = this->header.repeaterRecords;
+        break;
+      case cfg_stream_sections_t::settings:
+        this->records = this->header.settingsRecordSize > 0 ? 1 : 0;
+        break;
+      case cfg_stream_sections_t::net:
+        this->records = this->header.netRecordSize > 0 ? 1 : 0;
+        break;
+      case cfg_stream_sections_t::trans:
+        this->records = this->header.transRecordSize > 0 ? 1 : 0;
+        break;
+      default:
+        break;
+    }
+  }
+}
+uint16_t ShadeConfigStream::recordSize() {
+  // Only the fixed length records are checked.  The settings, network and transceiver
+  // records contain variable strings and the readers seek to the record end anyway.
+  switch(this->section) {
+    case cfg_stream_sections_t::rooms: return this->header.roomRecordSize;
+    case cfg_stream_sections_t::shades: return this->header.shadeRecordSize;
+    case cfg_stream_sections_t::groups: return this->header.groupRecordSize;
+    default: return 0;
+  }
+}
+bool ShadeConfigStream::write(const uint8_t *buf, size_t len) {
+  if(this->failed || !this->_opened) return false;
+  for(size_t i = 0; i < len; i++) {
+    const char ch = static_cast<char>(buf[i]);
+    if(this->section == cfg_stream_sections_t::header) {
+      if(this->hdrLen >= sizeof(this->hdrBuff) - 1) return this->fail("Header too long");
+      this->hdrBuff[this->hdrLen++] = ch;
+      if(ch == CFG_REC_END) {
+        if(!this->parseHeader()) return false;
+        this->nextSection();
+      }
+      continue;
+    }
+    if(this->section == cfg_stream_sections_t::done) continue;
+    this->recLen++;
+    if(ch == CFG_REC_END) {
+      uint16_t size = this->recordSize();
+      if(size > 0 && this->recLen != size) {
+        char desc[64];
+        snprintf(desc, sizeof(desc), "Record %u length is %u and should be %u", this->recordsRead + 1, this->recLen, size);
+        return this->fail(desc);
+      }
+      this->recLen = 0;
+      this->recordsRead++;
+      if(--this->records == 0) this->nextSection();
+    }
+    else if(this->recLen > 512) return this->fail("Record end not found");
+  }
+  if(this->file.write(buf, len) != len) return this->fail("Error writing restore file");
+  this->loaded += len;
+  return true;
+}
+bool ShadeConfigStream::end() {
+  if(this->failed) return false;
+  if(this->section != cfg_stream_sections_t::done) return this->fail("Upload is incomplete");
+  this->file.flush();
+  this->file.close();
+  this->_opened = false;
+  if(this->loaded != this->expected) Serial.printf("Restore file size is %u and header describes %u\n", this->loaded, this->expected);
+  return true;
+}
+void ShadeConfigStream::toJSON(JsonSockEvent *json) {
+  json->addElem("loaded", this->loaded);
+  json->addElem("total", this->expected);
+  json->addElem("records", (uint32_t)this->recordsRead);
+  if(this->failed) {
+    json->addElem("status", "error");
+    json->addElem("desc", this->error);
+  }
+  else json->addElem("status", this->isComplete() ? "complete" : "uploading");
+}
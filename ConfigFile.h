@@ -28,15 +28,25 @@ struct config_header_t {
   char serverId[10] = ""; // This must match the server id size in the ConfigSettings.
   int8_t length = 0;
 };
+// Computes an FNV-1a hash over the bytes of a record as they would be written so a
+// changed record can be detected without keeping a copy of the file.
+class ConfigHash : public Print {
+  public:
+    uint32_t hash = 2166136261UL;
+    size_t write(uint8_t ch) override { this->hash = (this->hash ^ ch) * 16777619UL; return 1; }
+};
 class ConfigFile {
   protected:
     File file;
+    Print *writer = nullptr;
     bool readOnly = false;
     bool begin(const char *filename, bool readOnly = false);
+    size_t writeRaw(const uint8_t *buf, size_t len);
     uint32_t startRecPos = 0;
     bool _opened = false;
   public:
     config_header_t header;
+    bool beginStream(Print *out);
     void end();
     bool isOpen();
     bool seekRecordByIndex(uint16_t ndx);
@@ -68,6 +78,9 @@ class ConfigFile {
 };
 class ShadeConfigFile : public ConfigFile {
   protected:
+    // Set when hashing a record for its revision.  Positions, rolling codes and sensor
+    // states change as the shades run so they are left out of the hash.
+    bool configOnly = false;
     bool writeRepeaterRecord(SomfyShadeController *s);
     bool writeRoomRecord(SomfyRoom *room);
     bool writeShadeRecord(SomfyShade *shade);
@@ -89,11 +102,57 @@ class ShadeConfigFile : public ConfigFile {
     bool begin(const char *filename, bool readOnly = false);
     bool begin(bool readOnly = false);
     bool save(SomfyShadeController *somfy);
-    bool backup(SomfyShadeController *somfy);
+    bool backup(SomfyShadeController *somfy, uint32_t since = 0);
+    static uint32_t recordHash(SomfyRoom *room);
+    static uint32_t recordHash(SomfyShade *shade);
+    static uint32_t recordHash(SomfyGroup *group);
     bool loadFile(SomfyShadeController *somfy, const char *filename = "/shades.cfg");
     bool restoreFile(SomfyShadeController *somfy, const char *filename, restore_options_t &opts);
     void end();
     //bool seekRecordById(uint8_t id);
     bool validate();
 };
+enum class cfg_stream_sections_t : uint8_t {
+  header = 0,
+  rooms = 1,
+  shades = 2,
+  groups = 3,
+  repeaters = 4,
+  settings = 5,
+  net = 6,
+  trans = 7,
+  done = 8
+};
+// Validates a shade configuration file while it is being uploaded.  The chunks are
+// written through a single open file handle and the header and record boundaries
+// are checked as they arrive so a bad upload is rejected before the remainder of
+// the file is written.
+class ShadeConfigStream {
+  protected:
+    File file;
+    bool _opened = false;
+    char filename[32] = "";
+    char hdrBuff[128] = "";
+    uint8_t hdrLen = 0;
+    cfg_stream_sections_t section = cfg_stream_sections_t::header;
+    uint16_t records = 0;
+    uint16_t recLen = 0;
+    bool parseHeader();
+    void nextSection();
+    uint16_t recordSize();
+    bool fail(const char *desc);
+  public:
+    config_header_t header;
+    uint32_t loaded = 0;
+    uint32_t expected = 0;
+    uint16_t recordsRead = 0;
+    bool failed = false;
+    char error[64] = "";
+    bool begin(const char *filename);
+    bool write(const uint8_t *buf, size_t len);
+    bool end();
+    void abort();
+    bool isComplete();
+    void toJSON(JsonSockEvent *json);
+};
 #endif
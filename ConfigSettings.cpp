@@ -5,6 +5,7 @@
 #include <Preferences.h>
 #include "ConfigSettings.h"
 #include "Utils.h"
+#include "HeapTracker.h"
 #include "esp_chip_info.h"
 
 Preferences pref;
@@ -111,7 +112,7 @@ bool BaseSettings::loadFile(const char *filename) {
       char c = file.read();
       data += c;
     }
-    DynamicJsonDocument doc(filesize);
+    SettingsJsonDocument doc(filesize);
     deserializeJson(doc, data);
     JsonObject obj = doc.as<JsonObject>();
     this->fromJSON(obj);
@@ -121,7 +122,7 @@ bool BaseSettings::loadFile(const char *filename) {
 }
 bool BaseSettings::saveFile(const char *filename) {
   File file = LittleFS.open(filename, "w");
-  DynamicJsonDocument doc(2048);
+  SettingsJsonDocument doc(2048);
   JsonObject obj = doc.as<JsonObject>();
   this->toJSON(obj);
   serializeJson(doc, file);
@@ -206,6 +207,8 @@ bool ConfigSettings::load() {
   this->ssdpBroadcast = pref.getBool("ssdpBroadcast", true);
   this->checkForUpdate = pref.getBool("checkForUpdate", true);
   this->connType = static_cast<conn_types_t>(pref.getChar("connType", 0x00));
+  this->apiKeepAlive = pref.getUChar("apiKeepAlive", this->apiKeepAlive);
+  this->apiMaxRequests = pref.getUShort("apiMaxRequests", this->apiMaxRequests);
   //Serial.printf("Preference GFG Free Entries: %d\n", pref.freeEntries());
   pref.end();
   if(this->connType == conn_types_t::unset) {
@@ -238,6 +241,8 @@ bool ConfigSettings::save() {
   pref.putBool("ssdpBroadcast", this->ssdpBroadcast);
   pref.putChar("connType", static_cast<uint8_t>(this->connType));
   pref.putBool("checkForUpdate", this->checkForUpdate);
+  pref.putUChar("apiKeepAlive", this->apiKeepAlive);
+  pref.putUShort("apiMaxRequests", this->apiMaxRequests);
   pref.end();
   return true;
 }
@@ -247,6 +252,8 @@ bool ConfigSettings::toJSON(JsonObject &obj) {
   obj["connType"] = static_cast<uint8_t>(this->connType);
   obj["chipModel"] = this->chipModel;
   obj["checkForUpdate"] = this->checkForUpdate;
+  obj["apiKeepAlive"] = this->apiKeepAlive;
+  obj["apiMaxRequests"] = this->apiMaxRequests;
   return true;
 }
 void ConfigSettings::toJSON(JsonResponse &json) {
@@ -255,6 +262,8 @@ void ConfigSettings::toJSON(JsonResponse &json) {
   json.addElem("connType", static_cast<uint8_t>(this->connType));
   json.addElem("chipModel", this->chipModel);
   json.addElem("checkForUpdate", this->checkForUpdate);
+  json.addElem("apiKeepAlive", this->apiKeepAlive);
+  json.addElem("apiMaxRequests", static_cast<uint32_t>(this->apiMaxRequests));
 }
 
 bool ConfigSettings::requiresAuth() { return this->Security.type != security_types::None; }
@@ -263,6 +272,8 @@ bool ConfigSettings::fromJSON(JsonObject &obj) {
     if(obj.containsKey("hostname")) this->parseValueString(obj, "hostname", this->hostname, sizeof(this->hostname));
     if(obj.containsKey("connType")) this->connType = static_cast<conn_types_t>(obj["connType"].as<uint8_t>());
     if(obj.containsKey("checkForUpdate")) this->checkForUpdate = obj["checkForUpdate"];
+    if(obj.containsKey("apiKeepAlive")) this->apiKeepAlive = obj["apiKeepAlive"];
+    if(obj.containsKey("apiMaxRequests")) this->apiMaxRequests = max(obj["apiMaxRequests"].as<uint16_t>(), (uint16_t)1);
     return true;
 }
 void ConfigSettings::print() {
@@ -519,6 +530,7 @@ bool SecuritySettings::fromJSON(JsonObject &obj) {
   this->parseValueString(obj, "password", this->password, sizeof(this->password));
   this->parseValueString(obj, "pin", this->pin, sizeof(this->pin));
   if(obj.containsKey("permissions")) this->permissions = obj["permissions"];
+  this->revision++;
   return true;
 }
 bool SecuritySettings::toJSON(JsonObject &obj) {
@@ -556,6 +568,7 @@ bool SecuritySettings::load() {
   if(pref.isKey("pin")) pref.getString("pin", this->pin, sizeof(this->pin));
   if(pref.isKey("permissions")) this->permissions = pref.getChar("permissions", this->permissions);
   pref.end();
+  this->revision++;
   return true;
 }
 void SecuritySettings::print() {
@@ -140,6 +140,8 @@ class SecuritySettings: BaseSettings {
     char password[33] = "";
     char pin[5] = "";
     uint8_t permissions = 0;
+    // Bumped whenever the credentials change so cached api tokens are recomputed.
+    uint32_t revision = 0;
     bool begin();
     bool save();
     bool load();
@@ -177,6 +179,8 @@ class ConfigSettings: BaseSettings {
     appver_t appVersion;
     bool ssdpBroadcast = true;
     bool checkForUpdate = true;
+    uint8_t apiKeepAlive = 5; // Seconds an idle api connection is held open.  Zero closes after each request.
+    uint16_t apiMaxRequests = 100;
     uint8_t status;
     IPSettings IP;
     WifiSettings WIFI;
@@ -5,6 +5,7 @@
 #include "ConfigSettings.h"
 #include "Network.h"
 #include "Somfy.h"
+#include "HeapTracker.h"
 
 extern Network net;
 extern SomfyShadeController somfy;
@@ -47,31 +48,43 @@ void DinplugBridge::loop() {
     this->lastRxMs = millis();
     if(ch == '\r') continue;
     if(ch == '\n') {
-      if(this->rxBuffer.length() > 0) this->processLine(this->rxBuffer);
-      this->rxBuffer = "";
+      if(!this->rxOverflow && this->rxLength > 0) {
+        this->rxBuffer[this->rxLength] = '\0';
+        this->processLine(this->rxBuffer);
+      }
+      this->resetRx();
       continue;
     }
-    this->rxBuffer += ch;
-    if(this->rxBuffer.length() > 512) this->rxBuffer = "";
+    if(this->rxLength >= kRxBufferSize - 1) this->rxOverflow = true;
+    else this->rxBuffer[this->rxLength++] = ch;
   }
 }
 
-void DinplugBridge::printHelp(Stream &out) {
-  out.println("{\"event\":\"dinplug_help\",\"commands\":[\"dinplug status\",\"dinplug host <host>\",\"dinplug auto <on|off>\",\"dinplug connect\",\"dinplug disconnect\",\"dinplug map list\",\"dinplug map clear\",\"dinplug map del <index>\",\"dinplug map add <keypadId> <buttonId> <press|release|hold|double> <shade|group> <targetId> <command|target|cycle> [value]\"]}");
+void DinplugBridge::resetRx() {
+  this->rxLength = 0;
+  this->rxOverflow = false;
 }
 
-void DinplugBridge::printStatus(Stream &out) {
-  out.printf("{\"event\":\"dinplug_status\",\"host\":\"%s\",\"autoConnect\":%s,\"connected\":%s,\"mappings\":%u,\"status\":\"%s\"}\r\n",
+void DinplugBridge::printStatus(Print &out) {
+  out.printf("{\"event\":\"dinplug_status\",\"host\":\"%s\",\"autoConnect\":%s,\"connected\":%s,\"mappings\":%u,\"maxMappings\":%u,\"mappingBytes\":%u,\"status\":\"%s\"}\r\n",
              this->gatewayHost,
              this->autoConnect ? "true" : "false",
              this->client.connected() ? "true" : "false",
              this->mappingCount,
+             kMaxMappings,
+             static_cast<unsigned>(sizeof(this->mappings)),
              this->connectionLabel().c_str());
 }
 
-void DinplugBridge::printMappings(Stream &out) {
-  out.printf("{\"event\":\"dinplug_mappings\",\"count\":%u}\r\n", this->mappingCount);
-  for(uint8_t i = 0; i < this->mappingCount; i++) {
+// Lists count mappings from offset.  The header carries the total and the offset of the
+// next page so a client can walk the table.
+void DinplugBridge::printMappings(Print &out, uint16_t offset, uint16_t count) {
+  const uint16_t end = offset >= this->mappingCount ? offset : (this->mappingCount - offset > count ? offset + count : this->mappingCount);
+  if(end < this->mappingCount)
+    out.printf("{\"event\":\"dinplug_mappings\",\"count\":%u,\"offset\":%u,\"next\":%u}\r\n", this->mappingCount, offset, end);
+  else
+    out.printf("{\"event\":\"dinplug_mappings\",\"count\":%u,\"offset\":%u}\r\n", this->mappingCount, offset);
+  for(uint16_t i = offset; i < end; i++) {
     const Mapping &m = this->mappings[i];
     if(m.commandType == CommandTarget) {
       out.printf("{\"event\":\"dinplug_mapping\",\"index\":%u,\"keypad\":%u,\"button\":%u,\"action\":\"%s\",\"targetType\":\"%s\",\"targetId\":%u,\"command\":\"target\",\"value\":%d}\r\n",
@@ -81,7 +94,7 @@ void DinplugBridge::printMappings(Stream &out) {
     else {
       out.printf("{\"event\":\"dinplug_mapping\",\"index\":%u,\"keypad\":%u,\"button\":%u,\"action\":\"%s\",\"targetType\":\"%s\",\"targetId\":%u,\"command\":\"%s\"}\r\n",
                  i, m.keypadId, m.buttonId, this->actionToString(m.action),
-                 this->targetTypeToString(m.targetType), m.targetId, this->commandTypeToString(m.commandType, m.command));
+                 this->targetTypeToString(m.targetType), m.targetId, this->commandToString(m).c_str());
     }
   }
 }
@@ -122,7 +135,7 @@ bool DinplugBridge::connectNow(String &message) {
 bool DinplugBridge::disconnect(String &message) {
   this->client.stop();
   this->wasConnected = false;
-  this->rxBuffer = "";
+  this->resetRx();
   message = "{\"event\":\"dinplug\",\"msg\":\"Disconnected\"}";
   return true;
 }
@@ -134,13 +147,13 @@ bool DinplugBridge::clearMappings(String &message) {
   return true;
 }
 
-bool DinplugBridge::removeMapping(uint8_t index, String &message) {
+bool DinplugBridge::removeMapping(uint16_t index, String &message) {
   if(index >= this->mappingCount) {
     message = "{\"event\":\"error\",\"msg\":\"Mapping index out of range\"}";
     return false;
   }
-  for(uint8_t i = index; i + 1 < this->mappingCount; i++) this->mappings[i] = this->mappings[i + 1];
-  if(this->mappingCount > 0) this->mappingCount--;
+  memmove(&this->mappings[index], &this->mappings[index + 1], (this->mappingCount - index - 1) * sizeof(Mapping));
+  this->mappingCount--;
   this->saveConfig();
   message = "{\"event\":\"dinplug\",\"msg\":\"Mapping removed\"}";
   return true;
@@ -167,7 +180,7 @@ bool DinplugBridge::addMapping(uint16_t keypadId, uint16_t buttonId, const char
     message = "{\"event\":\"error\",\"msg\":\"Invalid target type\"}";
     return false;
   }
-  Mapping &m = this->mappings[this->mappingCount];
+  Mapping m;
   m.keypadId = keypadId;
   m.buttonId = buttonId;
   m.action = action;
@@ -180,7 +193,6 @@ bool DinplugBridge::addMapping(uint16_t keypadId, uint16_t buttonId, const char
     }
     m.commandType = CommandTarget;
     m.value = constrain(value, 0, 100);
-    strlcpy(m.command, "target", sizeof(m.command));
   }
   else if(strcasecmp(commandName, "cycle") == 0 || strcasecmp(commandName, "shade_toggle") == 0) {
     if(targetType != TargetShade) {
@@ -188,15 +200,12 @@ bool DinplugBridge::addMapping(uint16_t keypadId, uint16_t buttonId, const char
       return false;
     }
     m.commandType = CommandCycle;
-    m.value = 0;
-    strlcpy(m.command, "cycle", sizeof(m.command));
   }
   else {
     m.commandType = CommandSomfy;
-    strlcpy(m.command, commandName, sizeof(m.command));
-    m.value = 0;
+    m.command = static_cast<uint8_t>(translateSomfyCommand(commandName));
   }
-  this->mappingCount++;
+  this->insertMapping(m);
   this->saveConfig();
   message = "{\"event\":\"dinplug\",\"msg\":\"Mapping added\"}";
   return true;
@@ -207,74 +216,94 @@ void DinplugBridge::toJSON(JsonObject obj) {
   obj["autoConnect"] = this->autoConnect;
   obj["connected"] = this->client.connected();
   obj["mappingCount"] = this->mappingCount;
+  obj["maxMappings"] = kMaxMappings;
+  obj["mappingBytes"] = sizeof(this->mappings);
   obj["status"] = this->connectionLabel();
 }
 
-void DinplugBridge::mappingsToJSON(JsonArray arr) {
-  for(uint8_t i = 0; i < this->mappingCount; i++) {
+void DinplugBridge::mappingsToJSON(JsonFormatter &json) {
+  for(uint16_t i = 0; i < this->mappingCount; i++) {
     const Mapping &m = this->mappings[i];
-    JsonObject obj = arr.createNestedObject();
-    obj["index"] = i;
-    obj["keypadId"] = m.keypadId;
-    obj["buttonId"] = m.buttonId;
-    obj["action"] = this->actionToString(m.action);
-    obj["targetType"] = this->targetTypeToString(m.targetType);
-    obj["targetId"] = m.targetId;
-    obj["command"] = this->commandTypeToString(m.commandType, m.command);
-    if(m.commandType == CommandTarget) obj["value"] = m.value;
+    json.beginObject();
+    json.addElem("index", static_cast<uint32_t>(i));
+    json.addElem("keypadId", static_cast<uint32_t>(m.keypadId));
+    json.addElem("buttonId", static_cast<uint32_t>(m.buttonId));
+    json.addElem("action", this->actionToString(m.action));
+    json.addElem("targetType", this->targetTypeToString(m.targetType));
+    json.addElem("targetId", m.targetId);
+    json.addElem("command", this->commandToString(m).c_str());
+    if(m.commandType == CommandTarget) json.addElem("value", m.value);
+    json.endObject();
   }
 }
 
+// The mappings are read one at a time so the document only ever holds a single mapping
+// no matter how many are configured.  Files from before the command code was stored
+// fall back to the command name.
 bool DinplugBridge::loadConfig() {
   if(!LittleFS.exists(kConfigPath)) return true;
   File file = LittleFS.open(kConfigPath, "r");
   if(!file) return false;
-  DynamicJsonDocument doc(8192);
-  const DeserializationError err = deserializeJson(doc, file);
-  file.close();
+  StaticJsonDocument<64> filter;
+  filter["gateway_host"] = true;
+  filter["auto_connect"] = true;
+  DinplugJsonDocument doc(512);
+  DeserializationError err = deserializeJson(doc, file, DeserializationOption::Filter(filter));
   if(err) {
+    file.close();
     Serial.printf("dinplug: failed to load config: %s\n", err.c_str());
     return false;
   }
   strlcpy(this->gatewayHost, doc["gateway_host"] | "", sizeof(this->gatewayHost));
   this->autoConnect = doc["auto_connect"] | false;
   this->mappingCount = 0;
-  JsonArray arr = doc["mappings"].as<JsonArray>();
-  for(JsonObject obj : arr) {
-    if(this->mappingCount >= kMaxMappings) break;
-    Mapping &m = this->mappings[this->mappingCount++];
-    m.keypadId = obj["keypad_id"] | 0;
-    m.buttonId = obj["button_id"] | 0;
-    m.action = obj["action"] | static_cast<uint8_t>(ActionPress);
-    m.targetType = obj["target_type"] | static_cast<uint8_t>(TargetShade);
-    m.targetId = obj["target_id"] | 0;
-    m.commandType = obj["command_type"] | static_cast<uint8_t>(CommandSomfy);
-    m.value = obj["value"] | 0;
-    strlcpy(m.command, obj["command"] | "My", sizeof(m.command));
+  file.seek(0);
+  if(file.find("\"mappings\":[")) {
+    do {
+      err = deserializeJson(doc, file);
+      if(err) break;
+      JsonObject obj = doc.as<JsonObject>();
+      Mapping m;
+      m.keypadId = obj["keypad_id"] | 0;
+      m.buttonId = obj["button_id"] | 0;
+      m.action = obj["action"] | static_cast<uint8_t>(ActionPress);
+      m.targetType = obj["target_type"] | static_cast<uint8_t>(TargetShade);
+      m.targetId = obj["target_id"] | 0;
+      m.commandType = obj["command_type"] | static_cast<uint8_t>(CommandSomfy);
+      m.value = obj["value"] | 0;
+      if(obj.containsKey("command_code")) m.command = obj["command_code"].as<uint8_t>();
+      else m.command = static_cast<uint8_t>(translateSomfyCommand(obj["command"] | "My"));
+      if(!this->insertMapping(m)) break;
+    } while(file.findUntil(",", "]"));
   }
+  file.close();
+  Serial.printf("dinplug: loaded %u mappings (%u bytes)\n", this->mappingCount, static_cast<unsigned>(sizeof(this->mappings)));
   return true;
 }
 
 bool DinplugBridge::saveConfig() {
-  DynamicJsonDocument doc(8192);
+  File file = LittleFS.open(kConfigPath, "w");
+  if(!file) return false;
+  DinplugJsonDocument doc(512);
   doc["gateway_host"] = this->gatewayHost;
   doc["auto_connect"] = this->autoConnect;
-  JsonArray arr = doc.createNestedArray("mappings");
-  for(uint8_t i = 0; i < this->mappingCount; i++) {
+  char head[192];
+  const size_t len = serializeJson(doc, head, sizeof(head));
+  if(len == 0 || len >= sizeof(head) - 1) {
+    file.close();
+    return false;
+  }
+  // The mappings are written last and one at a time so the loader can stream them.
+  head[len - 1] = '\0';
+  size_t written = file.print(head);
+  file.print(",\"mappings\":[");
+  for(uint16_t i = 0; i < this->mappingCount; i++) {
     const Mapping &m = this->mappings[i];
-    JsonObject obj = arr.createNestedObject();
-    obj["keypad_id"] = m.keypadId;
-    obj["button_id"] = m.buttonId;
-    obj["action"] = m.action;
-    obj["target_type"] = m.targetType;
-    obj["target_id"] = m.targetId;
-    obj["command_type"] = m.commandType;
-    obj["command"] = m.command;
-    obj["value"] = m.value;
+    file.printf("%s{\"keypad_id\":%u,\"button_id\":%u,\"action\":%u,\"target_type\":%u,\"target_id\":%u,\"command_type\":%u,\"command_code\":%u,\"command\":\"%s\",\"value\":%d}",
+                i > 0 ? "," : "", m.keypadId, m.buttonId, m.action, m.targetType, m.targetId, m.commandType, m.command,
+                translateSomfyCommand(static_cast<somfy_commands>(m.command)).c_str(), m.value);
   }
-  File file = LittleFS.open(kConfigPath, "w");
-  if(!file) return false;
-  const size_t written = serializeJson(doc, file);
+  written += file.print("]}");
   file.close();
   return written > 0;
 }
@@ -293,7 +322,7 @@ bool DinplugBridge::ensureConnected(bool forceNow) {
   if(this->client.connect(this->gatewayHost, kDinplugPort)) {
     this->client.setNoDelay(true);
     this->wasConnected = true;
-    this->rxBuffer = "";
+    this->resetRx();
     this->lastKeepAliveMs = millis();
     this->lastRxMs = millis();
     Serial.println("dinplug: connected");
@@ -304,9 +333,11 @@ bool DinplugBridge::ensureConnected(bool forceNow) {
   return false;
 }
 
-bool DinplugBridge::sendCommand(const String &cmd) {
+bool DinplugBridge::sendCommand(const char *cmd) {
   if(!this->client.connected()) return false;
-  const size_t written = this->client.print(cmd + "\r\n");
+  char buf[64];
+  const int len = snprintf(buf, sizeof(buf), "%s\r\n", cmd);
+  const size_t written = len > 0 ? this->client.write(reinterpret_cast<const uint8_t *>(buf), min(len, (int)sizeof(buf) - 1)) : 0;
   if(written == 0) {
     this->client.stop();
     this->wasConnected = false;
@@ -316,46 +347,100 @@ bool DinplugBridge::sendCommand(const String &cmd) {
   return true;
 }
 
-void DinplugBridge::processLine(const String &line) {
-  String trimmed = line;
-  trimmed.trim();
-  if(trimmed.length() == 0) return;
-  if(trimmed.startsWith("R:")) trimmed = trimmed.substring(2);
-  if(!trimmed.startsWith("BTN ")) return;
+static char *nextToken(char *&p) {
+  while(*p == ' ' || *p == '\t') p++;
+  if(*p == '\0') return nullptr;
+  char *tok = p;
+  while(*p && *p != ' ' && *p != '\t') p++;
+  if(*p) *p++ = '\0';
+  return tok;
+}
 
-  const int firstSpace = trimmed.indexOf(' ');
-  const int secondSpace = trimmed.indexOf(' ', firstSpace + 1);
-  const int thirdSpace = trimmed.indexOf(' ', secondSpace + 1);
-  if(firstSpace < 0 || secondSpace < 0 || thirdSpace < 0) return;
+static bool parseId16(const char *tok, uint16_t &id) {
+  if(tok == nullptr || !isdigit(static_cast<unsigned char>(*tok))) return false;
+  char *end = nullptr;
+  const unsigned long val = strtoul(tok, &end, 10);
+  if(*end != '\0' || val > 0xFFFF) return false;
+  id = static_cast<uint16_t>(val);
+  return true;
+}
+
+// Splits "[R:]BTN <action> <keypad> <button>" in place.  Anything else the gateway sends
+// is rejected on its first characters without being copied.
+bool DinplugBridge::parseButtonLine(char *line, uint8_t &action, uint16_t &keypadId, uint16_t &buttonId) const {
+  char *p = line;
+  while(isspace(static_cast<unsigned char>(*p))) p++;
+  if(strncmp(p, "R:", 2) == 0) p += 2;
+  if(strncmp(p, "BTN ", 4) != 0) return false;
+  p += 4;
+  char *end = p + strlen(p);
+  while(end > p && isspace(static_cast<unsigned char>(end[-1]))) *--end = '\0';
+  const char *actionName = nextToken(p);
+  const char *keypadTok = nextToken(p);
+  const char *buttonTok = nextToken(p);
+  if(!this->parseAction(actionName, action)) return false;
+  return parseId16(keypadTok, keypadId) && parseId16(buttonTok, buttonId);
+}
 
-  const String actionName = trimmed.substring(firstSpace + 1, secondSpace);
-  const uint16_t keypadId = static_cast<uint16_t>(trimmed.substring(secondSpace + 1, thirdSpace).toInt());
-  const uint16_t buttonId = static_cast<uint16_t>(trimmed.substring(thirdSpace + 1).toInt());
+void DinplugBridge::processLine(char *line) {
   uint8_t action = ActionPress;
-  if(!this->parseAction(actionName.c_str(), action)) return;
+  uint16_t keypadId = 0;
+  uint16_t buttonId = 0;
+  if(!this->parseButtonLine(line, action, keypadId, buttonId)) return;
   this->handleButtonEvent(keypadId, buttonId, static_cast<ActionType>(action));
 }
 
+int DinplugBridge::compareMapping(const Mapping &m, uint16_t keypadId, uint16_t buttonId, uint8_t action) {
+  if(m.keypadId != keypadId) return m.keypadId < keypadId ? -1 : 1;
+  if(m.buttonId != buttonId) return m.buttonId < buttonId ? -1 : 1;
+  if(m.action != action) return m.action < action ? -1 : 1;
+  return 0;
+}
+
+uint16_t DinplugBridge::lowerBound(uint16_t keypadId, uint16_t buttonId, uint8_t action) const {
+  uint16_t lo = 0;
+  uint16_t hi = this->mappingCount;
+  while(lo < hi) {
+    const uint16_t mid = (lo + hi) / 2;
+    if(compareMapping(this->mappings[mid], keypadId, buttonId, action) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// A new mapping goes after any others for the same button so they run in the order
+// they were added.
+bool DinplugBridge::insertMapping(const Mapping &mapping) {
+  if(this->mappingCount >= kMaxMappings) return false;
+  uint16_t index = this->lowerBound(mapping.keypadId, mapping.buttonId, mapping.action);
+  while(index < this->mappingCount && compareMapping(this->mappings[index], mapping.keypadId, mapping.buttonId, mapping.action) == 0) index++;
+  memmove(&this->mappings[index + 1], &this->mappings[index], (this->mappingCount - index) * sizeof(Mapping));
+  this->mappings[index] = mapping;
+  this->mappingCount++;
+  return true;
+}
+
+// All the mappings for a button are sent as one batch and logged with one line.
 void DinplugBridge::handleButtonEvent(uint16_t keypadId, uint16_t buttonId, ActionType action) {
-  for(uint8_t i = 0; i < this->mappingCount; i++) {
-    const Mapping &m = this->mappings[i];
-    if(m.keypadId != keypadId || m.buttonId != buttonId || m.action != action) continue;
-    String detail;
-    if(this->applyMapping(m, detail)) {
-      Serial.printf("dinplug: applied mapping idx=%u keypad=%u button=%u action=%s %s\n",
-                    i, keypadId, buttonId, this->actionToString(action), detail.c_str());
-    }
-    else {
-      Serial.printf("dinplug: mapping idx=%u failed: %s\n", i, detail.c_str());
-    }
+  const uint16_t first = this->lowerBound(keypadId, buttonId, action);
+  uint16_t applied = 0;
+  uint16_t i = first;
+  char detail[48];
+  for(; i < this->mappingCount && compareMapping(this->mappings[i], keypadId, buttonId, action) == 0; i++) {
+    if(this->applyMapping(this->mappings[i], detail, sizeof(detail))) applied++;
+    else Serial.printf("dinplug: mapping idx=%u failed: %s\n", i, detail);
+  }
+  if(i > first) {
+    Serial.printf("dinplug: keypad=%u button=%u action=%s applied %u of %u mappings\n",
+                  keypadId, buttonId, this->actionToString(action), applied, i - first);
   }
 }
 
-bool DinplugBridge::applyMapping(const Mapping &mapping, String &detail) {
+bool DinplugBridge::applyMapping(const Mapping &mapping, char *detail, size_t size) {
   if(mapping.targetType == TargetShade) {
     SomfyShade *shade = somfy.getShadeById(mapping.targetId);
     if(!shade) {
-      detail = "shade not found";
+      snprintf(detail, size, "shade %u not found", mapping.targetId);
       return false;
     }
     if(mapping.commandType == CommandCycle) {
@@ -380,35 +465,35 @@ bool DinplugBridge::applyMapping(const Mapping &mapping, String &detail) {
       }
       shade->sendCommand(cycleCmd, shade->repeats);
       shade->emitState();
-      detail = "cycle cmd " + translateSomfyCommand(cycleCmd);
+      snprintf(detail, size, "cycle cmd %u", static_cast<uint8_t>(cycleCmd));
       return true;
     }
     if(mapping.commandType == CommandTarget) {
       shade->moveToTarget(shade->transformPosition(constrain(mapping.value, 0, 100)));
       shade->emitState();
-      detail = "target " + String(mapping.value);
+      snprintf(detail, size, "target %d", mapping.value);
       return true;
     }
-    const somfy_commands cmd = translateSomfyCommand(String(mapping.command));
+    const somfy_commands cmd = static_cast<somfy_commands>(mapping.command);
     shade->sendCommand(cmd, shade->repeats);
     shade->emitState();
-    detail = "shade cmd " + String(mapping.command);
+    snprintf(detail, size, "shade cmd %u", mapping.command);
     return true;
   }
 
   SomfyGroup *group = somfy.getGroupById(mapping.targetId);
   if(!group) {
-    detail = "group not found";
+    snprintf(detail, size, "group %u not found", mapping.targetId);
     return false;
   }
   if(mapping.commandType == CommandTarget) {
-    detail = "groups do not support target positions";
+    snprintf(detail, size, "groups do not support target positions");
     return false;
   }
-  const somfy_commands cmd = translateSomfyCommand(String(mapping.command));
+  const somfy_commands cmd = static_cast<somfy_commands>(mapping.command);
   group->sendCommand(cmd, group->repeats);
   group->emitState();
-  detail = "group cmd " + String(mapping.command);
+  snprintf(detail, size, "group cmd %u", mapping.command);
   return true;
 }
 
@@ -430,10 +515,10 @@ const char *DinplugBridge::targetTypeToString(uint8_t targetType) const {
   }
 }
 
-const char *DinplugBridge::commandTypeToString(uint8_t commandType, const char *command) const {
-  if(commandType == CommandTarget) return "target";
-  if(commandType == CommandCycle) return "cycle";
-  return command;
+String DinplugBridge::commandToString(const Mapping &mapping) const {
+  if(mapping.commandType == CommandTarget) return "target";
+  if(mapping.commandType == CommandCycle) return "cycle";
+  return translateSomfyCommand(static_cast<somfy_commands>(mapping.command));
 }
 
 bool DinplugBridge::parseAction(const char *name, uint8_t &action) const {
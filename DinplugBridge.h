@@ -4,33 +4,34 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <WiFi.h>
+#include "WResp.h"
 
 class DinplugBridge {
   public:
     DinplugBridge();
     void begin();
     void loop();
-    void printHelp(Stream &out);
-    void printStatus(Stream &out);
-    void printMappings(Stream &out);
+    void printStatus(Print &out);
+    void printMappings(Print &out, uint16_t offset, uint16_t count);
     bool setGatewayHost(const char *host, String &message);
     bool setAutoConnect(bool enabled, String &message);
     bool connectNow(String &message);
     bool disconnect(String &message);
     bool clearMappings(String &message);
-    bool removeMapping(uint8_t index, String &message);
+    bool removeMapping(uint16_t index, String &message);
     bool addMapping(uint16_t keypadId, uint16_t buttonId, const char *actionName,
                     const char *targetTypeName, uint8_t targetId,
                     const char *commandName, int16_t value, String &message);
     void toJSON(JsonObject obj);
-    void mappingsToJSON(JsonArray arr);
+    void mappingsToJSON(JsonFormatter &json);
 
   private:
     static const uint16_t kDinplugPort = 23;
-    static const uint8_t kMaxMappings = 48;
+    static const uint16_t kMaxMappings = 256;
     static const unsigned long kReconnectIntervalMs = 5000;
     static const unsigned long kKeepAliveIntervalMs = 10000;
     static const unsigned long kRxTimeoutMs = 25000;
+    static const uint16_t kRxBufferSize = 512;
     static const char *kConfigPath;
 
     enum ActionType : uint8_t {
@@ -48,6 +49,8 @@ class DinplugBridge {
       CommandTarget = 1,
       CommandCycle = 2
     };
+    // The command is kept as its somfy code and the target as a percentage so a mapping
+    // is 10 bytes and a large install fits a few hundred of them.
     struct Mapping {
       uint16_t keypadId = 0;
       uint16_t buttonId = 0;
@@ -55,31 +58,42 @@ class DinplugBridge {
       uint8_t targetType = TargetShade;
       uint8_t targetId = 0;
       uint8_t commandType = CommandSomfy;
-      int16_t value = 0;
-      char command[16] = "My";
+      uint8_t command = static_cast<uint8_t>(somfy_commands::My);
+      int8_t value = 0;
     };
 
     WiFiClient client;
-    String rxBuffer;
+    // Lines are gathered in place.  A line longer than the buffer is dropped up to its
+    // newline rather than processed in pieces.
+    char rxBuffer[kRxBufferSize];
+    uint16_t rxLength = 0;
+    bool rxOverflow = false;
     char gatewayHost[65];
     bool autoConnect = false;
     bool wasConnected = false;
     unsigned long lastAttemptMs = 0;
     unsigned long lastKeepAliveMs = 0;
     unsigned long lastRxMs = 0;
+    // Sorted by keypad, button and action so the mappings for a button are found with a
+    // binary search and sit next to each other in the order they were added.
     Mapping mappings[kMaxMappings];
-    uint8_t mappingCount = 0;
+    uint16_t mappingCount = 0;
 
     bool loadConfig();
     bool saveConfig();
     bool ensureConnected(bool forceNow);
-    bool sendCommand(const String &cmd);
-    void processLine(const String &line);
+    bool sendCommand(const char *cmd);
+    void resetRx();
+    void processLine(char *line);
+    bool parseButtonLine(char *line, uint8_t &action, uint16_t &keypadId, uint16_t &buttonId) const;
+    static int compareMapping(const Mapping &m, uint16_t keypadId, uint16_t buttonId, uint8_t action);
+    uint16_t lowerBound(uint16_t keypadId, uint16_t buttonId, uint8_t action) const;
+    bool insertMapping(const Mapping &mapping);
     void handleButtonEvent(uint16_t keypadId, uint16_t buttonId, ActionType action);
-    bool applyMapping(const Mapping &mapping, String &detail);
+    bool applyMapping(const Mapping &mapping, char *detail, size_t size);
     const char *actionToString(uint8_t action) const;
     const char *targetTypeToString(uint8_t targetType) const;
-    const char *commandTypeToString(uint8_t commandType, const char *command) const;
+    String commandToString(const Mapping &mapping) const;
     bool parseAction(const char *name, uint8_t &action) const;
     bool parseTargetType(const char *name, uint8_t &targetType) const;
     String connectionLabel();
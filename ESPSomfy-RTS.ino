@@ -11,6 +11,10 @@
 #include "GitOTA.h"
 #include "TelnetServer.h"
 #include "DinplugBridge.h"
+#include "Boot.h"
+#include "Metrics.h"
+#include "Profiler.h"
+#include "StateBus.h"
 
 ConfigSettings settings;
 Web webServer;
@@ -23,36 +27,63 @@ GitUpdater git;
 TelnetServer telnet;
 
 uint32_t oldheap = 0;
-void setup() {
-  Serial.begin(115200);
-  Serial.println();
-  Serial.println("Startup/Boot....");
+BootSequencer boot;
+Metrics metrics;
+LoopProfiler profiler;
+StateBus stateBus;
+
+static bool mountFileSystem() {
   Serial.println("Mounting File System...");
   if(LittleFS.begin()) {
     Serial.println("File system mounted successfully");
+    return true;
   }
-  else {
-    Serial.println("Error mounting file system; formatting...");
-    if(LittleFS.format() && LittleFS.begin()) Serial.println("LittleFS formatted and mounted");
-    else Serial.println("LittleFS format/mount failed");
+  Serial.println("Error mounting file system; formatting...");
+  if(LittleFS.format() && LittleFS.begin()) {
+    Serial.println("LittleFS formatted and mounted");
+    return true;
   }
-  settings.begin();
-  if(WiFi.status() == WL_CONNECTED) WiFi.disconnect(true);
-  delay(10);
+  Serial.println("LittleFS format/mount failed");
+  return false;
+}
+void setup() {
+  Serial.begin(115200);
   Serial.println();
-  webServer.startup();
-  webServer.begin();
-  delay(1000);
-  net.setup();  
-  somfy.begin();
-  telnet.begin();
-  dinplugBridge.begin();
+  Serial.println("Startup/Boot....");
+  // Each stage declares the stages it depends upon.  The radio is brought up as soon
+  // as the configuration is loaded so it does not wait behind the network, and the
+  // dinplug bridge waits for a network link instead of a fixed delay.
+  uint8_t fs = boot.addStage("filesystem", 0, mountFileSystem);
+  uint8_t cfg = boot.addStage("settings", BOOT_DEP(fs), []() {
+    settings.begin();
+    if(WiFi.status() == WL_CONNECTED) WiFi.disconnect(true);
+    return true;
+  });
+  uint8_t radio = boot.addStage("radio", BOOT_DEP(cfg), []() { return somfy.begin(); });
+  boot.addStage("web", BOOT_DEP(cfg), []() {
+    webServer.startup();
+    webServer.begin();
+    return true;
+  });
+  uint8_t netw = boot.addStage("network", BOOT_DEP(cfg), []() { return net.setup(); });
+  boot.addStage("telnet", BOOT_DEP(netw), []() { telnet.begin(); return true; });
+  uint8_t link = boot.addStage("link", BOOT_DEP(netw), nullptr, []() { return net.connected() || net.softAPOpened; });
+  boot.addStage("dinplug", BOOT_DEP(radio) | BOOT_DEP(link), []() { dinplugBridge.begin(); return true; });
+  boot.begin();
   //git.checkForUpdate();
   esp_task_wdt_init(7, true); //enable panic so ESP32 restarts
   esp_task_wdt_add(NULL); //add current thread to WDT watch
 
 }
 
+// Records the time spent in a stage of the loop and returns the start of the next one.
+static uint32_t endStage(prof_stages_t stage, uint32_t start) {
+  uint32_t now = LoopProfiler::cycles();
+  uint32_t us = profiler.record(stage, now - start);
+  metrics.observe(metric_families_t::loop, LoopProfiler::stageName(stage), us);
+  if(us > 100000) Serial.printf("Timing %s: %lums\n", LoopProfiler::stageName(stage), us / 1000);
+  return now;
+}
 void loop() {
   // put your main code here, to run repeatedly:
   //uint32_t heap = ESP.getFreeHeap();
@@ -64,33 +95,31 @@ void loop() {
     ESP.restart();
     return;
   }
-  uint32_t timing = millis();
-  
+  uint32_t timing = LoopProfiler::cycles();
+  boot.loop();
   net.loop();
-  if(millis() - timing > 100) Serial.printf("Timing Net: %ldms\n", millis() - timing);
-  timing = millis();
+  timing = endStage(prof_stages_t::net, timing);
   esp_task_wdt_reset();
   somfy.loop();
-  if(millis() - timing > 100) Serial.printf("Timing Somfy: %ldms\n", millis() - timing);
-  timing = millis();
+  timing = endStage(prof_stages_t::somfy, timing);
   esp_task_wdt_reset();
   if(net.connected() || net.softAPOpened) {
     if(!rebootDelay.reboot && net.connected() && !net.softAPOpened) {
       git.loop();
       esp_task_wdt_reset();
+      timing = endStage(prof_stages_t::git, timing);
     }
     webServer.loop();
     esp_task_wdt_reset();
-    if(millis() - timing > 100) Serial.printf("Timing WebServer: %ldms\n", millis() - timing);
-    esp_task_wdt_reset();
-    timing = millis();
+    timing = endStage(prof_stages_t::web, timing);
     sockEmit.loop();
-    if(millis() - timing > 100) Serial.printf("Timing Socket: %ldms\n", millis() - timing);
+    timing = endStage(prof_stages_t::socket, timing);
     esp_task_wdt_reset();
-    timing = millis();
     dinplugBridge.loop();
+    timing = endStage(prof_stages_t::dinplug, timing);
     esp_task_wdt_reset();
     telnet.loop();
+    timing = endStage(prof_stages_t::telnet, timing);
     esp_task_wdt_reset();
   }
   if(rebootDelay.reboot && millis() > rebootDelay.rebootTime) {
@@ -11,6 +11,7 @@
 #include "Web.h"
 #include "WResp.h"
 #include "Network.h"
+#include "HeapTracker.h"
 
 
 
@@ -328,7 +329,7 @@ void GitUpdater::toJSON(JsonResponse &json) {
   json.endObject();
 }
 void GitUpdater::emitUpdateCheck(uint8_t num) {
-  JsonSockEvent *json = sockEmit.beginEmit("fwStatus");
+  JsonSockEvent *json = sockEmit.beginEmit("fwStatus", 0);
   json->beginObject();
   json->addElem("available", this->updateAvailable);
   json->addElem("status", this->status);
@@ -381,7 +382,7 @@ int GitUpdater::checkInternet() {
 }
 void GitUpdater::emitDownloadProgress(size_t total, size_t loaded, const char *evt) { this->emitDownloadProgress(255, total, loaded, evt); }
 void GitUpdater::emitDownloadProgress(uint8_t num, size_t total, size_t loaded, const char *evt) {
-  JsonSockEvent *json = sockEmit.beginEmit(evt);
+  JsonSockEvent *json = sockEmit.beginEmit(evt, 0);
   json->beginObject();
   json->addElem("ver", this->targetRelease);
   json->addElem("part", (int32_t)this->partition);
@@ -496,7 +497,7 @@ int8_t GitUpdater::downloadFile() {
           https.end();
           return -(Update.getError() + UPDATE_ERR_OFFSET);
         }
-        uint8_t *buff = (uint8_t *)malloc(MAX_BUFF_SIZE);
+        uint8_t *buff = (uint8_t *)HeapTracker::alloc(heap_tags_t::git, MAX_BUFF_SIZE);
         if(buff) {
           this->emitDownloadProgress(len, total);
           int timeouts = 0;
@@ -507,7 +508,7 @@ int8_t GitUpdater::downloadFile() {
               timeouts = 0;
               if(this->cancelled && !this->lockFS) {
                 Update.abort();
-                free(buff);
+                HeapTracker::free(heap_tags_t::git, buff);
                 https.end();
                 return -(Update.getError() + UPDATE_ERR_OFFSET);
               }
@@ -517,7 +518,7 @@ int8_t GitUpdater::downloadFile() {
               if (Update.write(buff, c) != c) {
                 Update.printError(Serial);
                 Serial.printf("Upload of %s aborted invalid size %d\n", url, c);
-                free(buff);
+                HeapTracker::free(heap_tags_t::git, buff);
                 https.end();
                 sclient.stop();
                 return -(Update.getError() + UPDATE_ERR_OFFSET);
@@ -547,7 +548,7 @@ int8_t GitUpdater::downloadFile() {
               if(timeouts >= 500) {
                 Update.abort();
                 https.end();
-                free(buff);
+                HeapTracker::free(heap_tags_t::git, buff);
                 Serial.println("Stream timeout!!!");
                 return -43;
               }
@@ -556,7 +557,7 @@ int8_t GitUpdater::downloadFile() {
               delay(100);
             }
           }
-          free(buff);
+          HeapTracker::free(heap_tags_t::git, buff);
           if(len > total) {
             Update.abort();
             somfy.commit();
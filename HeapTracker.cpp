@@ -0,0 +1,148 @@
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include "HeapTracker.h"
+#include "WResp.h"
+#include "Metrics.h"
+
+static const char *g_tagNames[HEAP_MAX_TAGS] = {"web", "dinplug", "git", "settings", "mqtt", "ssdp"};
+static heap_tag_stats_t g_tags[HEAP_MAX_TAGS];
+static portMUX_TYPE g_heapMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t g_windowStart = 0;
+static uint32_t g_windowAllocs = 0;
+static uint32_t g_allocRate = 0;
+
+// The header is kept at 8 bytes so the block handed back keeps the alignment malloc gives.
+struct heap_block_t {
+  uint32_t size;
+  uint32_t reserved;
+};
+// Closes the rate window once it has run its length.  This is called with g_heapMux held
+// from both the allocations and the readers so the window moves even when nobody reads
+// it, and a window that ran long is scaled back to allocations per window.
+static void rollWindow(uint32_t now) {
+  uint32_t elapsed = now - g_windowStart;
+  if(elapsed < HEAP_RATE_WINDOW) return;
+  g_allocRate = (uint32_t)(((uint64_t)g_windowAllocs * HEAP_RATE_WINDOW) / elapsed);
+  g_windowAllocs = 0;
+  g_windowStart = now;
+}
+static void chargeAlloc(heap_tags_t tag, size_t size) {
+  heap_tag_stats_t &t = g_tags[static_cast<uint8_t>(tag)];
+  uint32_t now = millis();
+  portENTER_CRITICAL(&g_heapMux);
+  rollWindow(now);
+  t.allocs++;
+  t.bytes += size;
+  if(t.bytes > t.peak) t.peak = t.bytes;
+  g_windowAllocs++;
+  portEXIT_CRITICAL(&g_heapMux);
+}
+static void chargeFree(heap_tags_t tag, size_t size) {
+  heap_tag_stats_t &t = g_tags[static_cast<uint8_t>(tag)];
+  portENTER_CRITICAL(&g_heapMux);
+  t.frees++;
+  t.bytes = t.bytes > size ? t.bytes - size : 0;
+  portEXIT_CRITICAL(&g_heapMux);
+}
+static void chargeFailure(heap_tags_t tag) {
+  portENTER_CRITICAL(&g_heapMux);
+  g_tags[static_cast<uint8_t>(tag)].failures++;
+  portEXIT_CRITICAL(&g_heapMux);
+}
+void *HeapTracker::alloc(heap_tags_t tag, size_t size) {
+  heap_block_t *block = (heap_block_t *)::malloc(sizeof(heap_block_t) + size);
+  if(!block) {
+    chargeFailure(tag);
+    return nullptr;
+  }
+  block->size = size;
+  chargeAlloc(tag, size);
+  return block + 1;
+}
+void *HeapTracker::realloc(heap_tags_t tag, void *ptr, size_t size) {
+  if(!ptr) return HeapTracker::alloc(tag, size);
+  heap_block_t *block = (heap_block_t *)ptr - 1;
+  uint32_t oldSize = block->size;
+  heap_block_t *resized = (heap_block_t *)::realloc(block, sizeof(heap_block_t) + size);
+  if(!resized) {
+    chargeFailure(tag);
+    return nullptr;
+  }
+  resized->size = size;
+  heap_tag_stats_t &t = g_tags[static_cast<uint8_t>(tag)];
+  portENTER_CRITICAL(&g_heapMux);
+  t.bytes = (t.bytes > oldSize ? t.bytes - oldSize : 0) + size;
+  if(t.bytes > t.peak) t.peak = t.bytes;
+  portEXIT_CRITICAL(&g_heapMux);
+  return resized + 1;
+}
+void HeapTracker::free(heap_tags_t tag, void *ptr) {
+  if(!ptr) return;
+  heap_block_t *block = (heap_block_t *)ptr - 1;
+  chargeFree(tag, block->size);
+  ::free(block);
+}
+const char *HeapTracker::tagName(heap_tags_t tag) {
+  uint8_t ndx = static_cast<uint8_t>(tag);
+  return ndx < HEAP_MAX_TAGS ? g_tagNames[ndx] : "unknown";
+}
+void HeapTracker::getStats(heap_tags_t tag, heap_tag_stats_t &stats) {
+  portENTER_CRITICAL(&g_heapMux);
+  stats = g_tags[static_cast<uint8_t>(tag)];
+  portEXIT_CRITICAL(&g_heapMux);
+}
+uint32_t HeapTracker::allocRate() {
+  // The rate is the tracked allocations made over the last full window.
+  uint32_t now = millis();
+  portENTER_CRITICAL(&g_heapMux);
+  rollWindow(now);
+  uint32_t rate = g_allocRate;
+  portEXIT_CRITICAL(&g_heapMux);
+  return rate;
+}
+uint8_t HeapTracker::fragmentation() {
+  // The share of free memory that cannot be handed out in a single block.  A heap with
+  // plenty free but a small largest block will fail the next large allocation.
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  if(info.total_free_bytes == 0) return 0;
+  return 100 - (uint8_t)(((uint64_t)info.largest_free_block * 100) / info.total_free_bytes);
+}
+void HeapTracker::toJSON(JsonFormatter &json) {
+  json.addElem("largest", (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+  json.addElem("frag", HeapTracker::fragmentation());
+  json.addElem("allocRate", HeapTracker::allocRate());
+  json.beginArray("tags");
+  for(uint8_t i = 0; i < HEAP_MAX_TAGS; i++) {
+    heap_tag_stats_t stats;
+    HeapTracker::getStats(static_cast<heap_tags_t>(i), stats);
+    json.beginObject();
+    json.addElem("name", g_tagNames[i]);
+    json.addElem("bytes", stats.bytes);
+    json.addElem("peak", stats.peak);
+    json.addElem("allocs", stats.allocs);
+    json.addElem("frees", stats.frees);
+    json.addElem("failures", stats.failures);
+    json.endObject();
+  }
+  json.endArray();
+}
+static void writeTagFamily(Print &out, const char *name, const char *type, const char *help, uint32_t heap_tag_stats_t::*field) {
+  out.printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+  for(uint8_t i = 0; i < HEAP_MAX_TAGS; i++) {
+    heap_tag_stats_t stats;
+    HeapTracker::getStats(static_cast<heap_tags_t>(i), stats);
+    out.printf("%s{tag=\"%s\"} %u\n", name, g_tagNames[i], stats.*field);
+  }
+}
+void HeapTracker::writeMetrics(Print &out) {
+  Metrics::writeGauge(out, "espsomfy_heap_free_bytes", "Free heap.", ESP.getFreeHeap());
+  Metrics::writeGauge(out, "espsomfy_heap_min_free_bytes", "Lowest free heap since boot.", ESP.getMinFreeHeap());
+  Metrics::writeGauge(out, "espsomfy_heap_largest_free_block_bytes", "Largest block the heap can hand out.", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+  Metrics::writeGauge(out, "espsomfy_heap_fragmentation_percent", "Share of free heap outside the largest free block.", HeapTracker::fragmentation());
+  Metrics::writeGauge(out, "espsomfy_heap_alloc_rate", "Tracked allocations over the last minute.", HeapTracker::allocRate());
+  writeTagFamily(out, "espsomfy_heap_tag_bytes", "gauge", "Bytes held by each subsystem.", &heap_tag_stats_t::bytes);
+  writeTagFamily(out, "espsomfy_heap_tag_peak_bytes", "gauge", "Most bytes held by each subsystem.", &heap_tag_stats_t::peak);
+  writeTagFamily(out, "espsomfy_heap_tag_allocs_total", "counter", "Allocations made by each subsystem.", &heap_tag_stats_t::allocs);
+  writeTagFamily(out, "espsomfy_heap_tag_failures_total", "counter", "Allocations each subsystem could not get.", &heap_tag_stats_t::failures);
+}
@@ -0,0 +1,50 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#ifndef heaptracker_h
+#define heaptracker_h
+
+#define HEAP_RATE_WINDOW 60000
+
+enum class heap_tags_t : uint8_t {
+  web = 0,
+  dinplug = 1,
+  git = 2,
+  settings = 3,
+  mqtt = 4,
+  ssdp = 5
+};
+#define HEAP_MAX_TAGS 6
+struct heap_tag_stats_t {
+  uint32_t allocs = 0;              // Allocations made since boot.
+  uint32_t frees = 0;               // Allocations released since boot.
+  uint32_t failures = 0;            // Allocations the heap could not satisfy.
+  uint32_t bytes = 0;               // Bytes currently held.
+  uint32_t peak = 0;                // Most bytes held at one time.
+};
+class JsonFormatter;
+// Accounts for the larger buffers each subsystem takes from the heap.  A small header
+// in front of each block holds the size so a free can be charged back to its tag.
+class HeapTracker {
+  public:
+    static void *alloc(heap_tags_t tag, size_t size);
+    static void *realloc(heap_tags_t tag, void *ptr, size_t size);
+    static void free(heap_tags_t tag, void *ptr);
+    static const char *tagName(heap_tags_t tag);
+    static void getStats(heap_tags_t tag, heap_tag_stats_t &stats);
+    static uint32_t allocRate();
+    static uint8_t fragmentation();
+    static void toJSON(JsonFormatter &json);
+    static void writeMetrics(Print &out);
+};
+// An ArduinoJson allocator that charges the document pool to a subsystem.
+template<heap_tags_t TAG>
+struct TaggedAllocator {
+  void *allocate(size_t size) { return HeapTracker::alloc(TAG, size); }
+  void deallocate(void *ptr) { HeapTracker::free(TAG, ptr); }
+  void *reallocate(void *ptr, size_t size) { return HeapTracker::realloc(TAG, ptr, size); }
+};
+typedef BasicJsonDocument<TaggedAllocator<heap_tags_t::web>> WebJsonDocument;
+typedef BasicJsonDocument<TaggedAllocator<heap_tags_t::dinplug>> DinplugJsonDocument;
+typedef BasicJsonDocument<TaggedAllocator<heap_tags_t::settings>> SettingsJsonDocument;
+typedef BasicJsonDocument<TaggedAllocator<heap_tags_t::mqtt>> MqttJsonDocument;
+#endif
@@ -7,6 +7,7 @@
 #include "Somfy.h"
 #include "Network.h"
 #include "Utils.h"
+#include "Metrics.h"
 
 WiFiClient tcpClient;
 PubSubClient mqttClient(tcpClient);
@@ -18,8 +19,16 @@ extern ConfigSettings settings;
 extern SomfyShadeController somfy;
 extern Network net;
 extern rebootDelay_t rebootDelay;
+extern Metrics metrics;
 
 
+// Shades publish each attribute as it changes so only rooms and groups are published
+// from a state change.
+void MQTTClass::onStateChange(state_change_t &change) {
+  if(!this->connected()) return;
+  if(change.kind == state_kinds_t::group) change.group->publish();
+  else if(change.kind == state_kinds_t::room) change.room->publish();
+}
 bool MQTTClass::begin() {
   this->suspended = false;
   return true;
@@ -45,6 +54,7 @@ bool MQTTClass::loop() {
 }
 void MQTTClass::receive(const char *topic, byte*payload, uint32_t length) {
   esp_task_wdt_reset(); // Make sure we do not reboot here.
+  uint32_t start = micros();
   Serial.print("MQTT Topic:");
   Serial.print(topic);
   Serial.print(" payload:");
@@ -183,6 +193,7 @@ void MQTTClass::receive(const char *topic, byte*payload, uint32_t length) {
       }
     }
   }
+  metrics.observe(metric_families_t::mqtt, strlen(command) > 0 ? command : "unknown", micros() - start);
   esp_task_wdt_reset(); // Make sure we do not reboot here.
 }
 bool MQTTClass::connect() {
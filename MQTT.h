@@ -3,6 +3,7 @@
 #include <Arduino.h>
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
+#include "StateBus.h"
 class MQTTClass {
   public:
     uint64_t lastConnect = 0;
@@ -26,6 +27,7 @@ class MQTTClass {
     bool publishDisco(const char *topic, JsonObject &obj, bool retain = false);
     bool subscribe(const char *topic);
     bool unsubscribe(const char *topic);
+    void onStateChange(state_change_t &change);
     static void receive(const char *topic, byte *payload, uint32_t length);
 };
 #endif
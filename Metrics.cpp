@@ -0,0 +1,82 @@
+#include <Arduino.h>
+#include "Metrics.h"
+
+// Upper bound of each bucket in microseconds.  Anything slower than the last bucket
+// is only counted in +Inf.
+static const uint32_t g_bucketUs[METRICS_BUCKETS] = {1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000};
+static const char *g_bucketLe[METRICS_BUCKETS] = {"0.001", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1"};
+struct metrics_family_t {
+  const char *name;
+  const char *label;
+  const char *help;
+};
+static const metrics_family_t g_families[] = {
+  {"espsomfy_http_request_duration_seconds", "route", "Time spent handling http requests."},
+  {"espsomfy_mqtt_command_duration_seconds", "command", "Time spent handling mqtt commands."},
+  {"espsomfy_socket_event_duration_seconds", "event", "Time spent emitting socket events."},
+  {"espsomfy_loop_stage_duration_seconds", "stage", "Time spent in each stage of the main loop."},
+  {"espsomfy_http_auth_duration_seconds", "token", "Time spent checking api keys."}
+};
+
+void metrics_histogram_t::observe(uint32_t us) {
+  for(uint8_t i = 0; i < METRICS_BUCKETS; i++) {
+    if(us <= g_bucketUs[i]) {
+      this->buckets[i]++;
+      break;
+    }
+  }
+  this->count++;
+  this->sumUs += us;
+}
+metrics_histogram_t *Metrics::histogram(metric_families_t family, const char *label) {
+  // The series are only added to from the loop task or a web handler holding the
+  // state lock so they are never added from two tasks at once.
+  for(uint8_t i = 0; i < this->seriesCount; i++) {
+    if(this->series[i].family == family && strcmp(this->series[i].label, label) == 0) return &this->series[i].hist;
+  }
+  if(this->seriesCount >= METRICS_MAX_SERIES) {
+    this->seriesDropped++;
+    return nullptr;
+  }
+  metrics_series_t *s = &this->series[this->seriesCount++];
+  s->family = family;
+  strlcpy(s->label, label, sizeof(s->label));
+  // Labels such as an mqtt command come from outside so keep anything out of them
+  // that would need to be escaped in the exposition format.
+  for(char *p = s->label; *p; p++) {
+    if(*p == '"' || *p == '\\' || *p < ' ') *p = '_';
+  }
+  return &s->hist;
+}
+void Metrics::observe(metric_families_t family, const char *label, uint32_t us) {
+  metrics_histogram_t *hist = this->histogram(family, label);
+  if(hist) hist->observe(us);
+}
+void Metrics::writeHistograms(Print &out) {
+  for(uint8_t f = 0; f < sizeof(g_families) / sizeof(g_families[0]); f++) {
+    const metrics_family_t *fam = &g_families[f];
+    bool header = false;
+    for(uint8_t i = 0; i < this->seriesCount; i++) {
+      metrics_series_t *s = &this->series[i];
+      if(static_cast<uint8_t>(s->family) != f) continue;
+      if(!header) {
+        out.printf("# HELP %s %s\n# TYPE %s histogram\n", fam->name, fam->help, fam->name);
+        header = true;
+      }
+      uint32_t total = 0;
+      for(uint8_t b = 0; b < METRICS_BUCKETS; b++) {
+        total += s->hist.buckets[b];
+        out.printf("%s_bucket{%s=\"%s\",le=\"%s\"} %u\n", fam->name, fam->label, s->label, g_bucketLe[b], total);
+      }
+      out.printf("%s_bucket{%s=\"%s\",le=\"+Inf\"} %u\n", fam->name, fam->label, s->label, s->hist.count);
+      out.printf("%s_sum{%s=\"%s\"} %.6f\n", fam->name, fam->label, s->label, (double)s->hist.sumUs / 1000000.0);
+      out.printf("%s_count{%s=\"%s\"} %u\n", fam->name, fam->label, s->label, s->hist.count);
+    }
+  }
+}
+void Metrics::writeCounter(Print &out, const char *name, const char *help, uint32_t value) {
+  out.printf("# HELP %s %s\n# TYPE %s counter\n%s %u\n", name, help, name, name, value);
+}
+void Metrics::writeGauge(Print &out, const char *name, const char *help, uint32_t value) {
+  out.printf("# HELP %s %s\n# TYPE %s gauge\n%s %u\n", name, help, name, name, value);
+}
@@ -0,0 +1,42 @@
+#include <Arduino.h>
+#ifndef metrics_h
+#define metrics_h
+
+#define METRICS_MAX_SERIES 64
+#define METRICS_BUCKETS 9
+#define METRICS_LABEL_LEN 32
+
+enum class metric_families_t : uint8_t {
+  http = 0,
+  mqtt = 1,
+  socket = 2,
+  loop = 3,
+  auth = 4
+};
+// Latency observations are counted into fixed buckets so a series costs the same
+// memory no matter how often it is hit.  The buckets are not cumulative here; they
+// are summed when written out.
+struct metrics_histogram_t {
+  uint32_t buckets[METRICS_BUCKETS] = {0};
+  uint32_t count = 0;
+  uint64_t sumUs = 0;
+  void observe(uint32_t us);
+};
+struct metrics_series_t {
+  metric_families_t family = metric_families_t::http;
+  char label[METRICS_LABEL_LEN] = "";
+  metrics_histogram_t hist;
+};
+class Metrics {
+  protected:
+    metrics_series_t series[METRICS_MAX_SERIES];
+    uint8_t seriesCount = 0;
+  public:
+    uint32_t seriesDropped = 0;
+    metrics_histogram_t *histogram(metric_families_t family, const char *label);
+    void observe(metric_families_t family, const char *label, uint32_t us);
+    void writeHistograms(Print &out);
+    static void writeCounter(Print &out, const char *name, const char *help, uint32_t value);
+    static void writeGauge(Print &out, const char *name, const char *help, uint32_t value);
+};
+#endif
@@ -9,6 +9,7 @@
 #include "Utils.h"
 #include "SSDP.h"
 #include "MQTT.h"
+#include "HeapTracker.h"
 
 extern ConfigSettings settings;
 extern Web webServer;
@@ -178,7 +179,7 @@ void Network::emitSockets() {
 }
 void Network::emitSockets(uint8_t num) {
   if(this->connType == conn_types_t::ethernet) {
-      JsonSockEvent *json = sockEmit.beginEmit("ethernet");
+      JsonSockEvent *json = sockEmit.beginEmit("ethernet", 0);
       json->beginObject();
       json->addElem("connected", this->connected());
       json->addElem("speed", ETH.linkSpeed());
@@ -188,7 +189,7 @@ void Network::emitSockets(uint8_t num) {
   }
   else {
       if(WiFi.status() == WL_CONNECTED) {
-        JsonSockEvent *json = sockEmit.beginEmit("wifiStrength");
+        JsonSockEvent *json = sockEmit.beginEmit("wifiStrength", 0);
         json->beginObject();
         json->addElem("ssid", WiFi.SSID().c_str());
         json->addElem("strength", (int32_t)WiFi.RSSI());
@@ -199,7 +200,7 @@ void Network::emitSockets(uint8_t num) {
         this->lastChannel = WiFi.channel();
       }
       else {
-        JsonSockEvent *json = sockEmit.beginEmit("wifiStrength");
+        JsonSockEvent *json = sockEmit.beginEmit("wifiStrength", 0);
         json->beginObject();
         json->addElem("ssid", "");
         json->addElem("strength", (int8_t)-100);
@@ -207,7 +208,7 @@ void Network::emitSockets(uint8_t num) {
         json->endObject();
         sockEmit.endEmit(num);
         
-        json = sockEmit.beginEmit("ethernet");
+        json = sockEmit.beginEmit("ethernet", 0);
         json->beginObject();
         json->addElem("connected", false);
         json->addElem("speed", (uint8_t)0);
@@ -285,7 +286,7 @@ void Network::setConnected(conn_types_t connType) {
         settings.IP.dns2 = ETH.dnsIP(1);
       }
       esp_task_wdt_reset();
-      JsonSockEvent *json = sockEmit.beginEmit("ethernet");
+      JsonSockEvent *json = sockEmit.beginEmit("ethernet", 0);
       json->beginObject();
       json->addElem("connected", this->connected());
       json->addElem("speed", ETH.linkSpeed());
@@ -682,15 +683,16 @@ void Network::emitHeap(uint8_t num) {
   uint32_t minHeap = ESP.getMinFreeHeap();
   if(abs((int)(freeHeap - _lastHeap)) > 1500) bValEmit = true;
   if(abs((int)(maxHeap - _lastMaxHeap)) > 1500) bValEmit = true;
-  bRoomEmit = sockEmit.activeClients(0) > 0;
+  bRoomEmit = sockEmit.subscribers(sock_topics_t::heap) > 0;
   if(bValEmit) bTimeEmit = millis() - _lastHeapEmit > 7000;
   if(bEmit || bTimeEmit || bRoomEmit || bValEmit) {
-    JsonSockEvent *json = sockEmit.beginEmit("memStatus");
+    JsonSockEvent *json = sockEmit.beginEmit("memStatus", 0);
     json->beginObject();
     json->addElem("max", maxHeap);
     json->addElem("free", freeHeap);
     json->addElem("min", minHeap);
     json->addElem("total", ESP.getHeapSize());
+    HeapTracker::toJSON(*json);
     json->endObject();
     if(num == 255 && bTimeEmit && bValEmit) {
       sockEmit.endEmit(num);
@@ -704,7 +706,7 @@ void Network::emitHeap(uint8_t num) {
       //Serial.printf("TARGET HEAP %d: Emit:%d TimeEmit:%d ValEmit:%d\n", num, bEmit, bTimeEmit, bValEmit);
     }
     else if(bRoomEmit) {
-      sockEmit.endEmitRoom(0);
+      sockEmit.endEmitTopic(sock_topics_t::heap);
       //Serial.printf("ROOM HEAP: Emit:%d TimeEmit:%d ValEmit:%d\n", bEmit, bTimeEmit, bValEmit);
     }
   }
@@ -0,0 +1,77 @@
+#include <Arduino.h>
+#include <algorithm>
+#include "Profiler.h"
+#include "Sockets.h"
+
+extern SocketEmitter sockEmit;
+
+static const char *g_stageNames[PROF_MAX_STAGES] = {"net", "somfy", "git", "web", "socket", "dinplug", "telnet"};
+
+const char *LoopProfiler::stageName(prof_stages_t stage) {
+  uint8_t ndx = static_cast<uint8_t>(stage);
+  return ndx < PROF_MAX_STAGES ? g_stageNames[ndx] : "unknown";
+}
+uint32_t LoopProfiler::record(prof_stages_t stage, uint32_t cycles) {
+  prof_stage_t &s = this->stages[static_cast<uint8_t>(stage)];
+  s.ring[s.head] = cycles;
+  s.head = (s.head + 1) % PROF_RING_SIZE;
+  if(s.filled < PROF_RING_SIZE) s.filled++;
+  if(s.count == 0 || cycles < s.min) s.min = cycles;
+  if(cycles > s.max) {
+    s.max = cycles;
+    s.maxTime = millis();
+  }
+  s.count++;
+  s.total += cycles;
+  return cycles / ESP.getCpuFreqMHz();
+}
+void LoopProfiler::getStats(prof_stages_t stage, prof_stats_t &stats) {
+  prof_stage_t &s = this->stages[static_cast<uint8_t>(stage)];
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  stats.count = s.count;
+  stats.minUs = s.min / mhz;
+  stats.maxUs = s.max / mhz;
+  stats.maxTime = s.maxTime;
+  stats.avgUs = s.count > 0 ? (uint32_t)((s.total / s.count) / mhz) : 0;
+  stats.p99Us = 0;
+  if(s.filled > 0) {
+    // Sorting a copy keeps the ring in arrival order for the next sample.
+    uint32_t sorted[PROF_RING_SIZE];
+    memcpy(sorted, s.ring, s.filled * sizeof(uint32_t));
+    uint8_t ndx = (s.filled * 99) / 100;
+    if(ndx >= s.filled) ndx = s.filled - 1;
+    std::nth_element(sorted, sorted + ndx, sorted + s.filled);
+    stats.p99Us = sorted[ndx] / mhz;
+  }
+}
+void LoopProfiler::reset() {
+  for(uint8_t i = 0; i < PROF_MAX_STAGES; i++) this->stages[i] = prof_stage_t();
+  this->resetTime = millis();
+}
+void LoopProfiler::toJSON(JsonFormatter &json) {
+  json.addElem("since", this->resetTime);
+  json.addElem("uptime", (uint32_t)millis());
+  json.addElem("cpuMHz", (uint32_t)ESP.getCpuFreqMHz());
+  json.beginArray("stages");
+  for(uint8_t i = 0; i < PROF_MAX_STAGES; i++) {
+    prof_stats_t stats;
+    this->getStats(static_cast<prof_stages_t>(i), stats);
+    json.beginObject();
+    json.addElem("name", g_stageNames[i]);
+    json.addElem("count", stats.count);
+    json.addElem("min", stats.minUs);
+    json.addElem("avg", stats.avgUs);
+    json.addElem("p99", stats.p99Us);
+    json.addElem("max", stats.maxUs);
+    json.addElem("maxTime", stats.maxTime);
+    json.endObject();
+  }
+  json.endArray();
+}
+void LoopProfiler::emitSocket(uint8_t num) {
+  JsonSockEvent *json = sockEmit.beginEmit("loopProfile", 0);
+  json->beginObject();
+  this->toJSON(*json);
+  json->endObject();
+  sockEmit.endEmit(num);
+}
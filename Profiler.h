@@ -0,0 +1,52 @@
+#include <Arduino.h>
+#include "WResp.h"
+#ifndef profiler_h
+#define profiler_h
+
+#define PROF_RING_SIZE 128
+
+enum class prof_stages_t : uint8_t {
+  net = 0,
+  somfy = 1,
+  git = 2,
+  web = 3,
+  socket = 4,
+  dinplug = 5,
+  telnet = 6
+};
+#define PROF_MAX_STAGES 7
+// Each stage keeps the most recent samples in a ring so the p99 reflects current
+// behavior while the min, max, and average run from the last reset.  Samples are
+// kept in cpu cycles and only converted when they are reported.
+struct prof_stage_t {
+  uint32_t ring[PROF_RING_SIZE];
+  uint8_t head = 0;
+  uint8_t filled = 0;
+  uint32_t count = 0;
+  uint64_t total = 0;
+  uint32_t min = 0;
+  uint32_t max = 0;
+  uint32_t maxTime = 0;
+};
+struct prof_stats_t {
+  uint32_t count = 0;
+  uint32_t minUs = 0;
+  uint32_t avgUs = 0;
+  uint32_t p99Us = 0;
+  uint32_t maxUs = 0;
+  uint32_t maxTime = 0;
+};
+class LoopProfiler {
+  protected:
+    prof_stage_t stages[PROF_MAX_STAGES];
+  public:
+    uint32_t resetTime = 0;
+    static const char *stageName(prof_stages_t stage);
+    static uint32_t cycles() { return ESP.getCycleCount(); }
+    uint32_t record(prof_stages_t stage, uint32_t cycles);
+    void getStats(prof_stages_t stage, prof_stats_t &stats);
+    void reset();
+    void toJSON(JsonFormatter &json);
+    void emitSocket(uint8_t num = 255);
+};
+#endif
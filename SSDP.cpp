@@ -3,6 +3,7 @@
 #include "Utils.h"
 #include "ConfigSettings.h"
 #include "SSDP.h"
+#include "HeapTracker.h"
 
 
 #define SSDP_PORT         1900
@@ -396,7 +397,7 @@ IPAddress SSDPClass::localIP()
 void SSDPClass::_sendResponse(IPAddress addr, uint16_t port, UPNPDeviceType *d, const char *st, response_types_t responseType) {
   char buffer[1460];
   IPAddress ip = this->localIP();
-  char *pbuff = (char *)malloc(strlen_P(_ssdp_response_template)+1);
+  char *pbuff = (char *)HeapTracker::alloc(heap_tags_t::ssdp, strlen_P(_ssdp_response_template)+1);
   if(!pbuff) {
     #ifdef DEBUG_SSDP
     DEBUG_SSDP.println("Out of memory for SSDP response");
@@ -416,7 +417,7 @@ void SSDPClass::_sendResponse(IPAddress addr, uint16_t port, UPNPDeviceType *d,
                        this->bootId, this->configId);
   buffer[sizeof(buffer) - 1] = '\0';
   this->_sendResponse(addr, port, buffer);
-  free(pbuff);
+  HeapTracker::free(heap_tags_t::ssdp, pbuff);
 }
 void SSDPClass::_sendResponse(IPAddress addr, uint16_t port, const char *buff) {
   #ifdef DEBUG_SSDP
@@ -484,7 +485,7 @@ void SSDPClass::_sendNotify(UPNPDeviceType *d, bool root) {
   "%s: %s\r\n"  // "NT" or "ST", _deviceType
   "LOCATION: http://%s:%u/%s\r\n" // WiFi.localIP(), _port, _schemaURL
   */
-  char *pbuff = (char *)malloc(strlen_P(_ssdp_notify_template)+1);
+  char *pbuff = (char *)HeapTracker::alloc(heap_tags_t::ssdp, strlen_P(_ssdp_notify_template)+1);
   if(!pbuff) {
     #ifdef DEBUG_SSDP
     DEBUG_SSDP.println(PSTR("Out of memory for SSDP response"));
@@ -522,7 +523,7 @@ void SSDPClass::_sendNotify(UPNPDeviceType *d, bool root) {
                        ip[0], ip[1], ip[2], ip[3], _port, d->schemaURL, this->bootId, this->configId);
   this->_sendNotify(buffer);
   d->lastNotified = millis();
-  free(pbuff);
+  HeapTracker::free(heap_tags_t::ssdp, pbuff);
 }
 void SSDPClass::setActive(uint8_t ndx, bool isActive) {
   UPNPDeviceType *d = &this->deviceTypes[ndx];
@@ -2,57 +2,161 @@
 #include <ArduinoJson.h>
 #include <WebSocketsServer.h>
 #include <esp_task_wdt.h>
+#include <lwip/sockets.h>
 #include "Sockets.h"
+#include "Web.h"
+#include "TelnetServer.h"
 #include "ConfigSettings.h"
 #include "Somfy.h"
 #include "Network.h"
 #include "GitOTA.h"
+#include "Metrics.h"
+#include "Profiler.h"
 
 extern ConfigSettings settings;
 extern Network net;
 extern SomfyShadeController somfy;
 extern SocketEmitter sockEmit;
 extern GitUpdater git;
+extern Metrics metrics;
+extern LoopProfiler profiler;
 
 
-WebSocketsServer sockServer = WebSocketsServer(8080);
+// Lets the emitter ask whether a client can take a message before it is handed to the
+// library, whose send waits on a full TCP window.  lwip only reports a socket writable
+// once more than TCP_SNDLOWAT bytes are free, which is more than the largest event, so
+// a message sent to a writable socket goes out without blocking.
+class SockServer : public WebSocketsServer {
+  public:
+    SockServer(uint16_t port) : WebSocketsServer(port) {}
+    bool canWrite(uint8_t num) {
+      if(num >= WEBSOCKETS_SERVER_CLIENT_MAX || !this->_clients[num].tcp) return false;
+      int fd = this->_clients[num].tcp->fd();
+      if(fd < 0) return false;
+      fd_set wfds;
+      FD_ZERO(&wfds);
+      FD_SET(fd, &wfds);
+      struct timeval tv = {0, 0};
+      return select(fd + 1, nullptr, &wfds, nullptr, &tv) > 0;
+    }
+};
+SockServer sockServer = SockServer(8080);
 
 #define MAX_SOCK_RESPONSE 2048
 static char g_response[MAX_SOCK_RESPONSE];
 
-bool room_t::isJoined(uint8_t num) {
-  for(uint8_t i = 0; i < sizeof(this->clients); i++) { 
-    if(this->clients[i] == num) return true; 
-  } 
-  return false; 
-}
-bool room_t::join(uint8_t num) {
-  if(this->isJoined(num)) return true; 
-  for(uint8_t i = 0; i < sizeof(this->clients); i++) { 
-    if(this->clients[i] == 255) { 
-      this->clients[i] = num; 
-      return true; 
-    } 
+static_assert(SOCK_QUEUE_BYTES >= MAX_SOCK_RESPONSE, "The socket queue must hold the largest event");
+static_assert(SOCK_FIXED_SOCKETS + SOCK_MAX_CLIENTS + TELNET_MAX_CLIENTS + WEB_KEEPALIVE_MAX <= CONFIG_LWIP_MAX_SOCKETS,
+  "The socket, telnet and keep-alive clients need more sockets than lwip has");
+
+// Sets or clears the bit for an id or every bit when the id is *.
+static bool setSubBits(uint32_t *bits, const char *id, uint8_t maxId, bool on) {
+  uint32_t mask;
+  if(strcmp(id, "*") == 0) mask = maxId >= 32 ? 0xFFFFFFFF : (1UL << maxId) - 1;
+  else {
+    int n = atoi(id);
+    if(n < 1 || n > maxId) return false;
+    mask = 1UL << (n - 1);
+  }
+  if(on) *bits |= mask;
+  else *bits &= ~mask;
+  return true;
+}
+bool sock_subs_t::isSubscribed(sock_topics_t topic, uint8_t id) {
+  switch(topic) {
+    case sock_topics_t::shade:
+      return id >= 1 && id <= 32 && (this->shades & (1UL << (id - 1)));
+    case sock_topics_t::group:
+      return id >= 1 && id <= 32 && (this->groups & (1UL << (id - 1)));
+    default:
+      return (this->topics & (1 << static_cast<uint8_t>(topic))) != 0;
   }
-  return false;  
 }
-bool room_t::leave(uint8_t num) { 
-  if(!this->isJoined(num)) return false; 
-  for(uint8_t i = 0; i < sizeof(this->clients); i++) { 
-    if(this->clients[i] == num) this->clients[i] = 255; 
-  } 
+bool sock_subs_t::subscribe(const char *topic, bool on) {
+  if(strncmp(topic, "shade:", 6) == 0) return setSubBits(&this->shades, &topic[6], SOMFY_MAX_SHADES, on);
+  if(strncmp(topic, "group:", 6) == 0) return setSubBits(&this->groups, &topic[6], SOMFY_MAX_GROUPS, on);
+  uint8_t bit;
+  if(strcmp(topic, "frames") == 0) bit = 1 << static_cast<uint8_t>(sock_topics_t::frames);
+  else if(strcmp(topic, "scan") == 0) bit = 1 << static_cast<uint8_t>(sock_topics_t::scan);
+  else if(strcmp(topic, "heap") == 0) bit = 1 << static_cast<uint8_t>(sock_topics_t::heap);
+  else return false;
+  if(on) this->topics |= bit;
+  else this->topics &= ~bit;
   return true;
 }
-void room_t::clear() {
-  memset(this->clients, 255, sizeof(this->clients));
+void sock_subs_t::defaults() {
+  this->clear();
+  this->subscribe("shade:*", true);
+  this->subscribe("group:*", true);
+}
+void sock_subs_t::clear() {
+  this->shades = 0;
+  this->groups = 0;
+  this->topics = 0;
 }
-uint8_t room_t::activeClients() {
+uint8_t sock_queue_t::supersede(uint32_t key) {
   uint8_t n = 0;
-  for(uint8_t i = 0; i < sizeof(this->clients); i++) {
-    if(this->clients[i] != 255) n++;
+  for(uint8_t i = 0; i < this->count; i++) {
+    sock_msg_t *m = &this->msgs[(this->head + i) % SOCK_QUEUE_DEPTH];
+    if(!m->superseded && m->key == key) {
+      m->superseded = true;
+      n++;
+    }
   }
   return n;
 }
+bool sock_queue_t::push(uint32_t key, const char *msg, uint16_t len) {
+  if(this->count >= SOCK_QUEUE_DEPTH || len == 0 || len >= SOCK_QUEUE_BYTES) return false;
+  uint16_t offset = this->count > 0 ? this->tail : 0;
+  if(this->count > 0) {
+    uint16_t first = this->msgs[this->head].offset;
+    if(offset >= first) {
+      if(offset + len > SOCK_QUEUE_BYTES) {
+        if(len >= first) return false;
+        offset = 0;
+      }
+    }
+    else if(offset + len >= first) return false;
+  }
+  memcpy(&this->buff[offset], msg, len);
+  sock_msg_t *m = &this->msgs[(this->head + this->count) % SOCK_QUEUE_DEPTH];
+  m->key = key;
+  m->queued = millis();
+  m->offset = offset;
+  m->len = len;
+  m->superseded = false;
+  this->tail = offset + len;
+  this->count++;
+  return true;
+}
+sock_msg_t *sock_queue_t::front() {
+  while(this->count > 0 && this->msgs[this->head].superseded) this->pop();
+  return this->count > 0 ? &this->msgs[this->head] : nullptr;
+}
+void sock_queue_t::pop() {
+  if(this->count == 0) return;
+  this->head = (this->head + 1) % SOCK_QUEUE_DEPTH;
+  if(--this->count == 0) this->tail = 0;
+}
+void sock_queue_t::clear() {
+  this->head = 0;
+  this->count = 0;
+  this->tail = 0;
+  this->overflowed = false;
+}
+uint32_t sock_queue_t::lag() {
+  sock_msg_t *m = this->front();
+  return m ? millis() - m->queued : 0;
+}
+// State events are keyed on the event name and the entity so a newer state replaces
+// the one still waiting in the queue.
+static uint32_t sockKey(const char *evt, uint16_t id) {
+  uint32_t hash = 2166136261UL;
+  while(*evt) hash = (hash ^ (uint8_t)*evt++) * 16777619UL;
+  hash = (hash ^ (id & 0xFF)) * 16777619UL;
+  hash = (hash ^ (id >> 8)) * 16777619UL;
+  return hash ? hash : 1;
+}
 /*********************************************************************
  * ClientSocketEvent class members
  ********************************************************************/
@@ -83,56 +187,183 @@ void SocketEmitter::begin() {
   //settings.printAvailHeap();
 }
 void SocketEmitter::loop() {
-  this->initClients();
+  this->syncClients();
+  this->drain();
   sockServer.loop();  
 }
-JsonSockEvent *SocketEmitter::beginEmit(const char *evt) {
+JsonSockEvent *SocketEmitter::beginEmit(const char *evt, uint16_t supersede) {
+  this->emitEvent = evt;
+  this->emitStart = micros();
+  this->emitKey = supersede == SOCK_NO_SUPERSEDE ? 0 : sockKey(evt, supersede);
   this->json.beginEvent(&sockServer, evt, g_response, sizeof(g_response));
   return &this->json;
 }
-void SocketEmitter::endEmit(uint8_t num) { this->json.endEvent(num); sockServer.loop(); }
-void SocketEmitter::endEmitRoom(uint8_t room) {
-  if(room < SOCK_MAX_ROOMS) {
-    room_t *r = &this->rooms[room];
-    for(uint8_t i = 0; i < sizeof(r->clients); i++) {
-      if(r->clients[i] != 255) this->json.endEvent(r->clients[i]);
+void SocketEmitter::endEmitTiming() {
+  if(this->emitEvent) metrics.observe(metric_families_t::socket, this->emitEvent, micros() - this->emitStart);
+  this->emitEvent = nullptr;
+}
+// Events are queued for each client and sent from the loop so a client on a poor
+// connection does not hold up the code that raised the event.
+void SocketEmitter::endEmit(uint8_t num) {
+  this->json.closeEvent();
+  if(num == 255) {
+    for(uint8_t i = 0; i < SOCK_MAX_CLIENTS; i++) {
+      if(sockServer.clientIsConnected(i)) this->enqueue(i, false);
+    }
+  }
+  else this->enqueue(num, true);
+  this->endEmitTiming();
+}
+void SocketEmitter::endEmitTopic(sock_topics_t topic, uint8_t id) {
+  this->json.closeEvent();
+  for(uint8_t i = 0; i < SOCK_MAX_CLIENTS; i++) {
+    if(this->subs[i].isSubscribed(topic, id) && sockServer.clientIsConnected(i)) this->enqueue(i, false);
+  }
+  this->endEmitTiming();
+}
+void SocketEmitter::enqueue(uint8_t num, bool direct) {
+  if(num >= SOCK_MAX_CLIENTS) return;
+  sock_queue_t *q = &this->queues[num];
+  if(q->overflowed) return;
+  uint16_t len = strlen(g_response);
+  if(this->emitKey) this->superseded += q->supersede(this->emitKey);
+  if(q->push(this->emitKey, g_response, len)) return;
+  if(direct) {
+    // A reply to a single client such as its initial sync sends whatever the client
+    // can take right now rather than losing part of the state.
+    this->flush(num);
+    if(q->push(this->emitKey, g_response, len)) return;
+  }
+  // The client has missed an event and is out of sync.  It is dropped on the next
+  // drain and gets a full sync when it reconnects.
+  this->overflows++;
+  q->overflowed = true;
+}
+bool SocketEmitter::sendNext(uint8_t num) {
+  sock_queue_t *q = &this->queues[num];
+  sock_msg_t *m = q->front();
+  if(!m || !sockServer.canWrite(num)) return false;
+  sockServer.sendTXT(num, (uint8_t *)&q->buff[m->offset], m->len);
+  q->pop();
+  return true;
+}
+void SocketEmitter::onStateChange(state_change_t &change) {
+  switch(change.kind) {
+    case state_kinds_t::shade: change.shade->emitState(255, change.evt); break;
+    case state_kinds_t::group: change.group->emitState(255, change.evt); break;
+    case state_kinds_t::room: change.room->emitState(255, change.evt); break;
+  }
+}
+void SocketEmitter::flush(uint8_t num) {
+  if(num >= SOCK_MAX_CLIENTS) return;
+  while(this->sendNext(num)) esp_task_wdt_reset();
+}
+// Sends whatever the clients can take now.  Used by handlers that hold the state lock
+// for a long time, such as an upload, while the loop task cannot drain the queues.
+void SocketEmitter::flushAll() {
+  for(uint8_t i = 0; i < SOCK_MAX_CLIENTS; i++) {
+    if(sockServer.clientIsConnected(i)) this->flush(i);
+  }
+}
+void SocketEmitter::drain() {
+  uint32_t start = micros();
+  for(uint8_t i = 0; i < SOCK_MAX_CLIENTS; i++) {
+    sock_queue_t *q = &this->queues[i];
+    if(q->count == 0 && !q->overflowed) continue;
+    if(!sockServer.clientIsConnected(i)) q->clear();
+    else if(q->overflowed || q->lag() > SOCK_LAG_BUDGET) {
+      Serial.printf("Socket [%u] lagging behind; disconnecting\n", i);
+      this->lagDisconnects++;
+      q->clear();
+      sockServer.disconnect(i);
     }
   }
+  // Send a message to each client in turn so one deep queue does not starve the rest.
+  bool sent = true;
+  while(sent && micros() - start < SOCK_DRAIN_BUDGET) {
+    sent = false;
+    for(uint8_t i = 0; i < SOCK_MAX_CLIENTS; i++) {
+      if(this->sendNext(i)) sent = true;
+    }
+  }
+}
+void SocketEmitter::writeMetrics(Print &out) {
+  uint32_t depth = 0;
+  uint32_t maxDepth = 0;
+  for(uint8_t i = 0; i < SOCK_MAX_CLIENTS; i++) {
+    depth += this->queues[i].count;
+    maxDepth = max(maxDepth, (uint32_t)this->queues[i].count);
+  }
+  Metrics::writeGauge(out, "espsomfy_socket_queue_depth", "Messages waiting to be sent to socket clients.", depth);
+  Metrics::writeGauge(out, "espsomfy_socket_queue_depth_max", "Messages waiting on the slowest socket client.", maxDepth);
+  Metrics::writeCounter(out, "espsomfy_socket_superseded_total", "Queued state events replaced by a newer state.", this->superseded);
+  Metrics::writeCounter(out, "espsomfy_socket_overflows_total", "Socket client queues that ran out of room.", this->overflows);
+  Metrics::writeCounter(out, "espsomfy_socket_lag_disconnects_total", "Socket clients dropped for falling behind.", this->lagDisconnects);
+}
+// Emitters check this before building an event so nothing is serialized when no one
+// is listening.
+uint8_t SocketEmitter::subscribers(sock_topics_t topic, uint8_t id) {
+  uint8_t n = 0;
+  for(uint8_t i = 0; i < SOCK_MAX_CLIENTS; i++) {
+    if(this->subs[i].isSubscribed(topic, id)) n++;
+  }
+  return n;
 }
-uint8_t SocketEmitter::activeClients(uint8_t room) {
-  if(room < SOCK_MAX_ROOMS) return this->rooms[room].activeClients();
-  return 0;
-}
-void SocketEmitter::initClients() {
-  for(uint8_t i = 0; i < sizeof(this->newClients); i++) {
-    uint8_t num = this->newClients[i];
-    if(num != 255) {
-      if(sockServer.clientIsConnected(num)) {
-        Serial.printf("Initializing Socket Client %u\n", num);
-        esp_task_wdt_reset();
-        settings.emitSockets(num);
-        somfy.emitState(num);
-        git.emitUpdateCheck(num);
-        net.emitSockets(num);
-        esp_task_wdt_reset();
+void SocketEmitter::beginSync(uint8_t num) {
+  if(num >= SOCK_MAX_CLIENTS) return;
+  this->syncs[num].step = 1;
+  this->syncs[num].index = 0;
+}
+bool SocketEmitter::syncStep(uint8_t num) {
+  sock_sync_t *s = &this->syncs[num];
+  switch(s->step) {
+    case 1:
+      Serial.printf("Initializing Socket Client %u\n", num);
+      settings.emitSockets(num);
+      git.emitUpdateCheck(num);
+      net.emitSockets(num);
+      s->step = 2;
+      s->index = 0;
+      return true;
+    case 2: {
+      // The shades are batched into snapshots that fill the event buffer so a new
+      // client is sent a few messages rather than one for every shade.
+      JsonSockEvent *json = this->beginEmit("shadeSnapshot");
+      json->beginArray();
+      while(s->index < SOMFY_MAX_SHADES && strlen(g_response) + SOCK_SNAPSHOT_RESERVE < MAX_SOCK_RESPONSE) {
+        SomfyShade *shade = &somfy.shades[s->index++];
+        if(shade->getShadeId() != 255) shade->toJSONState(json);
       }
-      this->newClients[i] = 255;
+      json->endArray();
+      this->endEmit(num);
+      if(s->index >= SOMFY_MAX_SHADES) s->step = 0;
+      return true;
     }
   }
+  s->step = 0;
+  return false;
 }
-void SocketEmitter::delayInit(uint8_t num) {
-  for(uint8_t i=0; i < sizeof(this->newClients); i++) {
-    if(this->newClients[i] == num) break;
-    else if(this->newClients[i] == 255) {
-      this->newClients[i] = num;
-      break;
+// Takes a single step for a single client each loop.  A client only gets its next
+// step once its queue has drained so a reconnect storm is spread over several loops.
+void SocketEmitter::syncClients() {
+  for(uint8_t n = 0; n < SOCK_MAX_CLIENTS; n++) {
+    uint8_t num = (this->nextSync + n) % SOCK_MAX_CLIENTS;
+    sock_sync_t *s = &this->syncs[num];
+    if(s->step == 0) continue;
+    if(!sockServer.clientIsConnected(num)) {
+      s->step = 0;
+      continue;
     }
+    if(this->queues[num].count > 0) continue;
+    this->syncStep(num);
+    this->nextSync = (num + 1) % SOCK_MAX_CLIENTS;
+    break;
   }
 }
 void SocketEmitter::end() { 
   sockServer.close(); 
-  for(uint8_t i = 0; i < SOCK_MAX_ROOMS; i++)
-    this->rooms[i].clear();
+  for(uint8_t i = 0; i < SOCK_MAX_CLIENTS; i++)
+    this->subs[i].clear();
 }
 void SocketEmitter::disconnect() { sockServer.disconnect(); }
 void SocketEmitter::wsEvent(uint8_t num, WStype_t type, uint8_t *payload, size_t length) {
@@ -148,8 +379,9 @@ void SocketEmitter::wsEvent(uint8_t num, WStype_t type, uint8_t *payload, size_t
               Serial.printf("Socket [%u] Disconnected!\n [%s]", num, payload);
             else
               Serial.printf("Socket [%u] Disconnected!\n", num);
-            for(uint8_t i = 0; i < SOCK_MAX_ROOMS; i++) {
-              sockEmit.rooms[i].leave(num);
+            if(num < SOCK_MAX_CLIENTS) {
+              sockEmit.subs[num].clear();
+              sockEmit.queues[num].clear();
             }
             break;
         case WStype_CONNECTED:
@@ -158,22 +390,30 @@ void SocketEmitter::wsEvent(uint8_t num, WStype_t type, uint8_t *payload, size_t
                 Serial.printf("Socket [%u] Connected from %d.%d.%d.%d url: %s\n", num, ip[0], ip[1], ip[2], ip[3], payload);
                 // Send all the current shade settings to the client.
                 sockServer.sendTXT(num, "Connected");
+                if(num < SOCK_MAX_CLIENTS) sockEmit.subs[num].defaults();
                 //sockServer.loop();
-                sockEmit.delayInit(num);
+                sockEmit.beginSync(num);
             }
             break;
         case WStype_TEXT:
-            if(strncmp((char *)payload, "join:", 5) == 0) {
-              // In this instance the client wants to join a room.  Let's do some
-              // work to get the ordinal of the room that the client wants to join.
-              uint8_t roomNum = atoi((char *)&payload[5]);
-              Serial.printf("Client %u joining room %u\n", num, roomNum);
-              if(roomNum < SOCK_MAX_ROOMS) sockEmit.rooms[roomNum].join(num);
+            if(num >= SOCK_MAX_CLIENTS) break;
+            if(strncmp((char *)payload, "join:", 5) == 0 || strncmp((char *)payload, "leave:", 6) == 0) {
+              // Room 0 is the configuration panel which watches the radio and the heap.
+              bool join = payload[0] == 'j';
+              Serial.printf("Client %u %s configuration\n", num, join ? "joining" : "leaving");
+              sockEmit.subs[num].subscribe("frames", join);
+              sockEmit.subs[num].subscribe("scan", join);
+              sockEmit.subs[num].subscribe("heap", join);
+            }
+            else if(strncmp((char *)payload, "sub:", 4) == 0 || strncmp((char *)payload, "unsub:", 6) == 0) {
+              bool on = payload[0] == 's';
+              const char *topic = (char *)&payload[on ? 4 : 6];
+              if(!sockEmit.subs[num].subscribe(topic, on)) Serial.printf("Socket [%u] unknown topic %s\n", num, topic);
             }
-            else if(strncmp((char *)payload, "leave:", 6) == 0) {
-              uint8_t roomNum = atoi((char *)&payload[6]);
-              Serial.printf("Client %u leaving room %u\n", num, roomNum);
-              if(roomNum < SOCK_MAX_ROOMS) sockEmit.rooms[roomNum].leave(num);
+            else if(strcmp((char *)payload, "prof") == 0) profiler.emitSocket(num);
+            else if(strcmp((char *)payload, "prof:reset") == 0) {
+              profiler.reset();
+              profiler.emitSocket(num);
             }
             else {
               Serial.printf("Socket [%u] text: %s\n", num, payload);
@@ -1,38 +1,112 @@
 #include <WebSocketsServer.h>
 #include "WResp.h"
+#include "StateBus.h"
 #ifndef sockets_h
 #define sockets_h
 
-#define SOCK_MAX_ROOMS 1
-#define ROOM_EMIT_FRAME 0
+// The socket library sizes its client table at build time so the client cap is set by
+// building with -DWEBSOCKETS_SERVER_CLIENT_MAX=n.  The outbound queues share a fixed budget
+// so more clients shrink each queue rather than growing memory.  Every client also holds one
+// of the CONFIG_LWIP_MAX_SOCKETS (16) lwip sockets.  SOCK_FIXED_SOCKETS are held whatever the
+// load: the listeners on 80, 8081, 8080 and 23, the client each web server is answering, MQTT
+// and the Dinplug gateway.  SSDP uses a raw UDP pcb and the update check only opens a socket
+// briefly, so neither is counted.  The telnet sessions and parked keep-alive connections come
+// out of the same table, so raising the client cap means lowering TELNET_MAX_CLIENTS or
+// WEB_KEEPALIVE_MAX.
+#define SOCK_MAX_CLIENTS WEBSOCKETS_SERVER_CLIENT_MAX
+#define SOCK_FIXED_SOCKETS 8
+#define SOCK_QUEUE_BUDGET 20480
+#define SOCK_QUEUE_MIN 2048
+#define SOCK_QUEUE_BYTES (SOCK_QUEUE_BUDGET / SOCK_MAX_CLIENTS > 4096 ? 4096 : (SOCK_QUEUE_BUDGET / SOCK_MAX_CLIENTS < SOCK_QUEUE_MIN ? SOCK_QUEUE_MIN : SOCK_QUEUE_BUDGET / SOCK_MAX_CLIENTS))
+#define SOCK_QUEUE_DEPTH 24
+#define SOCK_LAG_BUDGET 5000    // Milliseconds a message may wait before the client is dropped.
+#define SOCK_DRAIN_BUDGET 4000  // Microseconds spent sending queued messages each loop.
+#define SOCK_NO_SUPERSEDE 0xFFFF
+#define SOCK_SNAPSHOT_RESERVE 512 // Room left in the event buffer before another shade is added to a snapshot.
 
-struct room_t {
-  uint8_t clients[5] = {255, 255, 255, 255, 255};
-  uint8_t activeClients();
-  bool isJoined(uint8_t num);
-  bool join(uint8_t num);
-  bool leave(uint8_t num);
+enum class sock_topics_t : uint8_t {
+  shade = 0,
+  group = 1,
+  frames = 2,
+  scan = 3,
+  heap = 4
+};
+// The topics a client listens to.  Shades and groups are subscribed by id so a wall
+// tablet for a single room is only sent the shades it shows.  A client starts out
+// subscribed to every shade and group.
+struct sock_subs_t {
+  uint32_t shades = 0;
+  uint32_t groups = 0;
+  uint8_t topics = 0;
+  bool isSubscribed(sock_topics_t topic, uint8_t id = 0);
+  bool subscribe(const char *topic, bool on);
+  void defaults();
   void clear();
 };
+struct sock_msg_t {
+  uint32_t key = 0;
+  uint32_t queued = 0;
+  uint16_t offset = 0;
+  uint16_t len = 0;
+  bool superseded = false;
+};
+// The messages waiting to go out to a single client.  The text is stored back to back
+// in a ring and a message that does not fit at the end starts over at the front.
+struct sock_queue_t {
+  sock_msg_t msgs[SOCK_QUEUE_DEPTH];
+  char buff[SOCK_QUEUE_BYTES];
+  uint8_t head = 0;
+  uint8_t count = 0;
+  uint16_t tail = 0;
+  bool overflowed = false;
+  uint8_t supersede(uint32_t key);
+  bool push(uint32_t key, const char *msg, uint16_t len);
+  sock_msg_t *front();
+  void pop();
+  void clear();
+  uint32_t lag();
+};
+// Where a new client is in its initial sync.  The sync is sent a step at a time so
+// clients that connect together do not flood the loop.
+struct sock_sync_t {
+  uint8_t step = 0;
+  uint8_t index = 0;
+};
 class SocketEmitter {
   protected:
-    uint8_t newclients = 0;
-    uint8_t newClients[5] = {255,255,255,255,255};
-    void delayInit(uint8_t num);
+    sock_sync_t syncs[SOCK_MAX_CLIENTS];
+    uint8_t nextSync = 0;
+    const char *emitEvent = nullptr;
+    uint32_t emitStart = 0;
+    uint32_t emitKey = 0;
+    sock_queue_t queues[SOCK_MAX_CLIENTS];
+    void beginSync(uint8_t num);
+    bool syncStep(uint8_t num);
+    void endEmitTiming();
+    void enqueue(uint8_t num, bool direct);
+    bool sendNext(uint8_t num);
+    void drain();
   public:
+    uint32_t superseded = 0;
+    uint32_t overflows = 0;
+    uint32_t lagDisconnects = 0;
     JsonSockEvent json;
     //ClientSocketEvent evt;
-    room_t rooms[SOCK_MAX_ROOMS];
-    uint8_t activeClients(uint8_t room);
-    void initClients();
+    sock_subs_t subs[SOCK_MAX_CLIENTS];
+    uint8_t subscribers(sock_topics_t topic, uint8_t id = 0);
+    void syncClients();
     void startup();
     void begin();
     void loop();
     void end();
     void disconnect();
-    JsonSockEvent * beginEmit(const char *evt);
+    JsonSockEvent * beginEmit(const char *evt, uint16_t supersede = SOCK_NO_SUPERSEDE);
     void endEmit(uint8_t num = 255);
-    void endEmitRoom(uint8_t num);
+    void endEmitTopic(sock_topics_t topic, uint8_t id = 0);
+    void flush(uint8_t num);
+    void flushAll();
+    void onStateChange(state_change_t &change);
+    void writeMetrics(Print &out);
     static void wsEvent(uint8_t num, WStype_t type, uint8_t *payload, size_t length);
 };
 #endif
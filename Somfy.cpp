@@ -10,6 +10,9 @@
 #include "MQTT.h"
 #include "ConfigFile.h"
 #include "GitOTA.h"
+#include "Boot.h"
+#include "HeapTracker.h"
+#include "StateBus.h"
 
 extern Preferences pref;
 extern SomfyShadeController somfy;
@@ -17,6 +20,8 @@ extern SocketEmitter sockEmit;
 extern ConfigSettings settings;
 extern MQTTClass mqtt;
 extern GitUpdater git;
+extern BootSequencer boot;
+extern StateBus stateBus;
 
 
 uint8_t rxmode = 0;  // Indicates whether the radio is in receive mode.  Just to ensure there isn't more than one interrupt hooked.
@@ -43,39 +48,49 @@ int sort_asc(const void *cmp1, const void *cmp2) {
 
 static int interruptPin = 0;
 static uint8_t bit_length = 56;
-somfy_commands translateSomfyCommand(const String& string) {
-    if (string.equalsIgnoreCase("My")) return somfy_commands::My;
-    else if (string.equalsIgnoreCase("Up")) return somfy_commands::Up;
-    else if (string.equalsIgnoreCase("MyUp")) return somfy_commands::MyUp;
-    else if (string.equalsIgnoreCase("Down")) return somfy_commands::Down;
-    else if (string.equalsIgnoreCase("MyDown")) return somfy_commands::MyDown;
-    else if (string.equalsIgnoreCase("UpDown")) return somfy_commands::UpDown;
-    else if (string.equalsIgnoreCase("MyUpDown")) return somfy_commands::MyUpDown;
-    else if (string.equalsIgnoreCase("Prog")) return somfy_commands::Prog;
-    else if (string.equalsIgnoreCase("SunFlag")) return somfy_commands::SunFlag;
-    else if (string.equalsIgnoreCase("StepUp")) return somfy_commands::StepUp;
-    else if (string.equalsIgnoreCase("StepDown")) return somfy_commands::StepDown;
-    else if (string.equalsIgnoreCase("Flag")) return somfy_commands::Flag;
-    else if (string.equalsIgnoreCase("Sensor")) return somfy_commands::Sensor;
-    else if (string.equalsIgnoreCase("Toggle")) return somfy_commands::Toggle;
-    else if (string.equalsIgnoreCase("Favorite")) return somfy_commands::Favorite;
-    else if (string.equalsIgnoreCase("Stop")) return somfy_commands::Stop;
-    else if (string.startsWith("fav") || string.startsWith("FAV")) return somfy_commands::Favorite;
-    else if (string.startsWith("mud") || string.startsWith("MUD")) return somfy_commands::MyUpDown;
-    else if (string.startsWith("md") || string.startsWith("MD")) return somfy_commands::MyDown;
-    else if (string.startsWith("ud") || string.startsWith("UD")) return somfy_commands::UpDown;
-    else if (string.startsWith("mu") || string.startsWith("MU")) return somfy_commands::MyUp;
-    else if (string.startsWith("su") || string.startsWith("SU")) return somfy_commands::StepUp;
-    else if (string.startsWith("sd") || string.startsWith("SD")) return somfy_commands::StepDown;
-    else if (string.startsWith("sen") || string.startsWith("SEN")) return somfy_commands::Sensor;
-    else if (string.startsWith("p") || string.startsWith("P")) return somfy_commands::Prog;
-    else if (string.startsWith("u") || string.startsWith("U")) return somfy_commands::Up;
-    else if (string.startsWith("d") || string.startsWith("D")) return somfy_commands::Down;
-    else if (string.startsWith("m") || string.startsWith("M")) return somfy_commands::My;
-    else if (string.startsWith("f") || string.startsWith("F")) return somfy_commands::Flag;
-    else if (string.startsWith("s") || string.startsWith("S")) return somfy_commands::SunFlag;
-    else if (string.startsWith("t") || string.startsWith("T")) return somfy_commands::Toggle;
-    else if (string.length() == 1) return static_cast<somfy_commands>(strtol(string.c_str(), nullptr, 16));
+// Command names may be abbreviated to a prefix given all in lower or all in upper case.
+static bool commandPrefix(const char *string, const char *lower) {
+  size_t len = strlen(lower);
+  if(strncmp(string, lower, len) == 0) return true;
+  for(size_t i = 0; i < len; i++) {
+    if(string[i] != toupper(lower[i])) return false;
+  }
+  return true;
+}
+somfy_commands translateSomfyCommand(const String& string) { return translateSomfyCommand(string.c_str()); }
+somfy_commands translateSomfyCommand(const char *string) {
+    if (strcasecmp(string, "My") == 0) return somfy_commands::My;
+    else if (strcasecmp(string, "Up") == 0) return somfy_commands::Up;
+    else if (strcasecmp(string, "MyUp") == 0) return somfy_commands::MyUp;
+    else if (strcasecmp(string, "Down") == 0) return somfy_commands::Down;
+    else if (strcasecmp(string, "MyDown") == 0) return somfy_commands::MyDown;
+    else if (strcasecmp(string, "UpDown") == 0) return somfy_commands::UpDown;
+    else if (strcasecmp(string, "MyUpDown") == 0) return somfy_commands::MyUpDown;
+    else if (strcasecmp(string, "Prog") == 0) return somfy_commands::Prog;
+    else if (strcasecmp(string, "SunFlag") == 0) return somfy_commands::SunFlag;
+    else if (strcasecmp(string, "StepUp") == 0) return somfy_commands::StepUp;
+    else if (strcasecmp(string, "StepDown") == 0) return somfy_commands::StepDown;
+    else if (strcasecmp(string, "Flag") == 0) return somfy_commands::Flag;
+    else if (strcasecmp(string, "Sensor") == 0) return somfy_commands::Sensor;
+    else if (strcasecmp(string, "Toggle") == 0) return somfy_commands::Toggle;
+    else if (strcasecmp(string, "Favorite") == 0) return somfy_commands::Favorite;
+    else if (strcasecmp(string, "Stop") == 0) return somfy_commands::Stop;
+    else if (commandPrefix(string, "fav")) return somfy_commands::Favorite;
+    else if (commandPrefix(string, "mud")) return somfy_commands::MyUpDown;
+    else if (commandPrefix(string, "md")) return somfy_commands::MyDown;
+    else if (commandPrefix(string, "ud")) return somfy_commands::UpDown;
+    else if (commandPrefix(string, "mu")) return somfy_commands::MyUp;
+    else if (commandPrefix(string, "su")) return somfy_commands::StepUp;
+    else if (commandPrefix(string, "sd")) return somfy_commands::StepDown;
+    else if (commandPrefix(string, "sen")) return somfy_commands::Sensor;
+    else if (commandPrefix(string, "p")) return somfy_commands::Prog;
+    else if (commandPrefix(string, "u")) return somfy_commands::Up;
+    else if (commandPrefix(string, "d")) return somfy_commands::Down;
+    else if (commandPrefix(string, "m")) return somfy_commands::My;
+    else if (commandPrefix(string, "f")) return somfy_commands::Flag;
+    else if (commandPrefix(string, "s")) return somfy_commands::SunFlag;
+    else if (commandPrefix(string, "t")) return somfy_commands::Toggle;
+    else if (strlen(string) == 1) return static_cast<somfy_commands>(strtol(string, nullptr, 16));
     else return somfy_commands::My;
 }
 String translateSomfyCommand(const somfy_commands cmd) {
@@ -605,6 +620,7 @@ bool SomfyShadeController::begin() {
     this->loadLegacy();
     #endif
   }
+  this->updateRevisions(true);
   this->transceiver.begin();
 
   // Set the radio type for shades that have yet to be specified.
@@ -629,14 +645,52 @@ void SomfyShadeController::commit() {
   file.end();
   this->isDirty = false;
   this->lastCommit = millis();
-}
-void SomfyShadeController::writeBackup() {
-  if(git.lockFS) return;
-  esp_task_wdt_reset(); // Make sure we don't reset inadvertently.
-  ShadeConfigFile file;
-  file.begin("/controller.backup", false);
-  file.backup(this);
-  file.end();
+  this->updateRevisions();
+}
+void SomfyShadeController::updateRevisions(bool prime) {
+  // Each room, shade, and group slot carries the revision where its record last changed
+  // so a backup can export only the records changed since a prior revision.  The revision
+  // counter is kept in NVS so it continues to increase across reboots.  When priming after
+  // the configuration is loaded every record is stamped with the stored revision.
+  if(prime) {
+    pref.begin("ShadeCfg", true);
+    this->configRevision = pref.getULong("revision", 0);
+    pref.end();
+    this->m_revPrimed = true;
+  }
+  else if(!this->m_revPrimed) return;
+  bool changed = false;
+  uint32_t rev = prime ? this->configRevision : this->configRevision + 1;
+  for(uint8_t i = 0; i < SOMFY_MAX_ROOMS; i++) {
+    uint32_t hash = this->rooms[i].roomId != 0 ? ShadeConfigFile::recordHash(&this->rooms[i]) : 0;
+    if(prime || hash != this->roomRevs[i].hash) {
+      this->roomRevs[i].hash = hash;
+      this->roomRevs[i].revision = rev;
+      changed = true;
+    }
+  }
+  for(uint8_t i = 0; i < SOMFY_MAX_SHADES; i++) {
+    uint32_t hash = this->shades[i].getShadeId() != 255 ? ShadeConfigFile::recordHash(&this->shades[i]) : 0;
+    if(prime || hash != this->shadeRevs[i].hash) {
+      this->shadeRevs[i].hash = hash;
+      this->shadeRevs[i].revision = rev;
+      changed = true;
+    }
+  }
+  for(uint8_t i = 0; i < SOMFY_MAX_GROUPS; i++) {
+    uint32_t hash = this->groups[i].getGroupId() != 255 ? ShadeConfigFile::recordHash(&this->groups[i]) : 0;
+    if(prime || hash != this->groupRevs[i].hash) {
+      this->groupRevs[i].hash = hash;
+      this->groupRevs[i].revision = rev;
+      changed = true;
+    }
+  }
+  if(changed && !prime) {
+    this->configRevision = rev;
+    pref.begin("ShadeCfg");
+    pref.putULong("revision", rev);
+    pref.end();
+  }
 }
 SomfyRoom * SomfyShadeController::getRoomById(uint8_t roomId) {
   for(uint8_t i = 0; i < SOMFY_MAX_ROOMS; i++) {
@@ -750,7 +804,7 @@ bool SomfyShade::linkRemote(uint32_t address, uint16_t rollingCode) {
   }
   return false;
 }
-bool SomfyGroup::linkShade(uint8_t shadeId) {
+bool SomfyGroup::linkShade(uint8_t shadeId, bool commit) {
   // Check to see if the shade is already linked. If it is just return true
   for(uint8_t i = 0; i < SOMFY_MAX_GROUPED_SHADES; i++) {
     if(this->linkedShades[i] == shadeId) {
@@ -760,7 +814,7 @@ bool SomfyGroup::linkShade(uint8_t shadeId) {
   for(uint8_t i = 0; i < SOMFY_MAX_GROUPED_SHADES; i++) {
     if(this->linkedShades[i] == 0) {
       this->linkedShades[i] = shadeId;
-      somfy.commit();
+      if(commit) somfy.commit();
       return true;
     }
   }
@@ -1469,7 +1523,7 @@ void SomfyShade::publishState() {
 void SomfyShade::publishDisco() {
   if(!mqtt.connected() || !settings.MQTT.pubDisco) return;
   char topic[128] = "";
-  DynamicJsonDocument doc(2048);
+  MqttJsonDocument doc(2048);
   JsonObject obj = doc.to<JsonObject>();
   snprintf(topic, sizeof(topic), "%s/shades/%d", settings.MQTT.rootTopic, this->shadeId);
   obj["~"] = topic;
@@ -1893,9 +1947,31 @@ float SomfyShade::p_myTiltPos(float pos) {
   return old;
 }
 
-void SomfyShade::emitState(const char *evt) { this->emitState(255, evt); }
+void SomfyShade::emitState(const char *evt) { stateBus.publish(this, evt); }
 void SomfyShade::emitState(uint8_t num, const char *evt) {
-  JsonSockEvent *json = sockEmit.beginEmit(evt);
+  if(num == 255 && sockEmit.subscribers(sock_topics_t::shade, this->shadeId) == 0) return;
+  JsonSockEvent *json = sockEmit.beginEmit(evt, this->shadeId);
+  this->toJSONState(json);
+  if(num == 255) sockEmit.endEmitTopic(sock_topics_t::shade, this->shadeId);
+  else sockEmit.endEmit(num);
+  /*
+  char buf[420];
+  if(this->tiltType != tilt_types::none)
+    snprintf(buf, sizeof(buf), "{\"shadeId\":%d,\"type\":%u,\"remoteAddress\":%d,\"name\":\"%s\",\"direction\":%d,\"position\":%d,\"target\":%d,\"myPos\":%d,\"myTiltPos\":%d,\"tiltType\":%u,\"tiltDirection\":%d,\"tiltTarget\":%d,\"tiltPosition\":%d,\"flipCommands\":%s,\"flipPosition\":%s,\"flags\":%d,\"sunSensor\":%s,\"light\":%s,\"sortOrder\":%d}", 
+      this->shadeId, static_cast<uint8_t>(this->shadeType), this->getRemoteAddress(), this->name, this->direction, 
+      this->transformPosition(this->currentPos), this->transformPosition(this->target), this->transformPosition(this->myPos), this->transformPosition(this->myTiltPos), static_cast<uint8_t>(this->tiltType), this->tiltDirection, 
+      this->transformPosition(this->tiltTarget), this->transformPosition(this->currentTiltPos),
+      this->flipCommands ? "true" : "false", this->flipPosition ? "true": "false", this->flags, this->hasSunSensor() ? "true" : "false", this->hasLight() ? "true" : "false", this->sortOrder);
+  else
+    snprintf(buf, sizeof(buf), "{\"shadeId\":%d,\"type\":%u,\"remoteAddress\":%d,\"name\":\"%s\",\"direction\":%d,\"position\":%d,\"target\":%d,\"myPos\":%d,\"tiltType\":%u,\"flipCommands\":%s,\"flipPosition\":%s,\"flags\":%d,\"sunSensor\":%s,\"light\":%s,\"sortOrder\":%d}", 
+      this->shadeId, static_cast<uint8_t>(this->shadeType), this->getRemoteAddress(), this->name, this->direction, 
+      this->transformPosition(this->currentPos), this->transformPosition(this->target), this->transformPosition(this->myPos), 
+      static_cast<uint8_t>(this->tiltType), this->flipCommands ? "true" : "false", this->flipPosition ? "true": "false", this->flags, this->hasSunSensor() ? "true" : "false", this->hasLight() ? "true" : "false", this->sortOrder);
+  if(num >= 255) sockEmit.sendToClients(evt, buf);
+  else sockEmit.sendToClient(num, evt, buf);
+  */
+}
+void SomfyShade::toJSONState(JsonFormatter *json) {
   json->beginObject();
   json->addElem("shadeId", this->shadeId);
   json->addElem("type", static_cast<uint8_t>(this->shadeType));
@@ -1919,36 +1995,22 @@ void SomfyShade::emitState(uint8_t num, const char *evt) {
     json->addElem("myTiltPos", this->transformPosition(this->myTiltPos));
   }
   json->endObject();
-  sockEmit.endEmit(num);
-  /*
-  char buf[420];
-  if(this->tiltType != tilt_types::none)
-    snprintf(buf, sizeof(buf), "{\"shadeId\":%d,\"type\":%u,\"remoteAddress\":%d,\"name\":\"%s\",\"direction\":%d,\"position\":%d,\"target\":%d,\"myPos\":%d,\"myTiltPos\":%d,\"tiltType\":%u,\"tiltDirection\":%d,\"tiltTarget\":%d,\"tiltPosition\":%d,\"flipCommands\":%s,\"flipPosition\":%s,\"flags\":%d,\"sunSensor\":%s,\"light\":%s,\"sortOrder\":%d}", 
-      this->shadeId, static_cast<uint8_t>(this->shadeType), this->getRemoteAddress(), this->name, this->direction, 
-      this->transformPosition(this->currentPos), this->transformPosition(this->target), this->transformPosition(this->myPos), this->transformPosition(this->myTiltPos), static_cast<uint8_t>(this->tiltType), this->tiltDirection, 
-      this->transformPosition(this->tiltTarget), this->transformPosition(this->currentTiltPos),
-      this->flipCommands ? "true" : "false", this->flipPosition ? "true": "false", this->flags, this->hasSunSensor() ? "true" : "false", this->hasLight() ? "true" : "false", this->sortOrder);
-  else
-    snprintf(buf, sizeof(buf), "{\"shadeId\":%d,\"type\":%u,\"remoteAddress\":%d,\"name\":\"%s\",\"direction\":%d,\"position\":%d,\"target\":%d,\"myPos\":%d,\"tiltType\":%u,\"flipCommands\":%s,\"flipPosition\":%s,\"flags\":%d,\"sunSensor\":%s,\"light\":%s,\"sortOrder\":%d}", 
-      this->shadeId, static_cast<uint8_t>(this->shadeType), this->getRemoteAddress(), this->name, this->direction, 
-      this->transformPosition(this->currentPos), this->transformPosition(this->target), this->transformPosition(this->myPos), 
-      static_cast<uint8_t>(this->tiltType), this->flipCommands ? "true" : "false", this->flipPosition ? "true": "false", this->flags, this->hasSunSensor() ? "true" : "false", this->hasLight() ? "true" : "false", this->sortOrder);
-  if(num >= 255) sockEmit.sendToClients(evt, buf);
-  else sockEmit.sendToClient(num, evt, buf);
-  */
 }
 void SomfyShade::emitCommand(somfy_commands cmd, const char *source, uint32_t sourceAddress, const char *evt) { this->emitCommand(255, cmd, source, sourceAddress, evt); }
 void SomfyShade::emitCommand(uint8_t num, somfy_commands cmd, const char *source, uint32_t sourceAddress, const char *evt) {
-  JsonSockEvent *json = sockEmit.beginEmit(evt);
-  json->beginObject();
-  json->addElem("shadeId", this->shadeId);
-  json->addElem("remoteAddress", (uint32_t)this->getRemoteAddress());
-  json->addElem("cmd", translateSomfyCommand(cmd).c_str());
-  json->addElem("source", source);
-  json->addElem("rcode", (uint32_t)this->lastRollingCode);
-  json->addElem("sourceAddress", (uint32_t)sourceAddress);
-  json->endObject();
-  sockEmit.endEmit(num);
+  if(num != 255 || sockEmit.subscribers(sock_topics_t::shade, this->shadeId) > 0) {
+    JsonSockEvent *json = sockEmit.beginEmit(evt);
+    json->beginObject();
+    json->addElem("shadeId", this->shadeId);
+    json->addElem("remoteAddress", (uint32_t)this->getRemoteAddress());
+    json->addElem("cmd", translateSomfyCommand(cmd).c_str());
+    json->addElem("source", source);
+    json->addElem("rcode", (uint32_t)this->lastRollingCode);
+    json->addElem("sourceAddress", (uint32_t)sourceAddress);
+    json->endObject();
+    if(num == 255) sockEmit.endEmitTopic(sock_topics_t::shade, this->shadeId);
+    else sockEmit.endEmit(num);
+  }
   /*
   ClientSocketEvent e(evt);
   char buf[30];
@@ -1973,9 +2035,9 @@ void SomfyShade::emitCommand(uint8_t num, somfy_commands cmd, const char *source
     this->publish("cmd", translateSomfyCommand(cmd).c_str());
   }
 }
-void SomfyRoom::emitState(const char *evt) { this->emitState(255, evt); }
+void SomfyRoom::emitState(const char *evt) { stateBus.publish(this, evt); }
 void SomfyRoom::emitState(uint8_t num, const char *evt) {
-  JsonSockEvent *json = sockEmit.beginEmit(evt);
+  JsonSockEvent *json = sockEmit.beginEmit(evt, this->roomId);
   json->beginObject();
   json->addElem("roomId", this->roomId);
   json->addElem("name", this->name);
@@ -1995,29 +2057,31 @@ void SomfyRoom::emitState(uint8_t num, const char *evt) {
   if(num >= 255) sockEmit.sendToClients(&e);
   else sockEmit.sendToClient(num, &e);
   */
-  this->publish();
 }
-void SomfyGroup::emitState(const char *evt) { this->emitState(255, evt); }
+void SomfyGroup::emitState(const char *evt) { stateBus.publish(this, evt); }
 void SomfyGroup::emitState(uint8_t num, const char *evt) {
-  uint8_t flags = 0;
-  JsonSockEvent *json = sockEmit.beginEmit(evt);
-  json->beginObject();
-  json->addElem("groupId", this->groupId);
-  json->addElem("remoteAddress", (uint32_t)this->getRemoteAddress());
-  json->addElem("name", this->name);
-  json->addElem("sunSensor", this->hasSunSensor());
-  json->beginArray("shades");
-  for(uint8_t i = 0; i < SOMFY_MAX_GROUPED_SHADES; i++) {
-    if(this->linkedShades[i] != 255 && this->linkedShades[i] != 0) {
-      SomfyShade *shade = somfy.getShadeById(this->linkedShades[i]);
-      if(shade) json->addElem(this->linkedShades[i]);
-      flags |= shade->flags;
+  if(num != 255 || sockEmit.subscribers(sock_topics_t::group, this->groupId) > 0) {
+    uint8_t flags = 0;
+    JsonSockEvent *json = sockEmit.beginEmit(evt, this->groupId);
+    json->beginObject();
+    json->addElem("groupId", this->groupId);
+    json->addElem("remoteAddress", (uint32_t)this->getRemoteAddress());
+    json->addElem("name", this->name);
+    json->addElem("sunSensor", this->hasSunSensor());
+    json->beginArray("shades");
+    for(uint8_t i = 0; i < SOMFY_MAX_GROUPED_SHADES; i++) {
+      if(this->linkedShades[i] != 255 && this->linkedShades[i] != 0) {
+        SomfyShade *shade = somfy.getShadeById(this->linkedShades[i]);
+        if(shade) json->addElem(this->linkedShades[i]);
+        flags |= shade->flags;
+      }
     }
+    json->endArray();
+    json->addElem("flags", flags);
+    json->endObject();
+    if(num == 255) sockEmit.endEmitTopic(sock_topics_t::group, this->groupId);
+    else sockEmit.endEmit(num);
   }
-  json->endArray();
-  json->addElem("flags", flags);
-  json->endObject();
-  sockEmit.endEmit(num);
   /*
   ClientSocketEvent e(evt);
   char buf[55];
@@ -2050,7 +2114,6 @@ void SomfyGroup::emitState(uint8_t num, const char *evt) {
   if(num >= 255) sockEmit.sendToClients(&e);
   else sockEmit.sendToClient(num, &e);
   */
-  this->publish();
 }
 int8_t SomfyShade::transformPosition(float fpos) { 
   if(fpos < 0) return -1;
@@ -3556,7 +3619,7 @@ bool SomfyRemote::toJSON(JsonObject &obj) {
   return true;  
 }
 */
-void SomfyRemote::setRemoteAddress(uint32_t address) { this->m_remoteAddress = address; snprintf(this->m_remotePrefId, sizeof(this->m_remotePrefId), "_%lu", (unsigned long)this->m_remoteAddress); }
+void SomfyRemote::setRemoteAddress(uint32_t address) { this->m_remoteAddress = address; this->m_rcReserved = false; snprintf(this->m_remotePrefId, sizeof(this->m_remotePrefId), "_%lu", (unsigned long)this->m_remoteAddress); }
 uint32_t SomfyRemote::getRemoteAddress() { return this->m_remoteAddress; }
 void SomfyShadeController::processFrame(somfy_frame_t &frame, bool internal) {
   for(uint8_t i = 0; i < SOMFY_MAX_SHADES; i++) {
@@ -3868,6 +3931,144 @@ SomfyGroup *SomfyShadeController::addGroup(JsonObject &obj) {
   }
   return group;
 }
+static bool provisionRef(JsonObject &obj, const char *refKey, const char *idKey, const uint8_t *ids, uint8_t count, uint8_t &id) {
+  // A record may refer to another record in the same document by its index using the
+  // ref key or to a record that already exists using the id key.
+  if(obj.containsKey(refKey)) {
+    uint8_t ref = obj[refKey].as<uint8_t>();
+    if(ref >= count) return false;
+    id = ids[ref];
+    return true;
+  }
+  if(obj.containsKey(idKey)) id = obj[idKey].as<uint8_t>();
+  return true;
+}
+bool SomfyShadeController::provision(JsonObject &obj, provision_result_t &result) {
+  // Everything in the document is applied in memory and only committed once all of it has
+  // been validated.  If any record is rejected the records that were added are cleared and
+  // the group links are put back so nothing from the document is kept.
+  JsonArray rooms = obj["rooms"];
+  JsonArray shades = obj["shades"];
+  JsonArray groups = obj["groups"];
+  JsonArray links = obj["links"];
+  uint8_t linked[SOMFY_MAX_GROUPS][SOMFY_MAX_GROUPED_SHADES];
+  for(uint8_t i = 0; i < SOMFY_MAX_GROUPS; i++)
+    memcpy(linked[i], this->groups[i].linkedShades, sizeof(linked[i]));
+  bool ok = true;
+  uint8_t ndx = 0;
+  for(JsonObject robj : rooms) {
+    SomfyRoom *room = this->addRoom();
+    if(!room) {
+      snprintf(result.desc, sizeof(result.desc), "Maximum number of rooms exceeded at room %u.", ndx);
+      ok = false;
+      break;
+    }
+    result.rooms[result.roomCount++] = room->roomId;
+    room->fromJSON(robj);
+    ndx++;
+  }
+  ndx = 0;
+  for(JsonObject sobj : shades) {
+    if(!ok) break;
+    SomfyShade *shade = this->addShade();
+    if(!shade) {
+      snprintf(result.desc, sizeof(result.desc), "Maximum number of shades exceeded at shade %u.", ndx);
+      ok = false;
+      break;
+    }
+    result.shades[result.shadeCount++] = shade->getShadeId();
+    uint8_t roomId = 0;
+    int8_t err = shade->validateJSON(sobj);
+    if(err != 0) {
+      snprintf(result.desc, sizeof(result.desc), "Shade %u is invalid (%d).", ndx, err);
+      ok = false;
+    }
+    else if(!provisionRef(sobj, "roomRef", "roomId", result.rooms, result.roomCount, roomId) || (roomId != 0 && !this->getRoomById(roomId))) {
+      snprintf(result.desc, sizeof(result.desc), "Shade %u references an unknown room.", ndx);
+      ok = false;
+    }
+    else {
+      shade->bitLength = this->transceiver.config.type;
+      shade->proto = this->transceiver.config.proto;
+      shade->setRemoteAddress(this->getNextRemoteAddress(shade->getShadeId()));
+      shade->fromJSON(sobj);
+      shade->roomId = roomId;
+    }
+    ndx++;
+  }
+  ndx = 0;
+  for(JsonObject gobj : groups) {
+    if(!ok) break;
+    SomfyGroup *group = this->addGroup();
+    if(!group) {
+      snprintf(result.desc, sizeof(result.desc), "Maximum number of groups exceeded at group %u.", ndx);
+      ok = false;
+      break;
+    }
+    result.groups[result.groupCount++] = group->getGroupId();
+    uint8_t roomId = 0;
+    if(!provisionRef(gobj, "roomRef", "roomId", result.rooms, result.roomCount, roomId) || (roomId != 0 && !this->getRoomById(roomId))) {
+      snprintf(result.desc, sizeof(result.desc), "Group %u references an unknown room.", ndx);
+      ok = false;
+    }
+    else {
+      group->bitLength = this->transceiver.config.type;
+      group->proto = this->transceiver.config.proto;
+      group->setRemoteAddress(this->getNextRemoteAddress(group->getGroupId()));
+      group->fromJSON(gobj);
+      group->roomId = roomId;
+    }
+    ndx++;
+  }
+  ndx = 0;
+  for(JsonObject lobj : links) {
+    if(!ok) break;
+    uint8_t groupId = 0, shadeId = 0;
+    provisionRef(lobj, "groupRef", "groupId", result.groups, result.groupCount, groupId);
+    provisionRef(lobj, "shadeRef", "shadeId", result.shades, result.shadeCount, shadeId);
+    SomfyGroup *group = groupId != 0 ? this->getGroupById(groupId) : nullptr;
+    SomfyShade *shade = shadeId != 0 ? this->getShadeById(shadeId) : nullptr;
+    if(!group || !shade) {
+      snprintf(result.desc, sizeof(result.desc), "Link %u references an unknown %s.", ndx, group ? "shade" : "group");
+      ok = false;
+    }
+    else if(!group->linkShade(shadeId, false)) {
+      snprintf(result.desc, sizeof(result.desc), "Link %u exceeds the shades allowed in a group.", ndx);
+      ok = false;
+    }
+    else result.links++;
+    ndx++;
+  }
+  if(!ok) {
+    Serial.printf("Provisioning rejected: %s\n", result.desc);
+    for(uint8_t i = 0; i < result.roomCount; i++) this->getRoomById(result.rooms[i])->clear();
+    for(uint8_t i = 0; i < result.shadeCount; i++) this->getShadeById(result.shades[i])->clear();
+    for(uint8_t i = 0; i < result.groupCount; i++) this->getGroupById(result.groups[i])->clear();
+    for(uint8_t i = 0; i < SOMFY_MAX_GROUPS; i++)
+      memcpy(this->groups[i].linkedShades, linked[i], sizeof(linked[i]));
+    result.roomCount = result.shadeCount = result.groupCount = result.links = 0;
+    return false;
+  }
+  this->updateGroupFlags();
+  this->commit();
+  Serial.printf("Provisioned %u rooms, %u shades, %u groups, and %u links\n", result.roomCount, result.shadeCount, result.groupCount, result.links);
+  for(uint8_t i = 0; i < result.roomCount; i++) this->getRoomById(result.rooms[i])->emitState("roomAdded");
+  for(uint8_t i = 0; i < result.shadeCount; i++) this->getShadeById(result.shades[i])->emitState("shadeAdded");
+  for(uint8_t i = 0; i < result.groupCount; i++) this->getGroupById(result.groups[i])->emitState("groupAdded");
+  return true;
+}
+void provision_result_t::toJSON(JsonResponse &json) {
+  json.beginArray("rooms");
+  for(uint8_t i = 0; i < this->roomCount; i++) json.addElem(this->rooms[i]);
+  json.endArray();
+  json.beginArray("shades");
+  for(uint8_t i = 0; i < this->shadeCount; i++) json.addElem(this->shades[i]);
+  json.endArray();
+  json.beginArray("groups");
+  for(uint8_t i = 0; i < this->groupCount; i++) json.addElem(this->groups[i]);
+  json.endArray();
+  json.addElem("links", this->links);
+}
 SomfyGroup *SomfyShadeController::addGroup() {
   uint8_t groupId = this->getNextGroupId();
   // So the next shade id will be the first one we run into with an id of 255 so
@@ -4087,11 +4288,23 @@ bool SomfyShadeController::deleteGroup(uint8_t groupId) {
 
 bool SomfyShadeController::loadShadesFile(const char *filename) { return ShadeConfigFile::load(this, filename); }
 uint16_t SomfyRemote::getNextRollingCode() {
-  pref.begin("ShadeCodes");
-  uint16_t code = pref.getUShort(this->m_remotePrefId, 0);
-  code++;
-  pref.putUShort(this->m_remotePrefId, code);
-  pref.end();
+  // Codes are handed out from RAM inside a block that has already been reserved
+  // on NVS.  The NVS value is the top of the reserved block so if we reboot before
+  // the block is used up the shade load will skip ahead past the unsent codes.
+  uint16_t code = this->lastRollingCode + 1;
+  uint16_t remaining = this->m_rcReserveEnd - this->lastRollingCode;
+  if(!this->m_rcReserved || remaining == 0 || remaining > SOMFY_ROLLING_CODE_BLOCK) {
+    pref.begin("ShadeCodes");
+    uint16_t stored = pref.getUShort(this->m_remotePrefId, 0);
+    code = max(stored, this->lastRollingCode) + 1;
+    this->m_rcReserveEnd = code + SOMFY_ROLLING_CODE_BLOCK - 1;
+    pref.putUShort(this->m_remotePrefId, this->m_rcReserveEnd);
+    pref.end();
+    this->m_rcReserved = true;
+    somfy.rollingCodeStats.writes++;
+    //Serial.printf("Reserved rolling codes %d-%d\n", code, this->m_rcReserveEnd);
+  }
+  somfy.rollingCodeStats.commands++;
   this->p_lastRollingCode(code);
   //Serial.printf("Getting Next Rolling code %d\n", this->lastRollingCode);
   return code;
@@ -4107,10 +4320,18 @@ uint16_t SomfyRemote::setRollingCode(uint16_t code) {
     pref.putUShort(this->m_remotePrefId, code);
     pref.end();  
     this->lastRollingCode = code;
+    this->m_rcReserved = false;
     Serial.printf("Setting Last Rolling code %d\n", this->lastRollingCode);
   }
   return code;
 }
+uint32_t rolling_code_stats_t::writesPer1000() { return this->commands > 0 ? (this->writes * 1000) / this->commands : 0; }
+void rolling_code_stats_t::toJSON(JsonResponse &json) {
+  json.addElem("blockSize", (uint32_t)SOMFY_ROLLING_CODE_BLOCK);
+  json.addElem("commands", this->commands);
+  json.addElem("writes", this->writes);
+  json.addElem("writesPer1000", this->writesPer1000());
+}
 void SomfyShadeController::toJSONRooms(JsonResponse &json) {
   for(uint8_t i = 0; i < SOMFY_MAX_ROOMS; i++) {
     SomfyRoom *room = &this->rooms[i];
@@ -4239,6 +4460,8 @@ static const uint32_t tempo_if_gap = 30415;  // Gap between frames
 static int16_t  bitMin = SYMBOL * TOLERANCE_MIN;
 static somfy_rx_t somfy_rx;
 static somfy_rx_queue_t rx_queue;
+static volatile uint32_t rx_dropped = 0;
+uint32_t rf_frame_stats_t::dropped() { return rx_dropped; }
 static somfy_tx_queue_t tx_queue;
 bool somfy_tx_queue_t::pop(somfy_tx_t *tx) {
   // Read the oldest index.
@@ -4311,6 +4534,7 @@ bool somfy_rx_queue_t::pop(somfy_rx_t *rx) {
 
 void Transceiver::sendFrame(byte *frame, uint8_t sync, uint8_t bitLength) {
   if(!this->config.enabled) return;
+  this->stats.sent++;
   uint32_t pin = 1 << this->config.TXPin;
   if (sync == 2 || sync == 12) {  // Only with the first frame.  Repeats do not get a wakeup pulse.
     // All information online for the wakeup pulse appears to be incorrect.  While there is a wakeup
@@ -4488,6 +4712,7 @@ void RECEIVE_ATTR Transceiver::handleReceive() {
           //memset(&this->items[ndx], 0x00, sizeof(somfy_rx_t));
           rx_queue.index[MAX_RX_BUFFER - 1] = 255;
           rx_queue.length--;
+          rx_dropped++;
         }
         uint8_t first = 0;
         // Place this record in the first empty slot.  There will
@@ -4573,7 +4798,8 @@ void Transceiver::endFrequencyScan() {
   }
 }
 void Transceiver::emitFrequencyScan(uint8_t num) {
-  JsonSockEvent *json = sockEmit.beginEmit("frequencyScan");
+  if(num == 255 && sockEmit.subscribers(sock_topics_t::scan) == 0) return;
+  JsonSockEvent *json = sockEmit.beginEmit("frequencyScan", 0);
   json->beginObject();
   json->addElem("scanning", rxmode == 3);
   json->addElem("testFreq", currFreq);
@@ -4581,7 +4807,8 @@ void Transceiver::emitFrequencyScan(uint8_t num) {
   json->addElem("frequency", markFreq);
   json->addElem("RSSI", (int32_t)markRSSI);
   json->endObject();
-  sockEmit.endEmit(num);
+  if(num == 255) sockEmit.endEmitTopic(sock_topics_t::scan);
+  else sockEmit.endEmit(num);
   /*
   char buf[420];
   snprintf(buf, sizeof(buf), "{\"scanning\":%s,\"testFreq\":%f,\"testRSSI\":%d,\"frequency\":%f,\"RSSI\":%d}", rxmode == 3 ? "true" : "false", currFreq, currRSSI, markFreq, markRSSI); 
@@ -4596,12 +4823,14 @@ bool Transceiver::receive(somfy_rx_t *rx) {
       rx_queue.pop(rx);
       this->frame.decodeFrame(rx);
       this->emitFrame(&this->frame, rx);
+      this->stats.received++;
+      if(!this->frame.valid) this->stats.invalid++;
       return this->frame.valid;
     }
     return false;
 }
 void Transceiver::emitFrame(somfy_frame_t *frame, somfy_rx_t *rx) {
-  if(sockEmit.activeClients(ROOM_EMIT_FRAME) > 0) {
+  if(sockEmit.subscribers(sock_topics_t::frames) > 0) {
     JsonSockEvent *json = sockEmit.beginEmit("remoteFrame");
     json->beginObject();
     json->addElem("encKey", frame->encKey);
@@ -4623,7 +4852,7 @@ void Transceiver::emitFrame(somfy_frame_t *frame, somfy_rx_t *rx) {
     }
     json->endArray();
     json->endObject();
-    sockEmit.endEmitRoom(ROOM_EMIT_FRAME);
+    sockEmit.endEmitTopic(sock_topics_t::frames);
     /*
     ClientSocketEvent evt("remoteFrame");
     char buf[30];
@@ -5116,6 +5345,7 @@ void Transceiver::loop() {
 }
 somfy_frame_t& Transceiver::lastFrame() { return this->frame; }
 void Transceiver::beginTransmit() {
+    boot.markTransmit();
     if(this->config.enabled) {
       this->disableReceive();
       pinMode(this->config.TXPin, OUTPUT);
@@ -9,6 +9,9 @@
 #define SOMFY_MAX_GROUPED_SHADES 32
 #define SOMFY_MAX_ROOMS 16
 #define SOMFY_MAX_REPEATERS 7
+// Number of rolling codes reserved on NVS with a single write.  After a reboot
+// the remote skips ahead past any codes in the block that were never sent.
+#define SOMFY_ROLLING_CODE_BLOCK 32
 
 #define SECS_TO_MILLIS(x) ((x) * 1000)
 #define MINS_TO_MILLIS(x) SECS_TO_MILLIS((x) * 60)
@@ -81,6 +84,7 @@ enum class tilt_types : byte {
 };
 String translateSomfyCommand(const somfy_commands cmd);
 somfy_commands translateSomfyCommand(const String& string);
+somfy_commands translateSomfyCommand(const char *string);
 
 #define MAX_TIMINGS 300
 #define MAX_RX_BUFFER 3
@@ -223,6 +227,8 @@ class SomfyRemote {
   protected:
     char m_remotePrefId[11] = "";
     uint32_t m_remoteAddress = 0;
+    bool m_rcReserved = false;
+    uint16_t m_rcReserveEnd = 0;
   public:
     radio_proto proto = radio_proto::RTS;
     uint8_t gpioFlags = 0;
@@ -335,6 +341,7 @@ class SomfyShade : public SomfyRemote {
     bool unlinkRemote(uint32_t remoteAddress);
     void emitState(const char *evt = "shadeState");
     void emitState(uint8_t num, const char *evt = "shadeState");
+    void toJSONState(JsonFormatter *json);
     void emitCommand(somfy_commands cmd, const char *source, uint32_t sourceAddress, const char *evt = "shadeCommand");
     void emitCommand(uint8_t num, somfy_commands cmd, const char *source, uint32_t sourceAddress, const char *evt = "shadeCommand");
     void setMyPosition(int8_t pos, int8_t tilt = -1);
@@ -396,7 +403,7 @@ class SomfyGroup : public SomfyRemote {
     void toJSON(JsonResponse &json);
     void toJSONRef(JsonResponse &json);
     
-    bool linkShade(uint8_t shadeId);
+    bool linkShade(uint8_t shadeId, bool commit = true);
     bool unlinkShade(uint8_t shadeId);
     bool hasShadeId(uint8_t shadeId);
     void compressLinkedShadeIds();
@@ -491,6 +498,12 @@ struct transceiver_config_t {
     void apply();
     void removeNVSKey(const char *key);
 };
+struct rf_frame_stats_t {
+  uint32_t received = 0;            // Frames taken off the receive queue.
+  uint32_t invalid = 0;             // Received frames that failed to decode.
+  uint32_t sent = 0;                // Frames written to the radio including repeats.
+  uint32_t dropped();               // Received frames pushed out of a full receive queue.
+};
 class Transceiver {
   private:
     static void handleReceive();
@@ -498,6 +511,7 @@ class Transceiver {
     somfy_frame_t frame;
   public:
     transceiver_config_t config;
+    rf_frame_stats_t stats;
     bool printBuffer = false;
     //bool toJSON(JsonObject& obj);
     void toJSON(JsonResponse& json);
@@ -521,11 +535,38 @@ class Transceiver {
     void emitFrequencyScan(uint8_t num = 255);
     bool usesPin(uint8_t pin);
 };
+struct rolling_code_stats_t {
+  uint32_t commands = 0;            // Rolling codes handed out for transmitted commands.
+  uint32_t writes = 0;              // NVS writes made to reserve rolling code blocks.
+  uint32_t writesPer1000();
+  void toJSON(JsonResponse &json);
+};
+struct provision_result_t {
+  uint8_t rooms[SOMFY_MAX_ROOMS];   // Ids assigned to the rooms in document order.
+  uint8_t roomCount = 0;
+  uint8_t shades[SOMFY_MAX_SHADES]; // Ids assigned to the shades in document order.
+  uint8_t shadeCount = 0;
+  uint8_t groups[SOMFY_MAX_GROUPS]; // Ids assigned to the groups in document order.
+  uint8_t groupCount = 0;
+  uint8_t links = 0;
+  char desc[64] = "";
+  void toJSON(JsonResponse &json);
+};
+struct config_rev_t {
+  uint32_t hash = 0;                // Hash of the record as it was last written.
+  uint32_t revision = 0;            // Configuration revision where the record last changed.
+};
 class SomfyShadeController {
   protected:
     uint8_t m_shadeIds[SOMFY_MAX_SHADES];
     uint32_t lastCommit = 0;
+    bool m_revPrimed = false;
   public:
+    uint32_t configRevision = 0;
+    config_rev_t roomRevs[SOMFY_MAX_ROOMS];
+    config_rev_t shadeRevs[SOMFY_MAX_SHADES];
+    config_rev_t groupRevs[SOMFY_MAX_GROUPS];
+    void updateRevisions(bool prime = false);
     bool useNVS();
     bool isDirty = false;
     uint32_t startingAddress;
@@ -538,12 +579,14 @@ class SomfyShadeController {
     uint32_t getNextRemoteAddress(uint8_t shadeId);
     SomfyShadeController();
     Transceiver transceiver;
+    rolling_code_stats_t rollingCodeStats;
     SomfyRoom *addRoom();
     SomfyRoom *addRoom(JsonObject &obj);
     SomfyShade *addShade();
     SomfyShade *addShade(JsonObject &obj);
     SomfyGroup *addGroup();
     SomfyGroup *addGroup(JsonObject &obj);
+    bool provision(JsonObject &obj, provision_result_t &result);
     bool deleteRoom(uint8_t roomId);
     bool deleteShade(uint8_t shadeId);
     bool deleteGroup(uint8_t groupId);
@@ -577,7 +620,6 @@ class SomfyShadeController {
     void publish();
     void processWaitingFrame();
     void commit();
-    void writeBackup();
     bool loadShadesFile(const char *filename);
     #ifdef USE_NVS
     bool loadLegacy();
@@ -0,0 +1,41 @@
+#include <Arduino.h>
+#include "StateBus.h"
+#include "Somfy.h"
+#include "Sockets.h"
+#include "TelnetServer.h"
+#include "MQTT.h"
+
+extern SocketEmitter sockEmit;
+extern TelnetServer telnet;
+extern MQTTClass mqtt;
+
+void StateBus::publish(SomfyShade *shade, const char *evt) {
+  state_change_t change;
+  change.kind = state_kinds_t::shade;
+  change.id = shade->getShadeId();
+  change.evt = evt;
+  change.shade = shade;
+  this->fanOut(change);
+}
+void StateBus::publish(SomfyGroup *group, const char *evt) {
+  state_change_t change;
+  change.kind = state_kinds_t::group;
+  change.id = group->getGroupId();
+  change.evt = evt;
+  change.group = group;
+  this->fanOut(change);
+}
+void StateBus::publish(SomfyRoom *room, const char *evt) {
+  state_change_t change;
+  change.kind = state_kinds_t::room;
+  change.id = room->roomId;
+  change.evt = evt;
+  change.room = room;
+  this->fanOut(change);
+}
+void StateBus::fanOut(state_change_t &change) {
+  this->published++;
+  sockEmit.onStateChange(change);
+  telnet.onStateChange(change);
+  mqtt.onStateChange(change);
+}
@@ -0,0 +1,34 @@
+#include <Arduino.h>
+#ifndef statebus_h
+#define statebus_h
+
+class SomfyShade;
+class SomfyGroup;
+class SomfyRoom;
+enum class state_kinds_t : uint8_t {
+  shade = 0,
+  group = 1,
+  room = 2
+};
+// A change to a shade, group or room.  Only the pointer for the kind is set and it is
+// only good for the duration of the publish.
+struct state_change_t {
+  state_kinds_t kind = state_kinds_t::shade;
+  uint8_t id = 255;
+  const char *evt = nullptr;
+  SomfyShade *shade = nullptr;
+  SomfyGroup *group = nullptr;
+  SomfyRoom *room = nullptr;
+};
+// Hands each state change to every transport once.  Each transport serializes the
+// change a single time in its own wire format and sends that to all of its clients.
+class StateBus {
+  protected:
+    void fanOut(state_change_t &change);
+  public:
+    uint32_t published = 0;
+    void publish(SomfyShade *shade, const char *evt);
+    void publish(SomfyGroup *group, const char *evt);
+    void publish(SomfyRoom *room, const char *evt);
+};
+#endif
@@ -1,11 +1,112 @@
 #include <Arduino.h>
 #include <ctype.h>
 #include <esp_task_wdt.h>
+#include <errno.h>
+#include <lwip/sockets.h>
 #include "TelnetServer.h"
 #include "DinplugBridge.h"
+#include "Profiler.h"
+#include "Metrics.h"
 
 extern SomfyShadeController somfy;
+extern LoopProfiler profiler;
 
+static_assert(TELNET_MAP_PAGE < TELNET_TX_DEPTH && (TELNET_MAP_PAGE + 1) * 192 <= TELNET_TX_BYTES, "A page of dinplug mappings must fit the output queue");
+
+void TelnetOutput::begin(int fd) {
+  this->fd = fd;
+  this->used = 0;
+  this->sent = 0;
+  this->count = 0;
+  this->lineLen = 0;
+  this->failed = false;
+}
+// Writes as much as the socket will take right now and never waits on the client.
+int TelnetOutput::sendNow(const char *data, size_t len) {
+  if(this->fd < 0 || this->failed || len == 0) return 0;
+  int n = ::send(this->fd, data, len, MSG_DONTWAIT);
+  if(n < 0) {
+    if(errno != EAGAIN && errno != EWOULDBLOCK) this->failed = true;
+    return 0;
+  }
+  this->bytesSent += n;
+  return n;
+}
+void TelnetOutput::removeLine(uint8_t index) {
+  uint16_t offset = 0;
+  for(uint8_t i = 0; i < index; i++) offset += this->lines[i].len;
+  uint16_t len = this->lines[index].len;
+  memmove(&this->buff[offset], &this->buff[offset + len], this->used - offset - len);
+  memmove(&this->lines[index], &this->lines[index + 1], (this->count - index - 1) * sizeof(telnet_line_t));
+  this->used -= len;
+  this->count--;
+}
+// Drops the oldest update that has not started going out.
+bool TelnetOutput::dropUpdate() {
+  for(uint8_t i = this->sent > 0 ? 1 : 0; i < this->count; i++) {
+    if(this->lines[i].update) {
+      this->removeLine(i);
+      this->updatesDropped++;
+      return true;
+    }
+  }
+  return false;
+}
+bool TelnetOutput::push(const char *data, size_t len, bool update) {
+  if(this->fd < 0 || this->failed) return false;
+  bool started = false;
+  if(this->count == 0) {
+    int n = this->sendNow(data, len);
+    data += n;
+    len -= n;
+    if(len == 0) return true;
+    started = n > 0;
+  }
+  while(len <= TELNET_TX_BYTES && (this->count >= TELNET_TX_DEPTH || this->used + len > TELNET_TX_BYTES)) {
+    if(!this->dropUpdate()) break;
+  }
+  if(len > TELNET_TX_BYTES || this->count >= TELNET_TX_DEPTH || this->used + len > TELNET_TX_BYTES) {
+    if(update) this->updatesDropped++;
+    else this->repliesDropped++;
+    return false;
+  }
+  memcpy(&this->buff[this->used], data, len);
+  this->lines[this->count].len = len;
+  // The rest of a line that has started going out can no longer be dropped.
+  this->lines[this->count].update = update && !started;
+  this->count++;
+  this->used += len;
+  if(this->used > this->highWater) this->highWater = this->used;
+  return true;
+}
+void TelnetOutput::drain() {
+  if(this->count == 0) return;
+  int n = this->sendNow(&this->buff[this->sent], this->used - this->sent);
+  if(n <= 0) return;
+  // The queue is one run of bytes so everything that went out is trimmed from the
+  // front in a single move.
+  uint16_t done = this->sent + n;
+  uint16_t lineBytes = 0;
+  uint8_t lineCount = 0;
+  while(lineCount < this->count && lineBytes + this->lines[lineCount].len <= done) lineBytes += this->lines[lineCount++].len;
+  memmove(this->buff, &this->buff[lineBytes], this->used - lineBytes);
+  memmove(this->lines, &this->lines[lineCount], (this->count - lineCount) * sizeof(telnet_line_t));
+  this->used -= lineBytes;
+  this->count -= lineCount;
+  this->sent = done - lineBytes;
+}
+size_t TelnetOutput::write(uint8_t ch) { return this->write(&ch, 1); }
+// Print output is gathered into lines so a reply is never split across a dropped update.
+size_t TelnetOutput::write(const uint8_t *data, size_t len) {
+  for(size_t i = 0; i < len; i++) {
+    this->line[this->lineLen++] = data[i];
+    if(data[i] == '\n' || this->lineLen >= sizeof(this->line)) {
+      this->push(this->line, this->lineLen);
+      this->lineLen = 0;
+    }
+  }
+  return len;
+}
 TelnetServer::TelnetServer() : server(23) {
   for(auto &c : this->clients) this->resetInput(c);
 }
@@ -14,6 +115,13 @@ void TelnetServer::begin() {
   this->server.setNoDelay(true);
   Serial.println("Telnet server listening on port 23...");
 }
+// The goodbye is written before the socket closes but it is not waited on.
+void TelnetServer::disconnect(TelnetClient &c) {
+  c.out.drain();
+  c.client.stop();
+  c.out.begin(-1);
+  this->resetInput(c);
+}
 void TelnetServer::resetInput(TelnetClient &c) {
   memset(c.inputBuffer, 0x00, sizeof(c.inputBuffer));
   c.inputLength = 0;
@@ -25,26 +133,187 @@ bool TelnetServer::parseId(const char *token, uint8_t *outId) {
   *outId = static_cast<uint8_t>(val);
   return true;
 }
-void TelnetServer::printShadeJson(TelnetClient &c, SomfyShade *shade, const char *evt) {
-  if(!c.client || !c.client.connected() || !shade) return;
+// Parses all, none or a comma separated list of shade ids into a watch mask.
+bool TelnetServer::parseWatch(const char *token, uint32_t *mask) {
+  if(!token || !mask) return false;
+  if(strcasecmp(token, "all") == 0 || strcmp(token, "*") == 0) {
+    *mask = TELNET_WATCH_ALL;
+    return true;
+  }
+  if(strcasecmp(token, "none") == 0) {
+    *mask = 0;
+    return true;
+  }
+  uint32_t bits = 0;
+  const char *p = token;
+  while(*p) {
+    char *end = nullptr;
+    long id = strtol(p, &end, 10);
+    if(end == p || id < 1 || id > 32) return false;
+    bits |= 1UL << (id - 1);
+    p = end;
+    if(*p == ',') p++;
+    else if(*p) return false;
+  }
+  *mask = bits;
+  return true;
+}
+void TelnetServer::printWatch(TelnetClient &c) {
+  char buf[200];
+  int n = snprintf(buf, sizeof(buf), "{\"event\":\"watch\",\"shades\":");
+  if(c.watch == TELNET_WATCH_ALL) n += snprintf(&buf[n], sizeof(buf) - n, "\"all\"}");
+  else {
+    n += snprintf(&buf[n], sizeof(buf) - n, "[");
+    bool first = true;
+    for(uint8_t id = 1; id <= 32 && n < (int)sizeof(buf) - 6; id++) {
+      if(!(c.watch & (1UL << (id - 1)))) continue;
+      n += snprintf(&buf[n], sizeof(buf) - n, first ? "%u" : ",%u", id);
+      first = false;
+    }
+    snprintf(&buf[n], sizeof(buf) - n, "]}");
+  }
+  this->sendJson(c, buf);
+}
+size_t TelnetServer::formatShadeJson(char *buf, size_t size, SomfyShade *shade, const char *evt) {
   const int8_t pos = shade->transformPosition(shade->currentPos);
   const int8_t target = shade->transformPosition(shade->target);
-  char buf[256];
-  int n = snprintf(buf, sizeof(buf),
+  int n = snprintf(buf, size,
     "{\"event\":\"%s\",\"id\":%u,\"name\":\"%s\",\"pos\":%d,\"target\":%d,\"dir\":%d,\"addr\":%lu,\"flags\":%u",
     evt, shade->getShadeId(), shade->name, pos, target, shade->direction,
     static_cast<unsigned long>(shade->getRemoteAddress()), shade->flags);
   if(shade->tiltType != tilt_types::none) {
     const int8_t tiltPos = shade->transformPosition(shade->currentTiltPos);
     const int8_t tiltTarget = shade->transformPosition(shade->tiltTarget);
-    n += snprintf(&buf[n], sizeof(buf) - n, ",\"tiltPos\":%d,\"tiltTarget\":%d,\"tiltDir\":%d",
+    n += snprintf(&buf[n], size - n, ",\"tiltPos\":%d,\"tiltTarget\":%d,\"tiltDir\":%d",
       tiltPos, tiltTarget, shade->tiltDirection);
   }
-  n += snprintf(&buf[n], sizeof(buf) - n, "}");
-  if(n < (int)sizeof(buf)) {
+  n += snprintf(&buf[n], size - n, "}");
+  if(n < (int)size - 2) {
     buf[n++] = '\r'; buf[n++] = '\n'; buf[n] = '\0';
   }
-  c.client.write((const uint8_t *)buf, strlen(buf));
+  return strlen(buf);
+}
+// The state is the shade id, position, target, direction and flags followed by the
+// tilt position, target and direction, which are -1 for a shade without tilt.
+void TelnetServer::encodeShadeState(uint8_t *buf, SomfyShade *shade) {
+  const bool tilt = shade->tiltType != tilt_types::none;
+  buf[0] = shade->getShadeId();
+  buf[1] = static_cast<uint8_t>(shade->transformPosition(shade->currentPos));
+  buf[2] = static_cast<uint8_t>(shade->transformPosition(shade->target));
+  buf[3] = static_cast<uint8_t>(shade->direction);
+  buf[4] = shade->flags;
+  buf[5] = static_cast<uint8_t>(tilt ? shade->transformPosition(shade->currentTiltPos) : -1);
+  buf[6] = static_cast<uint8_t>(tilt ? shade->transformPosition(shade->tiltTarget) : -1);
+  buf[7] = static_cast<uint8_t>(tilt ? shade->tiltDirection : -1);
+}
+size_t TelnetServer::formatShadeFrame(uint8_t *buf, SomfyShade *shade, bool removed) {
+  const uint8_t len = removed ? 1 : TELNET_BIN_STATE;
+  buf[0] = len + 3;
+  buf[1] = 0;
+  buf[2] = static_cast<uint8_t>(removed ? telnet_ops_t::removed : telnet_ops_t::state);
+  buf[3] = 0;
+  buf[4] = 0;
+  if(removed) buf[TELNET_BIN_HEADER] = shade->getShadeId();
+  else this->encodeShadeState(&buf[TELNET_BIN_HEADER], shade);
+  return TELNET_BIN_HEADER + len;
+}
+void TelnetServer::sendFrame(TelnetClient &c, uint8_t op, uint16_t seq, const uint8_t *data, uint8_t len) {
+  uint8_t buf[TELNET_BIN_HEADER + 16];
+  if(len > sizeof(buf) - TELNET_BIN_HEADER) return;
+  buf[0] = len + 3;
+  buf[1] = 0;
+  buf[2] = op;
+  buf[3] = seq & 0xFF;
+  buf[4] = seq >> 8;
+  if(len > 0) memcpy(&buf[TELNET_BIN_HEADER], data, len);
+  c.out.push(reinterpret_cast<const char *>(buf), TELNET_BIN_HEADER + len);
+}
+void TelnetServer::sendResponse(TelnetClient &c, telnet_ops_t op, uint16_t seq, telnet_status_t status, const uint8_t *data, uint8_t len) {
+  uint8_t payload[16];
+  if(len > sizeof(payload) - 1) return;
+  payload[0] = static_cast<uint8_t>(status);
+  if(len > 0) memcpy(&payload[1], data, len);
+  this->sendFrame(c, static_cast<uint8_t>(op) | static_cast<uint8_t>(telnet_ops_t::response), seq, payload, len + 1);
+}
+// Frames are gathered in the input buffer.  A length that cannot be a valid frame
+// means the stream is out of step so the client is dropped rather than guessed at.
+void TelnetServer::readBinary(TelnetClient &c, char ch) {
+  c.inputBuffer[c.inputLength++] = ch;
+  if(c.inputLength < 2) return;
+  const uint8_t *buf = reinterpret_cast<const uint8_t *>(c.inputBuffer);
+  const uint16_t len = buf[0] | (buf[1] << 8);
+  if(len < 3 || len + 2 > sizeof(c.inputBuffer)) {
+    this->disconnect(c);
+    return;
+  }
+  if(c.inputLength < len + 2) return;
+  this->handleFrame(c, static_cast<telnet_ops_t>(buf[2]), buf[3] | (buf[4] << 8), &buf[TELNET_BIN_HEADER], len - 3);
+  c.inputLength = 0;
+}
+// Only the commands a shade knows how to send are taken off the wire.
+static bool isFrameCommand(uint8_t cmd) {
+  switch(static_cast<somfy_commands>(cmd)) {
+    case somfy_commands::My:
+    case somfy_commands::Up:
+    case somfy_commands::MyUp:
+    case somfy_commands::Down:
+    case somfy_commands::MyDown:
+    case somfy_commands::UpDown:
+    case somfy_commands::MyUpDown:
+    case somfy_commands::Prog:
+    case somfy_commands::SunFlag:
+    case somfy_commands::Flag:
+    case somfy_commands::StepDown:
+    case somfy_commands::Toggle:
+    case somfy_commands::Sensor:
+    case somfy_commands::StepUp:
+    case somfy_commands::Favorite:
+    case somfy_commands::Stop:
+      return true;
+    default:
+      return false;
+  }
+}
+void TelnetServer::handleFrame(TelnetClient &c, telnet_ops_t op, uint16_t seq, const uint8_t *data, uint16_t len) {
+  SomfyShade *shade = nullptr;
+  switch(op) {
+    case telnet_ops_t::move:
+    case telnet_ops_t::command:
+    case telnet_ops_t::query:
+      if(len < (op == telnet_ops_t::move ? 2 : op == telnet_ops_t::command ? 4 : 1)) break;
+      shade = somfy.getShadeById(data[0]);
+      if(!shade) {
+        this->sendResponse(c, op, seq, telnet_status_t::notFound);
+        return;
+      }
+      if(op == telnet_ops_t::command && !isFrameCommand(data[1])) {
+        this->sendResponse(c, op, seq, telnet_status_t::badCommand);
+        return;
+      }
+      if(op == telnet_ops_t::move) shade->moveToTarget(shade->transformPosition(min(data[1], (uint8_t)100)));
+      else if(op == telnet_ops_t::command) shade->sendCommand(static_cast<somfy_commands>(data[1]), data[2] > 0 ? data[2] : shade->repeats, data[3]);
+      {
+        uint8_t state[TELNET_BIN_STATE];
+        this->encodeShadeState(state, shade);
+        this->sendResponse(c, op, seq, telnet_status_t::ok, state, sizeof(state));
+      }
+      return;
+    case telnet_ops_t::subscribe:
+      if(len < 4) break;
+      c.watch = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+      this->sendResponse(c, op, seq, telnet_status_t::ok);
+      return;
+    default:
+      this->sendResponse(c, op, seq, telnet_status_t::badOpcode);
+      return;
+  }
+  this->sendResponse(c, op, seq, telnet_status_t::badLength);
+}
+void TelnetServer::printShadeJson(TelnetClient &c, SomfyShade *shade, const char *evt) {
+  if(!c.client || !c.client.connected() || !shade) return;
+  char buf[256];
+  size_t len = this->formatShadeJson(buf, sizeof(buf), shade, evt);
+  c.out.push(buf, len);
 }
 void TelnetServer::printAllShades(TelnetClient &c) {
   if(!c.client || !c.client.connected()) return;
@@ -56,193 +325,294 @@ void TelnetServer::printAllShades(TelnetClient &c) {
       count++;
     }
   }
-  if(count == 0) c.client.println("{\"event\":\"info\",\"msg\":\"No shades configured\"}");
+  if(count == 0) c.out.println("{\"event\":\"info\",\"msg\":\"No shades configured\"}");
 }
-void TelnetServer::printHelp(TelnetClient &c) {
-  if(!c.client || !c.client.connected()) return;
-  this->sendJson(c, "{\"event\":\"help\",\"commands\":[\"list\",\"shade <id>\",\"target <id> <0-100>\",\"cmd <id> <cmd> [repeat] [step]\",\"dinplug ...\",\"exit\"]}");
+void telnet_args_t::shift() {
+  if(this->argc == 0) return;
+  memmove(this->argv, &this->argv[1], (this->argc - 1) * sizeof(char *));
+  this->argc--;
 }
-void TelnetServer::handleLine(TelnetClient &tc, char *line) {
-  if(!line || !tc.client || !tc.client.connected()) return;
-  while(*line && isspace(static_cast<unsigned char>(*line))) line++;
-  if(*line == '\0') return;
-  char *cmd = strtok(line, " ");
-  if(!cmd) return;
-  for(char *p = cmd; *p; ++p) *p = tolower(*p);
-  if(strcmp(cmd, "help") == 0 || strcmp(cmd, "?") == 0) {
-    this->printHelp(tc);
-    return;
+#define TELNET_CMD(name, schema, usage, handler) { name, nullptr, schema, usage, &TelnetServer::handler, nullptr, 0 }
+#define TELNET_ALIAS(name, aliasOf) { name, aliasOf, nullptr, nullptr, nullptr, nullptr, 0 }
+#define TELNET_SUB(name, handler, table) { name, nullptr, "", "", &TelnetServer::handler, table, sizeof(table) / sizeof(table[0]) }
+// Each table must stay sorted by name for the binary search.
+const TelnetServer::telnet_cmd_t TelnetServer::mapCommands[] = {
+  TELNET_CMD("add", "nnssis[n", "<keypadId> <buttonId> <press|release|hold|double> <shade|group> <targetId> <command|target|cycle> [value]", cmdMapAdd),
+  TELNET_CMD("clear", "", "", cmdMapClear),
+  TELNET_CMD("del", "n", "<index>", cmdMapDel),
+  TELNET_CMD("list", "[nn", "[offset] [count]", cmdMapList)
+};
+const TelnetServer::telnet_cmd_t TelnetServer::dinplugCommands[] = {
+  TELNET_CMD("auto", "s", "<on|off>", cmdDinplugAuto),
+  TELNET_CMD("connect", "", "", cmdDinplugConnect),
+  TELNET_CMD("disconnect", "", "", cmdDinplugDisconnect),
+  TELNET_CMD("help", "", "", cmdDinplugHelp),
+  TELNET_CMD("host", "s", "<host>", cmdDinplugHost),
+  TELNET_SUB("map", cmdMapList, TelnetServer::mapCommands),
+  TELNET_CMD("status", "", "", cmdDinplugStatus)
+};
+const TelnetServer::telnet_cmd_t TelnetServer::commands[] = {
+  TELNET_ALIAS("?", "help"),
+  TELNET_CMD("binary", "", "", cmdBinary),
+  TELNET_ALIAS("bye", "exit"),
+  TELNET_CMD("cmd", "ls[nn", "<id>[,<id>...] <command> [repeat] [stepSize]", cmdSend),
+  TELNET_ALIAS("control", "cmd"),
+  TELNET_SUB("dinplug", cmdDinplugHelp, TelnetServer::dinplugCommands),
+  TELNET_CMD("exit", "", "", cmdExit),
+  TELNET_ALIAS("get", "shade"),
+  TELNET_ALIAS("goto", "target"),
+  TELNET_CMD("help", "", "", cmdHelp),
+  TELNET_CMD("list", "", "", cmdList),
+  TELNET_CMD("prof", "[s", "[reset]", cmdProf),
+  TELNET_ALIAS("quit", "exit"),
+  TELNET_ALIAS("send", "cmd"),
+  TELNET_ALIAS("set", "target"),
+  TELNET_CMD("shade", "l", "<id>[,<id>...]", cmdShade),
+  TELNET_ALIAS("show", "shade"),
+  TELNET_ALIAS("status", "list"),
+  TELNET_CMD("target", "ln", "<id>[,<id>...] <0-100>", cmdTarget),
+  TELNET_CMD("unwatch", "l", "<id>[,<id>...]", cmdWatch),
+  TELNET_CMD("watch", "[l", "[all|none|<id>[,<id>...]]", cmdWatch)
+};
+const TelnetServer::telnet_cmd_t *TelnetServer::findCommand(const telnet_cmd_t *table, uint8_t count, const char *name) {
+  int lo = 0;
+  int hi = count - 1;
+  while(lo <= hi) {
+    int mid = (lo + hi) / 2;
+    int cmp = strcmp(name, table[mid].name);
+    if(cmp == 0) return &table[mid];
+    if(cmp < 0) hi = mid - 1;
+    else lo = mid + 1;
   }
-  else if(strcmp(cmd, "list") == 0 || strcmp(cmd, "status") == 0) {
-    this->printAllShades(tc);
-    return;
-  }
-  else if(strcmp(cmd, "shade") == 0 || strcmp(cmd, "get") == 0 || strcmp(cmd, "show") == 0) {
-    char *idTok = strtok(nullptr, " ");
-    uint8_t shadeId = 255;
-    if(!idTok || !this->parseId(idTok, &shadeId)) {
-      this->sendJson(tc, "{\"event\":\"error\",\"msg\":\"Usage: shade <shadeId>\"}");
-      return;
+  return nullptr;
+}
+// Checks the arguments against the schema and converts them in the same pass.
+bool TelnetServer::parseArgs(const char *schema, telnet_args_t &args) {
+  bool optional = false;
+  uint8_t i = 0;
+  for(const char *p = schema; *p; p++) {
+    if(*p == '[') {
+      optional = true;
+      continue;
     }
-    SomfyShade *shade = somfy.getShadeById(shadeId);
-    if(!shade) {
-      this->sendJson(tc, "{\"event\":\"error\",\"msg\":\"Shade not found\"}");
-      return;
+    if(i >= args.argc) return optional;
+    char *tok = args.argv[i];
+    char *end = nullptr;
+    uint8_t id = 0;
+    switch(*p) {
+      case 'i':
+        if(!this->parseId(tok, &id)) return false;
+        args.num[i] = id;
+        break;
+      case 'n':
+        args.num[i] = strtol(tok, &end, 10);
+        if(end == tok || *end) return false;
+        break;
+      case 'l':
+        if(!this->parseWatch(tok, &args.ids)) return false;
+        break;
     }
-    this->printShadeJson(tc, shade);
-    return;
+    i++;
   }
-  else if(strcmp(cmd, "target") == 0 || strcmp(cmd, "set") == 0 || strcmp(cmd, "goto") == 0) {
-    char *idTok = strtok(nullptr, " ");
-    char *targetTok = strtok(nullptr, " ");
-    uint8_t shadeId = 255;
-    if(!idTok || !targetTok || !this->parseId(idTok, &shadeId)) {
-      this->sendJson(tc, "{\"event\":\"error\",\"msg\":\"Usage: target <shadeId> <0-100>\"}");
-      return;
+  return i == args.argc;
+}
+bool TelnetServer::dispatch(TelnetClient &c, const telnet_cmd_t *table, uint8_t count, telnet_args_t &args) {
+  if(args.argc == 0) return false;
+  for(char *p = args.argv[0]; *p; ++p) *p = tolower(*p);
+  const telnet_cmd_t *cmd = this->findCommand(table, count, args.argv[0]);
+  if(cmd && cmd->aliasOf) cmd = this->findCommand(table, count, cmd->aliasOf);
+  if(!cmd) return false;
+  args.shift();
+  if(cmd->sub && args.argc > 0) {
+    if(!this->dispatch(c, cmd->sub, cmd->subCount, args)) {
+      this->sendJsonf(c, "{\"event\":\"error\",\"msg\":\"Unknown %s command\"}", cmd->name);
     }
-    int target = atoi(targetTok);
-    target = constrain(target, 0, 100);
-    SomfyShade *shade = somfy.getShadeById(shadeId);
-    if(!shade) {
-      this->sendJson(tc, "{\"event\":\"error\",\"msg\":\"Shade not found\"}");
-      return;
+    return true;
+  }
+  if(!this->parseArgs(cmd->schema, args)) {
+    this->sendUsage(c, table == commands ? "" : table == dinplugCommands ? "dinplug " : "dinplug map ", cmd);
+    return true;
+  }
+  args.name = cmd->name;
+  (this->*(cmd->handler))(c, args);
+  return true;
+}
+void TelnetServer::sendUsage(TelnetClient &c, const char *prefix, const telnet_cmd_t *cmd) {
+  this->sendJsonf(c, "{\"event\":\"error\",\"msg\":\"Usage: %s%s%s%s\"}", prefix, cmd->name, cmd->usage[0] ? " " : "", cmd->usage);
+}
+void TelnetServer::sendMessage(TelnetClient &c, String &msg) {
+  c.out.print(msg);
+  c.out.print("\r\n");
+}
+// The help is built from the tables so a new command shows up without touching it.
+void TelnetServer::printCommands(TelnetClient &c, const telnet_cmd_t *table, uint8_t count, const char *prefix, bool expand, bool &first) {
+  for(uint8_t i = 0; i < count; i++) {
+    const telnet_cmd_t *cmd = &table[i];
+    if(cmd->aliasOf) continue;
+    if(cmd->sub && expand) {
+      char subPrefix[32];
+      snprintf(subPrefix, sizeof(subPrefix), "%s%s ", prefix, cmd->name);
+      this->printCommands(c, cmd->sub, cmd->subCount, subPrefix, expand, first);
+      continue;
     }
+    c.out.printf(first ? "\"%s%s%s%s\"" : ",\"%s%s%s%s\"", prefix, cmd->name, cmd->sub ? " ..." : cmd->usage[0] ? " " : "", cmd->sub ? "" : cmd->usage);
+    first = false;
+  }
+}
+void TelnetServer::cmdHelp(TelnetClient &c, telnet_args_t &args) {
+  bool first = true;
+  c.out.print("{\"event\":\"help\",\"commands\":[");
+  this->printCommands(c, commands, sizeof(commands) / sizeof(commands[0]), "", false, first);
+  c.out.print("]}\r\n");
+}
+void TelnetServer::cmdDinplugHelp(TelnetClient &c, telnet_args_t &args) {
+  bool first = true;
+  c.out.print("{\"event\":\"dinplug_help\",\"commands\":[");
+  this->printCommands(c, dinplugCommands, sizeof(dinplugCommands) / sizeof(dinplugCommands[0]), "dinplug ", true, first);
+  c.out.print("]}\r\n");
+}
+void TelnetServer::cmdList(TelnetClient &c, telnet_args_t &args) { this->printAllShades(c); }
+void TelnetServer::cmdShade(TelnetClient &c, telnet_args_t &args) {
+  uint8_t count = 0;
+  for(uint8_t id = 1; id <= 32; id++) {
+    if(!(args.ids & (1UL << (id - 1)))) continue;
+    SomfyShade *shade = somfy.getShadeById(id);
+    if(!shade) continue;
+    this->printShadeJson(c, shade);
+    count++;
+  }
+  if(count == 0) this->sendJson(c, "{\"event\":\"error\",\"msg\":\"Shade not found\"}");
+}
+// Every shade in the list is moved from the one line so a scene is a single command.
+void TelnetServer::cmdTarget(TelnetClient &c, telnet_args_t &args) {
+  const int target = constrain(args.num[1], 0, 100);
+  uint8_t count = 0;
+  for(uint8_t id = 1; id <= 32; id++) {
+    if(!(args.ids & (1UL << (id - 1)))) continue;
+    SomfyShade *shade = somfy.getShadeById(id);
+    if(!shade) continue;
     shade->moveToTarget(shade->transformPosition(target));
-    this->sendJsonf(tc, "{\"event\":\"command\",\"id\":%u,\"target\":%d}", shadeId, target);
-    this->printShadeJson(tc, shade, "update");
-    return;
+    this->sendJsonf(c, "{\"event\":\"command\",\"id\":%u,\"target\":%d}", id, target);
+    this->printShadeJson(c, shade, "update");
+    count++;
   }
-  else if(strcmp(cmd, "cmd") == 0 || strcmp(cmd, "send") == 0 || strcmp(cmd, "control") == 0) {
-    char *idTok = strtok(nullptr, " ");
-    char *commandTok = strtok(nullptr, " ");
-    char *repeatTok = strtok(nullptr, " ");
-    char *stepTok = strtok(nullptr, " ");
-    uint8_t shadeId = 255;
-    if(!idTok || !commandTok || !this->parseId(idTok, &shadeId)) {
-      tc.client.println("{\"event\":\"error\",\"msg\":\"Usage: cmd <shadeId> <command> [repeat] [stepSize]\"}");
-      return;
-    }
-    SomfyShade *shade = somfy.getShadeById(shadeId);
-    if(!shade) {
-      tc.client.println("{\"event\":\"error\",\"msg\":\"Shade not found\"}");
-      return;
-    }
-    somfy_commands cmdVal = translateSomfyCommand(String(commandTok));
-    uint8_t repeat = repeatTok ? static_cast<uint8_t>(atoi(repeatTok)) : shade->repeats;
-    uint8_t stepSize = stepTok ? static_cast<uint8_t>(atoi(stepTok)) : 0;
-    shade->sendCommand(cmdVal, repeat > 0 ? repeat : shade->repeats, stepSize);
-    this->sendJsonf(tc, "{\"event\":\"command\",\"id\":%u,\"cmd\":\"%s\",\"repeat\":%u,\"step\":%u}",
-      shadeId, commandTok, repeat > 0 ? repeat : shade->repeats, stepSize);
-    this->printShadeJson(tc, shade, "update");
-    return;
+  if(count == 0) this->sendJson(c, "{\"event\":\"error\",\"msg\":\"Shade not found\"}");
+}
+void TelnetServer::cmdSend(TelnetClient &c, telnet_args_t &args) {
+  somfy_commands cmdVal = translateSomfyCommand(String(args.argv[1]));
+  uint8_t count = 0;
+  for(uint8_t id = 1; id <= 32; id++) {
+    if(!(args.ids & (1UL << (id - 1)))) continue;
+    SomfyShade *shade = somfy.getShadeById(id);
+    if(!shade) continue;
+    uint8_t repeat = args.argc > 2 ? static_cast<uint8_t>(args.num[2]) : shade->repeats;
+    if(repeat == 0) repeat = shade->repeats;
+    uint8_t stepSize = args.argc > 3 ? static_cast<uint8_t>(args.num[3]) : 0;
+    shade->sendCommand(cmdVal, repeat, stepSize);
+    this->sendJsonf(c, "{\"event\":\"command\",\"id\":%u,\"cmd\":\"%s\",\"repeat\":%u,\"step\":%u}", id, args.argv[1], repeat, stepSize);
+    this->printShadeJson(c, shade, "update");
+    count++;
   }
-  else if(strcmp(cmd, "dinplug") == 0) {
-    char *sub = strtok(nullptr, " ");
-    if(!sub || strcmp(sub, "help") == 0) {
-      dinplugBridge.printHelp(tc.client);
-      return;
-    }
-    for(char *p = sub; *p; ++p) *p = tolower(*p);
-    if(strcmp(sub, "status") == 0) {
-      dinplugBridge.printStatus(tc.client);
-      return;
-    }
-    if(strcmp(sub, "connect") == 0) {
-      String msg;
-      dinplugBridge.connectNow(msg);
-      tc.client.print(msg);
-      tc.client.print("\r\n");
-      return;
-    }
-    if(strcmp(sub, "disconnect") == 0) {
-      String msg;
-      dinplugBridge.disconnect(msg);
-      tc.client.print(msg);
-      tc.client.print("\r\n");
-      return;
-    }
-    if(strcmp(sub, "host") == 0) {
-      String msg;
-      char *host = strtok(nullptr, "");
-      dinplugBridge.setGatewayHost(host, msg);
-      tc.client.print(msg);
-      tc.client.print("\r\n");
-      return;
-    }
-    if(strcmp(sub, "auto") == 0) {
-      char *mode = strtok(nullptr, " ");
-      String msg;
-      if(!mode) {
-        this->sendJson(tc, "{\"event\":\"error\",\"msg\":\"Usage: dinplug auto <on|off>\"}");
-        return;
-      }
-      const bool enabled = strcasecmp(mode, "on") == 0 || strcasecmp(mode, "true") == 0 || strcmp(mode, "1") == 0;
-      dinplugBridge.setAutoConnect(enabled, msg);
-      tc.client.print(msg);
-      tc.client.print("\r\n");
-      return;
-    }
-    if(strcmp(sub, "map") == 0) {
-      char *verb = strtok(nullptr, " ");
-      if(!verb || strcmp(verb, "list") == 0) {
-        dinplugBridge.printMappings(tc.client);
-        return;
-      }
-      for(char *p = verb; *p; ++p) *p = tolower(*p);
-      if(strcmp(verb, "clear") == 0) {
-        String msg;
-        dinplugBridge.clearMappings(msg);
-        tc.client.print(msg);
-        tc.client.print("\r\n");
-        return;
-      }
-      if(strcmp(verb, "del") == 0) {
-        char *idxTok = strtok(nullptr, " ");
-        if(!idxTok) {
-          this->sendJson(tc, "{\"event\":\"error\",\"msg\":\"Usage: dinplug map del <index>\"}");
-          return;
-        }
-        String msg;
-        dinplugBridge.removeMapping(static_cast<uint8_t>(atoi(idxTok)), msg);
-        tc.client.print(msg);
-        tc.client.print("\r\n");
-        return;
-      }
-      if(strcmp(verb, "add") == 0) {
-        char *keypadTok = strtok(nullptr, " ");
-        char *buttonTok = strtok(nullptr, " ");
-        char *actionTok = strtok(nullptr, " ");
-        char *targetTypeTok = strtok(nullptr, " ");
-        char *targetIdTok = strtok(nullptr, " ");
-        char *commandTok = strtok(nullptr, " ");
-        char *valueTok = strtok(nullptr, " ");
-        if(!keypadTok || !buttonTok || !actionTok || !targetTypeTok || !targetIdTok || !commandTok) {
-          this->sendJson(tc, "{\"event\":\"error\",\"msg\":\"Usage: dinplug map add <keypadId> <buttonId> <press|release|hold|double> <shade|group> <targetId> <command|target|cycle> [value]\"}");
-          return;
-        }
-        String msg;
-        dinplugBridge.addMapping(static_cast<uint16_t>(atoi(keypadTok)),
-                                 static_cast<uint16_t>(atoi(buttonTok)),
-                                 actionTok, targetTypeTok,
-                                 static_cast<uint8_t>(atoi(targetIdTok)),
-                                 commandTok,
-                                 valueTok ? atoi(valueTok) : 0,
-                                 msg);
-        tc.client.print(msg);
-        tc.client.print("\r\n");
-        return;
-      }
-    }
-    this->sendJson(tc, "{\"event\":\"error\",\"msg\":\"Unknown dinplug command\"}");
+  if(count == 0) this->sendJson(c, "{\"event\":\"error\",\"msg\":\"Shade not found\"}");
+}
+// A bare watch only reports the filter.  A list given to watch replaces the filter
+// and unwatch removes the listed shades from it.
+void TelnetServer::cmdWatch(TelnetClient &c, telnet_args_t &args) {
+  if(args.argc > 0) {
+    if(strcmp(args.name, "watch") == 0) c.watch = args.ids;
+    else c.watch &= ~args.ids;
+  }
+  this->printWatch(c);
+}
+void TelnetServer::cmdBinary(TelnetClient &c, telnet_args_t &args) {
+  this->sendJsonf(c, "{\"event\":\"binary\",\"version\":%u}", TELNET_BIN_VERSION);
+  c.binary = true;
+}
+void TelnetServer::cmdProf(TelnetClient &c, telnet_args_t &args) {
+  if(args.argc > 0 && strcmp(args.argv[0], "reset") == 0) {
+    profiler.reset();
+    this->sendJson(c, "{\"event\":\"prof\",\"msg\":\"Profile reset\"}");
     return;
   }
-  else if(strcmp(cmd, "exit") == 0 || strcmp(cmd, "quit") == 0 || strcmp(cmd, "bye") == 0) {
-    this->sendJson(tc, "{\"event\":\"bye\"}");
-    tc.client.stop();
-    this->resetInput(tc);
+  for(uint8_t i = 0; i < PROF_MAX_STAGES; i++) {
+    prof_stats_t stats;
+    profiler.getStats(static_cast<prof_stages_t>(i), stats);
+    this->sendJsonf(c, "{\"event\":\"prof\",\"stage\":\"%s\",\"count\":%lu,\"min\":%lu,\"avg\":%lu,\"p99\":%lu,\"max\":%lu,\"maxTime\":%lu}",
+      LoopProfiler::stageName(static_cast<prof_stages_t>(i)), (unsigned long)stats.count, (unsigned long)stats.minUs,
+      (unsigned long)stats.avgUs, (unsigned long)stats.p99Us, (unsigned long)stats.maxUs, (unsigned long)stats.maxTime);
+  }
+}
+void TelnetServer::cmdExit(TelnetClient &c, telnet_args_t &args) {
+  this->sendJson(c, "{\"event\":\"bye\"}");
+  this->disconnect(c);
+}
+void TelnetServer::cmdDinplugStatus(TelnetClient &c, telnet_args_t &args) { dinplugBridge.printStatus(c.out); }
+void TelnetServer::cmdDinplugConnect(TelnetClient &c, telnet_args_t &args) {
+  String msg;
+  dinplugBridge.connectNow(msg);
+  this->sendMessage(c, msg);
+}
+void TelnetServer::cmdDinplugDisconnect(TelnetClient &c, telnet_args_t &args) {
+  String msg;
+  dinplugBridge.disconnect(msg);
+  this->sendMessage(c, msg);
+}
+void TelnetServer::cmdDinplugHost(TelnetClient &c, telnet_args_t &args) {
+  String msg;
+  dinplugBridge.setGatewayHost(args.argv[0], msg);
+  this->sendMessage(c, msg);
+}
+void TelnetServer::cmdDinplugAuto(TelnetClient &c, telnet_args_t &args) {
+  const char *mode = args.argv[0];
+  const bool enabled = strcasecmp(mode, "on") == 0 || strcasecmp(mode, "true") == 0 || strcmp(mode, "1") == 0;
+  String msg;
+  dinplugBridge.setAutoConnect(enabled, msg);
+  this->sendMessage(c, msg);
+}
+// The whole table does not fit the output queue so it is listed a page at a time.
+void TelnetServer::cmdMapList(TelnetClient &c, telnet_args_t &args) {
+  long offset = args.argc > 0 ? args.num[0] : 0;
+  long count = args.argc > 1 ? args.num[1] : TELNET_MAP_PAGE;
+  if(offset < 0 || count < 1) {
+    this->sendJson(c, "{\"event\":\"error\",\"msg\":\"Invalid offset or count\"}");
     return;
   }
-  this->sendJson(tc, "{\"event\":\"error\",\"msg\":\"Unknown command\"}");
+  if(count > TELNET_MAP_PAGE) count = TELNET_MAP_PAGE;
+  dinplugBridge.printMappings(c.out, static_cast<uint16_t>(offset > 0xFFFF ? 0xFFFF : offset), static_cast<uint16_t>(count));
+}
+void TelnetServer::cmdMapClear(TelnetClient &c, telnet_args_t &args) {
+  String msg;
+  dinplugBridge.clearMappings(msg);
+  this->sendMessage(c, msg);
+}
+void TelnetServer::cmdMapDel(TelnetClient &c, telnet_args_t &args) {
+  String msg;
+  dinplugBridge.removeMapping(static_cast<uint16_t>(args.num[0]), msg);
+  this->sendMessage(c, msg);
+}
+void TelnetServer::cmdMapAdd(TelnetClient &c, telnet_args_t &args) {
+  String msg;
+  dinplugBridge.addMapping(static_cast<uint16_t>(args.num[0]), static_cast<uint16_t>(args.num[1]),
+                           args.argv[2], args.argv[3], static_cast<uint8_t>(args.num[4]), args.argv[5],
+                           args.argc > 6 ? args.num[6] : 0, msg);
+  this->sendMessage(c, msg);
+}
+// The line is split in place in a single pass and then looked up in the command table.
+void TelnetServer::handleLine(TelnetClient &tc, char *line) {
+  if(!line || !tc.client || !tc.client.connected()) return;
+  telnet_args_t args;
+  char *p = line;
+  while(*p && args.argc < TELNET_MAX_ARGS) {
+    while(*p && isspace(static_cast<unsigned char>(*p))) *p++ = '\0';
+    if(!*p) break;
+    args.argv[args.argc++] = p;
+    while(*p && !isspace(static_cast<unsigned char>(*p))) p++;
+    if(*p) *p++ = '\0';
+  }
+  if(args.argc == 0) return;
+  if(!this->dispatch(tc, commands, sizeof(commands) / sizeof(commands[0]), args)) {
+    this->sendJson(tc, "{\"event\":\"error\",\"msg\":\"Unknown command\"}");
+  }
 }
 void TelnetServer::loop() {
   esp_task_wdt_reset();
@@ -253,8 +623,11 @@ void TelnetServer::loop() {
       if(!c.client || !c.client.connected()) {
         c.client = incoming;
         c.client.setNoDelay(true);
+        c.out.begin(c.client.fd());
         this->resetInput(c);
         c.lastActivity = millis();
+        c.watch = TELNET_WATCH_ALL;
+        c.binary = false;
         this->sendJson(c, "{\"event\":\"welcome\",\"msg\":\"ESPSomfy RTS telnet\"}");
         this->printAllShades(c);
         break;
@@ -266,6 +639,11 @@ void TelnetServer::loop() {
     if(!c.client || !c.client.connected()) continue;
     while(c.client.connected() && c.client.available()) {
       char ch = c.client.read();
+      c.lastActivity = millis();
+      if(c.binary) {
+        this->readBinary(c, ch);
+        continue;
+      }
       if(ch == '\r') continue;
       if(ch == '\n') {
         c.inputBuffer[c.inputLength] = '\0';
@@ -278,22 +656,24 @@ void TelnetServer::loop() {
       else if(c.inputLength < sizeof(c.inputBuffer) - 1 && isprint(static_cast<unsigned char>(ch))) {
         c.inputBuffer[c.inputLength++] = ch;
       }
-      c.lastActivity = millis();
+    }
+    c.out.drain();
+    if(c.out.failed) {
+      this->disconnect(c);
+      continue;
     }
     if(c.client.connected() && millis() - c.lastActivity > 600000UL) {
-      c.client.println("{\"event\":\"bye\",\"reason\":\"timeout\"}");
-      c.client.stop();
-      this->resetInput(c);
+      if(!c.binary) this->sendJson(c, "{\"event\":\"bye\",\"reason\":\"timeout\"}");
+      this->disconnect(c);
     }
   }
-  this->emitLiveUpdates();
 }
 
 void TelnetServer::sendJson(TelnetClient &c, const char *json) {
   if(!c.client || !c.client.connected() || !json) return;
   char buf[256];
   int n = snprintf(buf, sizeof(buf), "%s\r\n", json);
-  if(n > 0) c.client.write((const uint8_t *)buf, (size_t)n);
+  if(n > 0) c.out.push(buf, (size_t)n);
 }
 void TelnetServer::sendJsonf(TelnetClient &c, const char *fmt, ...) {
   if(!c.client || !c.client.connected() || !fmt) return;
@@ -305,81 +685,46 @@ void TelnetServer::sendJsonf(TelnetClient &c, const char *fmt, ...) {
   if(n <= 0) return;
   char buf[256];
   n = snprintf(buf, sizeof(buf), "%s\r\n", payload);
-  if(n > 0) c.client.write((const uint8_t *)buf, (size_t)n);
+  if(n > 0) c.out.push(buf, (size_t)n);
 }
 
-void TelnetServer::snapshotShade(ShadeSnapshot &snap, SomfyShade *shade) {
-  snap.present = shade != nullptr;
-  if(!shade) return;
-  snap.shadeId = shade->getShadeId();
-  snap.remoteAddress = shade->getRemoteAddress();
-  snap.position = shade->transformPosition(shade->currentPos);
-  snap.target = shade->transformPosition(shade->target);
-  snap.direction = shade->direction;
-  snap.flags = shade->flags;
-  strlcpy(snap.name, shade->name, sizeof(snap.name));
-  snap.tiltType = shade->tiltType;
-  if(shade->tiltType != tilt_types::none) {
-    snap.tiltPosition = shade->transformPosition(shade->currentTiltPos);
-    snap.tiltTarget = shade->transformPosition(shade->tiltTarget);
-    snap.tiltDirection = shade->tiltDirection;
-  }
-  else {
-    snap.tiltPosition = snap.tiltTarget = -1;
-    snap.tiltDirection = 0;
-  }
-}
-bool TelnetServer::hasShadeChanged(ShadeSnapshot &snap, SomfyShade *shade) {
-  if(!shade) return snap.present;
-  const int8_t pos = shade->transformPosition(shade->currentPos);
-  const int8_t tgt = shade->transformPosition(shade->target);
-  const tilt_types ttype = shade->tiltType;
-  const int8_t tiltPos = ttype != tilt_types::none ? shade->transformPosition(shade->currentTiltPos) : -1;
-  const int8_t tiltTgt = ttype != tilt_types::none ? shade->transformPosition(shade->tiltTarget) : -1;
-  if(!snap.present ||
-     snap.shadeId != shade->getShadeId() ||
-     snap.remoteAddress != shade->getRemoteAddress() ||
-     snap.position != pos ||
-     snap.target != tgt ||
-     snap.direction != shade->direction ||
-     snap.flags != shade->flags ||
-     snap.tiltType != ttype ||
-     snap.tiltDirection != shade->tiltDirection ||
-     snap.tiltPosition != tiltPos ||
-     snap.tiltTarget != tiltTgt ||
-     strncmp(snap.name, shade->name, sizeof(snap.name)) != 0) {
-       return true;
-  }
-  return false;
-}
-void TelnetServer::emitLiveUpdates() {
+// Live updates come from the state bus so nothing is polled while the shades are idle
+// and the line is formatted once for every client watching the shade.
+void TelnetServer::onStateChange(state_change_t &change) {
+  if(change.kind != state_kinds_t::shade || change.id < 1 || change.id > 32) return;
+  const uint32_t bit = 1UL << (change.id - 1);
   bool anyClient = false;
-  for(auto &c : this->clients) if(c.client && c.client.connected()) { anyClient = true; break; }
+  for(auto &c : this->clients) if((c.watch & bit) && c.client && c.client.connected()) { anyClient = true; break; }
   if(!anyClient) return;
-  // Throttle to ~10 updates/sec to avoid flooding idle loops.
-  if(millis() - this->lastEmit < 100) return;
-  this->lastEmit = millis();
-  bool seen[SOMFY_MAX_SHADES] = {false};
-  // Check for additions/changes
-  for(uint8_t i = 0; i < SOMFY_MAX_SHADES; i++) {
-    SomfyShade *shade = &somfy.shades[i];
-    if(!shade || shade->getShadeId() == 255) continue;
-    uint8_t sid = shade->getShadeId();
-    if(sid >= SOMFY_MAX_SHADES) continue;
-    seen[sid] = true;
-    ShadeSnapshot &snap = this->snapshots[sid];
-    if(this->hasShadeChanged(snap, shade)) {
-      for(auto &c : this->clients) if(c.client && c.client.connected()) this->printShadeJson(c, shade, "update");
-      this->snapshotShade(snap, shade);
+  const bool removed = strcmp(change.evt, "shadeRemoved") == 0;
+  char buf[256];
+  uint8_t frame[TELNET_BIN_HEADER + TELNET_BIN_STATE];
+  size_t len = 0;
+  size_t frameLen = 0;
+  for(auto &c : this->clients) {
+    if(!(c.watch & bit) || !c.client || !c.client.connected()) continue;
+    if(c.binary) {
+      if(frameLen == 0) frameLen = this->formatShadeFrame(frame, change.shade, removed);
+      c.out.push(reinterpret_cast<const char *>(frame), frameLen, true);
     }
-  }
-  // Check for removals
-  for(uint8_t id = 0; id < SOMFY_MAX_SHADES; id++) {
-    ShadeSnapshot &snap = this->snapshots[id];
-    if(snap.present && !seen[id]) {
-      for(auto &c : this->clients) if(c.client && c.client.connected())
-        c.client.printf("{\"event\":\"removed\",\"id\":%u,\"name\":\"%s\"}\r\n", snap.shadeId, snap.name);
-      snap.present = false;
+    else {
+      if(len == 0) len = this->formatShadeJson(buf, sizeof(buf), change.shade, removed ? "removed" : "update");
+      c.out.push(buf, len, true);
     }
   }
 }
+void TelnetServer::writeMetrics(Print &out) {
+  uint32_t queued = 0, highWater = 0, sent = 0, updates = 0, replies = 0;
+  for(auto &c : this->clients) {
+    queued += c.out.queued();
+    highWater = max(highWater, (uint32_t)c.out.highWater);
+    sent += c.out.bytesSent;
+    updates += c.out.updatesDropped;
+    replies += c.out.repliesDropped;
+  }
+  Metrics::writeGauge(out, "espsomfy_telnet_queued_bytes", "Bytes waiting to be sent to telnet clients.", queued);
+  Metrics::writeGauge(out, "espsomfy_telnet_queued_bytes_max", "Most bytes ever queued for a single telnet client.", highWater);
+  Metrics::writeCounter(out, "espsomfy_telnet_sent_bytes_total", "Bytes written to telnet clients.", sent);
+  Metrics::writeCounter(out, "espsomfy_telnet_updates_dropped_total", "Live updates dropped for slow telnet clients.", updates);
+  Metrics::writeCounter(out, "espsomfy_telnet_replies_dropped_total", "Command replies dropped for slow telnet clients.", replies);
+}
@@ -3,48 +3,162 @@
 
 #include <WiFi.h>
 #include "Somfy.h"
+#include "StateBus.h"
 
-#define TELNET_MAX_CLIENTS 3
+#define TELNET_MAX_CLIENTS 2
+#define TELNET_WATCH_ALL 0xFFFFFFFF
+#define TELNET_TX_BYTES 3072 // Bytes queued for a single client.
+#define TELNET_TX_DEPTH 48   // Lines queued for a single client.
+#define TELNET_LINE_SIZE 256
+#define TELNET_MAP_PAGE 12   // Dinplug mappings listed per command.  A mapping line is under 192 bytes.
+#define TELNET_MAX_ARGS 10
+#define TELNET_BIN_VERSION 1
+#define TELNET_BIN_HEADER 5  // Length (2), opcode (1) and sequence (2).
+#define TELNET_BIN_STATE 8   // Bytes in an encoded shade state.
 
+// Opcodes for the binary protocol a client switches to with the "binary" command.  Every
+// frame is a little endian length of the bytes that follow, the opcode, a sequence
+// number and the payload.  A response carries the opcode of its request with the high
+// bit set, the same sequence number and a status byte ahead of its payload.
+enum class telnet_ops_t : uint8_t {
+  move = 0x01,      // shadeId, target 0-100
+  command = 0x02,   // shadeId, somfy command, repeat, step size
+  query = 0x03,     // shadeId -> state
+  subscribe = 0x04, // uint32 watch mask
+  state = 0x40,     // Unsolicited shade state with sequence 0
+  removed = 0x41,   // Unsolicited shadeId with sequence 0
+  response = 0x80
+};
+enum class telnet_status_t : uint8_t {
+  ok = 0,
+  badOpcode = 1,
+  badLength = 2,
+  notFound = 3,
+  badCommand = 4
+};
+
+struct telnet_line_t {
+  uint16_t len = 0;
+  bool update = false;
+};
+// Output for a single telnet client.  Lines are queued whole and written to the socket
+// without blocking as the TCP window opens, so a client that stops reading only fills
+// its own queue rather than stalling the loop.  Live updates are dropped oldest first
+// to make room and a reply to a command is only dropped when nothing else is queued.
+class TelnetOutput : public Print {
+  protected:
+    telnet_line_t lines[TELNET_TX_DEPTH];
+    char buff[TELNET_TX_BYTES];
+    char line[TELNET_LINE_SIZE];
+    uint16_t lineLen = 0;
+    uint16_t used = 0;
+    uint16_t sent = 0;
+    uint8_t count = 0;
+    int fd = -1;
+    int sendNow(const char *data, size_t len);
+    void removeLine(uint8_t index);
+    bool dropUpdate();
+  public:
+    bool failed = false;
+    uint16_t highWater = 0;
+    uint32_t bytesSent = 0;
+    uint32_t updatesDropped = 0;
+    uint32_t repliesDropped = 0;
+    void begin(int fd);
+    bool push(const char *data, size_t len, bool update = false);
+    void drain();
+    uint16_t queued() { return this->used - this->sent; }
+    size_t write(uint8_t ch) override;
+    size_t write(const uint8_t *data, size_t len) override;
+};
+// The tokens of a command line.  Numbers and shade id lists are converted while the
+// arguments are checked against the command so a handler reads them directly.
+struct telnet_args_t {
+  char *argv[TELNET_MAX_ARGS];
+  long num[TELNET_MAX_ARGS];
+  uint32_t ids = 0;
+  uint8_t argc = 0;
+  const char *name = nullptr;
+  void shift();
+};
 class TelnetServer {
   public:
     TelnetServer();
     void begin();
     void loop();
+    void onStateChange(state_change_t &change);
+    void writeMetrics(Print &out);
   private:
     WiFiServer server;
     struct TelnetClient {
       WiFiClient client;
+      TelnetOutput out;
       char inputBuffer[128];
       size_t inputLength = 0;
       uint32_t lastActivity = 0;
+      uint32_t watch = TELNET_WATCH_ALL; // Bit n-1 is set when updates for shade n are sent.
+      bool binary = false;
     } clients[TELNET_MAX_CLIENTS];
-    uint32_t lastEmit = 0;
-    struct ShadeSnapshot {
-      bool present = false;
-      uint8_t shadeId = 255;
-      uint32_t remoteAddress = 0;
-      int8_t position = -1;
-      int8_t target = -1;
-      int8_t direction = 0;
-      int8_t tiltPosition = -1;
-      int8_t tiltTarget = -1;
-      int8_t tiltDirection = 0;
-      uint8_t flags = 0;
-      char name[21] = "";
-      tilt_types tiltType = tilt_types::none;
-    } snapshots[SOMFY_MAX_SHADES];
+    typedef void (TelnetServer::*telnet_handler_t)(TelnetClient &c, telnet_args_t &args);
+    // A command in a table sorted by name.  An alias names the command it stands for,
+    // and a command with a sub table dispatches its first argument through that table
+    // and only runs its own handler when no argument is given.  The schema has one
+    // character for each argument: i is a shade id, l a list of shade ids, n a number
+    // and s a word.  Arguments after a [ are optional.
+    struct telnet_cmd_t {
+      const char *name;
+      const char *aliasOf;
+      const char *schema;
+      const char *usage;
+      telnet_handler_t handler;
+      const telnet_cmd_t *sub;
+      uint8_t subCount;
+    };
+    static const telnet_cmd_t commands[];
+    static const telnet_cmd_t dinplugCommands[];
+    static const telnet_cmd_t mapCommands[];
+    const telnet_cmd_t *findCommand(const telnet_cmd_t *table, uint8_t count, const char *name);
+    bool dispatch(TelnetClient &c, const telnet_cmd_t *table, uint8_t count, telnet_args_t &args);
+    bool parseArgs(const char *schema, telnet_args_t &args);
+    void printCommands(TelnetClient &c, const telnet_cmd_t *table, uint8_t count, const char *prefix, bool expand, bool &first);
+    void sendUsage(TelnetClient &c, const char *prefix, const telnet_cmd_t *cmd);
+    void sendMessage(TelnetClient &c, String &msg);
+    void cmdHelp(TelnetClient &c, telnet_args_t &args);
+    void cmdList(TelnetClient &c, telnet_args_t &args);
+    void cmdShade(TelnetClient &c, telnet_args_t &args);
+    void cmdTarget(TelnetClient &c, telnet_args_t &args);
+    void cmdSend(TelnetClient &c, telnet_args_t &args);
+    void cmdWatch(TelnetClient &c, telnet_args_t &args);
+    void cmdBinary(TelnetClient &c, telnet_args_t &args);
+    void cmdProf(TelnetClient &c, telnet_args_t &args);
+    void cmdExit(TelnetClient &c, telnet_args_t &args);
+    void cmdDinplugHelp(TelnetClient &c, telnet_args_t &args);
+    void cmdDinplugStatus(TelnetClient &c, telnet_args_t &args);
+    void cmdDinplugConnect(TelnetClient &c, telnet_args_t &args);
+    void cmdDinplugDisconnect(TelnetClient &c, telnet_args_t &args);
+    void cmdDinplugHost(TelnetClient &c, telnet_args_t &args);
+    void cmdDinplugAuto(TelnetClient &c, telnet_args_t &args);
+    void cmdMapList(TelnetClient &c, telnet_args_t &args);
+    void cmdMapClear(TelnetClient &c, telnet_args_t &args);
+    void cmdMapDel(TelnetClient &c, telnet_args_t &args);
+    void cmdMapAdd(TelnetClient &c, telnet_args_t &args);
     void resetInput(TelnetClient &c);
+    void disconnect(TelnetClient &c);
     void handleLine(TelnetClient &c, char *line);
-    void printHelp(TelnetClient &c);
     void printAllShades(TelnetClient &c);
+    size_t formatShadeJson(char *buf, size_t size, SomfyShade *shade, const char *evt);
     void printShadeJson(TelnetClient &c, SomfyShade *shade, const char *evt = "state");
+    void readBinary(TelnetClient &c, char ch);
+    void handleFrame(TelnetClient &c, telnet_ops_t op, uint16_t seq, const uint8_t *data, uint16_t len);
+    void sendFrame(TelnetClient &c, uint8_t op, uint16_t seq, const uint8_t *data, uint8_t len);
+    void sendResponse(TelnetClient &c, telnet_ops_t op, uint16_t seq, telnet_status_t status, const uint8_t *data = nullptr, uint8_t len = 0);
+    void encodeShadeState(uint8_t *buf, SomfyShade *shade);
+    size_t formatShadeFrame(uint8_t *buf, SomfyShade *shade, bool removed);
     void sendJson(TelnetClient &c, const char *json);
     void sendJsonf(TelnetClient &c, const char *fmt, ...);
     bool parseId(const char *token, uint8_t *outId);
-    void emitLiveUpdates();
-    void snapshotShade(ShadeSnapshot &snap, SomfyShade *shade);
-    bool hasShadeChanged(ShadeSnapshot &snap, SomfyShade *shade);
+    bool parseWatch(const char *token, uint32_t *mask);
+    void printWatch(TelnetClient &c);
 };
 
 #endif
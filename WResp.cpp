@@ -39,9 +39,19 @@ void JsonResponse::beginResponse(WebServer *server, char *buff, size_t buffSize)
   this->buffSize = buffSize;
   this->buff[0] = 0x00;
   this->_nocomma = true;
+  this->_headersSent = false;
   server->setContentLength(CONTENT_LENGTH_UNKNOWN);
 }
 void JsonResponse::endResponse() {
+  if(!this->_headersSent) {
+    // The whole response fit in the buffer so it goes out with its length rather
+    // than chunked.  Keep-alive clients can then read it without a terminator.
+    this->server->setContentLength(strlen(this->buff));
+    this->server->send_P(200, "application/json", this->buff);
+    this->buff[0] = 0x00;
+    this->_headersSent = true;
+    return;
+  }
   if(strlen(buff)) this->send();
   server->sendContent("", 0);
 }
@@ -52,6 +62,122 @@ void JsonResponse::send() {
     this->buff[0] = 0x00;
     this->_headersSent = true;
 }
+void StreamResponse::beginResponse(WebServer *server, const char *contentType, char *buff, size_t buffSize) {
+  this->server = server;
+  this->buff = (uint8_t *)buff;
+  this->buffSize = buffSize;
+  this->_len = 0;
+  this->_headersSent = false;
+  this->_contentType = contentType;
+  this->sent = 0;
+  server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+}
+void StreamResponse::send() {
+  if(!this->_headersSent) {
+    this->server->send(200, this->_contentType, "");
+    this->_headersSent = true;
+  }
+  if(this->_len > 0) this->server->sendContent((const char *)this->buff, this->_len);
+  this->sent += this->_len;
+  this->_len = 0;
+}
+void StreamResponse::endResponse() {
+  this->send();
+  this->server->sendContent("", 0);
+}
+size_t StreamResponse::write(uint8_t ch) {
+  if(this->_len >= this->buffSize) this->send();
+  this->buff[this->_len++] = ch;
+  return 1;
+}
+size_t StreamResponse::write(const uint8_t *buf, size_t size) {
+  size_t written = 0;
+  while(written < size) {
+    if(this->_len >= this->buffSize) this->send();
+    size_t len = min(size - written, this->buffSize - this->_len);
+    memcpy(&this->buff[this->_len], &buf[written], len);
+    this->_len += len;
+    written += len;
+  }
+  return written;
+}
+static const uint16_t _deflateLenBase[] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const uint8_t _deflateLenExtra[] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+void DeflateStream::begin(Print *out) {
+  this->out = out;
+  this->_bits = 0;
+  this->_bitCount = 0;
+  this->_adlerA = 1;
+  this->_adlerB = 0;
+  this->_prev = -1;
+  this->_run = 0;
+  // zlib header with no preset dictionary followed by a single final block using
+  // the fixed Huffman codes.
+  this->out->write(0x78);
+  this->out->write(0x01);
+  this->putBits(1, 1);
+  this->putBits(1, 2);
+}
+void DeflateStream::putBits(uint32_t val, uint8_t count) {
+  this->_bits |= val << this->_bitCount;
+  this->_bitCount += count;
+  while(this->_bitCount >= 8) {
+    this->out->write(static_cast<uint8_t>(this->_bits & 0xFF));
+    this->_bits >>= 8;
+    this->_bitCount -= 8;
+  }
+}
+void DeflateStream::putSymbol(uint16_t sym) {
+  // Huffman codes are packed starting with the most significant bit so the
+  // code is reversed before it is added to the bit stream.
+  uint16_t code;
+  uint8_t len;
+  if(sym < 144) { code = 0x30 + sym; len = 8; }
+  else if(sym < 256) { code = 0x190 + (sym - 144); len = 9; }
+  else if(sym < 280) { code = sym - 256; len = 7; }
+  else { code = 0xC0 + (sym - 280); len = 8; }
+  uint16_t rev = 0;
+  for(uint8_t i = 0; i < len; i++) rev |= ((code >> i) & 0x01) << (len - 1 - i);
+  this->putBits(rev, len);
+}
+void DeflateStream::flushRun() {
+  if(this->_run >= 3) {
+    uint8_t i = 28;
+    while(_deflateLenBase[i] > this->_run) i--;
+    this->putSymbol(257 + i);
+    if(_deflateLenExtra[i] > 0) this->putBits(this->_run - _deflateLenBase[i], _deflateLenExtra[i]);
+    this->putBits(0, 5); // Distance code 0 is a distance of 1.
+  }
+  else {
+    while(this->_run > 0) {
+      this->putSymbol(static_cast<uint8_t>(this->_prev));
+      this->_run--;
+    }
+  }
+  this->_run = 0;
+}
+size_t DeflateStream::write(uint8_t ch) {
+  this->_adlerA = (this->_adlerA + ch) % 65521;
+  this->_adlerB = (this->_adlerB + this->_adlerA) % 65521;
+  if(this->_prev == ch) {
+    if(++this->_run == 258) this->flushRun();
+    return 1;
+  }
+  this->flushRun();
+  this->putSymbol(ch);
+  this->_prev = ch;
+  return 1;
+}
+void DeflateStream::end() {
+  this->flushRun();
+  this->putSymbol(256);
+  if(this->_bitCount > 0) this->putBits(0, 8 - this->_bitCount);
+  uint32_t adler = (this->_adlerB << 16) | this->_adlerA;
+  this->out->write(static_cast<uint8_t>(adler >> 24));
+  this->out->write(static_cast<uint8_t>(adler >> 16));
+  this->out->write(static_cast<uint8_t>(adler >> 8));
+  this->out->write(static_cast<uint8_t>(adler));
+}
 void JsonResponse::_safecat(const char *val, bool escape) {
   size_t len = (escape ? this->calcEscapedLength(val) : strlen(val)) + strlen(this->buff);
   if(escape) len += 2;
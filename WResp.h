@@ -71,4 +71,43 @@ class JsonSockEvent : public JsonFormatter {
     void endEvent(uint8_t clientNum = 255);
     void closeEvent();
 };
+// Sends raw bytes to the client as chunks of a response whose length is not known up
+// front.  The headers go out with the first chunk so any additional headers must be
+// set before the first byte is written.
+class StreamResponse : public Print {
+  protected:
+    uint8_t *buff;
+    size_t buffSize;
+    size_t _len = 0;
+    bool _headersSent = false;
+    const char *_contentType = nullptr;
+  public:
+    WebServer *server;
+    uint32_t sent = 0;
+    void beginResponse(WebServer *server, const char *contentType, char *buff, size_t buffSize);
+    void endResponse();
+    void send();
+    size_t write(uint8_t ch) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+};
+// Compresses the written bytes into a zlib (RFC1950) stream using the fixed deflate
+// Huffman codes.  Repeated bytes are encoded as distance 1 matches so the padding in
+// fixed length records collapses without the 32k window a full deflate requires.
+class DeflateStream : public Print {
+  protected:
+    Print *out = nullptr;
+    uint32_t _bits = 0;
+    uint8_t _bitCount = 0;
+    uint32_t _adlerA = 1;
+    uint32_t _adlerB = 0;
+    int16_t _prev = -1;
+    uint16_t _run = 0;
+    void putBits(uint32_t val, uint8_t count);
+    void putSymbol(uint16_t sym);
+    void flushRun();
+  public:
+    void begin(Print *out);
+    void end();
+    size_t write(uint8_t ch) override;
+};
 #endif
@@ -1,5 +1,6 @@
 #include <WiFi.h>
 #include <WebServer.h>
+#include <uri/UriBraces.h>
 #include <LittleFS.h>
 #include <Update.h>
 #include <esp_task_wdt.h>
@@ -15,6 +16,10 @@
 #include "GitOTA.h"
 #include "Network.h"
 #include "DinplugBridge.h"
+#include "Sockets.h"
+#include "TelnetServer.h"
+#include "Boot.h"
+#include "Metrics.h"
 
 extern ConfigSettings settings;
 extern SSDPClass SSDP;
@@ -25,6 +30,10 @@ extern MQTTClass mqtt;
 extern GitUpdater git;
 extern Network net;
 extern DinplugBridge dinplugBridge;
+extern TelnetServer telnet;
+extern SocketEmitter sockEmit;
+extern BootSequencer boot;
+extern Metrics metrics;
 
 //#define WEB_MAX_RESPONSE 34768
 #define WEB_MAX_RESPONSE 4096
@@ -40,27 +49,442 @@ static const char _encoding_text[] = "text/plain";
 static const char _encoding_html[] = "text/html";
 static const char _encoding_json[] = "application/json";
 
-WebServer apiServer(8081);
-WebServer server(80);
+KeepAliveServer apiServer(8081);
+LockingServer server(80);
+static ShadeConfigStream restoreStream;
+void LockingServer::on(const Uri &uri, THandlerFunction fn) {
+  WebServer::on(uri, [fn]() { webServer.beginHandler(); fn(); webServer.endHandler(); });
+}
+void LockingServer::on(const Uri &uri, HTTPMethod method, THandlerFunction fn) {
+  WebServer::on(uri, method, [fn]() { webServer.beginHandler(); fn(); webServer.endHandler(); });
+}
+void LockingServer::on(const Uri &uri, HTTPMethod method, THandlerFunction fn, THandlerFunction ufn) {
+  // Each upload chunk is handled under the lock but the next one is read without it.
+  WebServer::on(uri, method, [fn]() { webServer.beginHandler(); fn(); webServer.endHandler(); },
+    [ufn]() { webServer.beginHandler(); ufn(); webServer.endHandler(); });
+}
+void LockingServer::onNotFound(THandlerFunction fn) {
+  WebServer::onNotFound([fn]() { webServer.beginHandler(); fn(); webServer.endHandler(); });
+}
+// Points at the value the server holds rather than copying it into a String the way
+// arg() does.  Form fields of a multipart post are looked at first as arg() does.
+const char *LockingServer::argPtr(const char *name) {
+  for(int i = 0; i < this->_postArgsLen; i++) {
+    if(this->_postArgs[i].key == name) return this->_postArgs[i].value.c_str();
+  }
+  for(int i = 0; i < this->_currentArgCount; i++) {
+    if(this->_currentArgs[i].key == name) return this->_currentArgs[i].value.c_str();
+  }
+  return nullptr;
+}
+size_t LockingServer::_currentClientWrite(const char *b, size_t l) {
+  bool held = webServer.beginWrite();
+  size_t n = WebServer::_currentClientWrite(b, l);
+  webServer.endWrite(held);
+  return n;
+}
+size_t LockingServer::_currentClientWrite_P(PGM_P b, size_t l) {
+  bool held = webServer.beginWrite();
+  size_t n = WebServer::_currentClientWrite_P(b, l);
+  webServer.endWrite(held);
+  return n;
+}
+uint8_t KeepAliveServer::parkedCount() {
+  uint8_t count = 0;
+  for(uint8_t i = 0; i < WEB_KEEPALIVE_MAX; i++) if(this->parked[i]) count++;
+  return count;
+}
+bool KeepAliveServer::canKeepAlive() {
+  if(settings.apiKeepAlive == 0 || this->_currentVersion == 0) return false;
+  if(this->requests >= settings.apiMaxRequests) return false;
+  if(this->hasHeader("Connection") && this->header("Connection").equalsIgnoreCase("close")) return false;
+  return this->parkedCount() < WEB_KEEPALIVE_MAX;
+}
+bool KeepAliveServer::resumeClient() {
+  uint32_t idle = settings.apiKeepAlive * 1000;
+  for(uint8_t i = 0; i < WEB_KEEPALIVE_MAX; i++) {
+    if(!this->parked[i]) continue;
+    if(this->parked[i].available()) {
+      this->_currentClient = this->parked[i];
+      this->parked[i] = WiFiClient();
+      this->_currentStatus = HC_WAIT_READ;
+      this->_statusChange = millis();
+      this->requests = this->parkedRequests[i];
+      this->reused++;
+      return true;
+    }
+    if(millis() - this->parkedAt[i] > idle) {
+      this->parked[i].stop();
+      this->parked[i] = WiFiClient();
+    }
+  }
+  return false;
+}
+void KeepAliveServer::parkClient() {
+  for(uint8_t i = 0; i < WEB_KEEPALIVE_MAX; i++) {
+    if(this->parked[i]) continue;
+    this->parked[i] = this->_currentClient;
+    this->parkedAt[i] = millis();
+    this->parkedRequests[i] = this->requests;
+    break;
+  }
+  this->_currentClient = WiFiClient();
+  this->_currentStatus = HC_NONE;
+}
+void KeepAliveServer::handleClient() {
+  if(this->_currentStatus == HC_NONE && !this->resumeClient()) this->requests = 0;
+  this->headerPending = true;
+  this->keepAlive = false;
+  WebServer::handleClient();
+  this->headerPending = false;
+  // A request was answered and the client is still there so hold onto it rather than
+  // leaving the server to wait for the close.
+  if(this->keepAlive && this->_currentStatus == HC_WAIT_CLOSE) this->parkClient();
+}
+size_t KeepAliveServer::_currentClientWrite(const char *b, size_t l) {
+  // The first write of a response is the header block which is where the server
+  // hard codes the Connection header.
+  if(!this->headerPending) return LockingServer::_currentClientWrite(b, l);
+  this->headerPending = false;
+  this->requests++;
+  if(l < 7 || strncmp(b, "HTTP/1.", 7) != 0) return LockingServer::_currentClientWrite(b, l);
+  static const char close[] = "Connection: close\r\n";
+  const char *conn = (const char *)memmem(b, l, close, sizeof(close) - 1);
+  if(!conn || !this->canKeepAlive()) return LockingServer::_currentClientWrite(b, l);
+  this->keepAlive = true;
+  char hdr[64];
+  snprintf(hdr, sizeof(hdr), "Connection: keep-alive\r\nKeep-Alive: timeout=%u, max=%u\r\n",
+    settings.apiKeepAlive, settings.apiMaxRequests - this->requests);
+  size_t pre = conn - b;
+  size_t post = pre + sizeof(close) - 1;
+  bool held = webServer.beginWrite();
+  size_t n = WebServer::_currentClientWrite(b, pre);
+  WebServer::_currentClientWrite(hdr, strlen(hdr));
+  n += WebServer::_currentClientWrite(b + post, l - post);
+  webServer.endWrite(held);
+  return n + post - pre;
+}
+static void emitRestoreProgress() {
+  JsonSockEvent *json = sockEmit.beginEmit("restoreProgress", 0);
+  json->beginObject();
+  restoreStream.toJSON(json);
+  json->endObject();
+  sockEmit.endEmit();
+  // The upload is parsed inside one request while the loop task waits on the state
+  // lock so the progress has to go out from here.
+  sockEmit.flushAll();
+}
 void Web::startup() {
   Serial.println("Launching web server...");
 }
+static void webTask(void *arg) {
+  // The http servers are serviced on their own task so a slow client does not hold up
+  // the radio.  The servers take the state lock themselves only while a handler runs so
+  // handlers never touch the shades at the same time as the loop task.
+  for(;;) {
+    server.handleClient();
+    apiServer.handleClient();
+    vTaskDelay(1);
+  }
+}
+void Web::lockState() {
+  if(!this->stateLock) return;
+  // The loop task is watched so keep feeding the watchdog while a long request
+  // such as an upload holds the lock.
+  while(xSemaphoreTake(this->stateLock, pdMS_TO_TICKS(1000)) != pdTRUE) esp_task_wdt_reset();
+}
+void Web::unlockState() { if(this->stateLock) xSemaphoreGive(this->stateLock); }
+void Web::beginHandler() {
+  this->lockState();
+  this->serving = true;
+}
+void Web::endHandler() {
+  this->serving = false;
+  this->unlockState();
+}
+// Gives up the lock a handler holds while it writes to the client.  Returns whether it
+// was held so endWrite takes it back.
+bool Web::beginWrite() {
+  if(!this->serving) return false;
+  this->serving = false;
+  this->unlockState();
+  return true;
+}
+void Web::endWrite(bool held) {
+  if(!held) return;
+  this->lockState();
+  this->serving = true;
+}
+bool Web::queueCommand(web_command_t &cmd) {
+  if(!this->commands) {
+    this->executeCommand(cmd);
+    return true;
+  }
+  if(xQueueSend(this->commands, &cmd, 0) != pdTRUE) {
+    this->commandsDropped++;
+    return false;
+  }
+  this->commandsQueued++;
+  return true;
+}
+void Web::executeCommand(web_command_t &cmd) {
+  switch(cmd.type) {
+    case web_cmd_types_t::shade:
+    case web_cmd_types_t::shadeTarget:
+    case web_cmd_types_t::tilt:
+    case web_cmd_types_t::tiltTarget:
+    case web_cmd_types_t::shadeRepeat: {
+      SomfyShade *shade = somfy.getShadeById(cmd.id);
+      if(!shade) return;
+      if(cmd.type == web_cmd_types_t::shadeTarget) shade->moveToTarget(shade->transformPosition(cmd.target));
+      else if(cmd.type == web_cmd_types_t::tiltTarget) shade->moveToTiltTarget(shade->transformPosition(cmd.target));
+      else if(cmd.type == web_cmd_types_t::tilt) shade->sendTiltCommand(cmd.command);
+      else if(cmd.type == web_cmd_types_t::shade) shade->sendCommand(cmd.command, cmd.repeat > 0 ? cmd.repeat : shade->repeats, cmd.stepSize);
+      else {
+        if(shade->shadeType == shade_types::garage1 && cmd.command == somfy_commands::Prog) cmd.command = somfy_commands::Toggle;
+        if(!shade->isLastCommand(cmd.command)) shade->sendCommand(cmd.command, cmd.repeat >= 0 ? cmd.repeat : shade->repeats, cmd.stepSize);
+        else shade->repeatFrame(cmd.repeat >= 0 ? cmd.repeat : shade->repeats);
+      }
+      break;
+    }
+    case web_cmd_types_t::group:
+    case web_cmd_types_t::groupRepeat: {
+      SomfyGroup *group = somfy.getGroupById(cmd.id);
+      if(!group) return;
+      if(cmd.type == web_cmd_types_t::groupRepeat && group->isLastCommand(cmd.command))
+        group->repeatFrame(cmd.repeat >= 0 ? cmd.repeat : group->repeats);
+      else
+        group->sendCommand(cmd.command, cmd.repeat >= 0 ? cmd.repeat : group->repeats, cmd.stepSize);
+      break;
+    }
+  }
+}
+void Web::processCommands() {
+  web_command_t cmd;
+  while(this->commands && xQueueReceive(this->commands, &cmd, 0) == pdTRUE) {
+    this->executeCommand(cmd);
+    esp_task_wdt_reset();
+  }
+}
 void Web::loop() {
-  server.handleClient();
-  delay(1);
-  apiServer.handleClient();
+  if(!this->task) {
+    server.handleClient();
+    delay(1);
+    apiServer.handleClient();
+    delay(1);
+    return;
+  }
+  // Long running work such as a file system recovery calls back into the loop to keep
+  // the servers responsive.  When that happens on the web task it is already serving.
+  if(xTaskGetCurrentTaskHandle() == this->task) return;
+  this->processCommands();
+  // The loop task owns the state lock except for this window where the web task
+  // can pick up a request.
+  this->unlockState();
   delay(1);
+  this->lockState();
+  this->processCommands();
+}
+static uint8_t g_arena[WEB_ARENA_SIZE] __attribute__((aligned(8)));
+static bool g_arenaInUse = false;
+static char g_body[WEB_BODY_SIZE];
+static bool g_bodyInUse = false;
+uint32_t WebArenaAllocator::hits = 0;
+uint32_t WebArenaAllocator::misses = 0;
+void *WebArenaAllocator::allocate(size_t size) {
+  // Routes without a body build an empty document which needs no pool at all.
+  if(size == 0) return nullptr;
+  if(!g_arenaInUse && size <= WEB_ARENA_SIZE) {
+    g_arenaInUse = true;
+    hits++;
+    return g_arena;
+  }
+  misses++;
+  return HeapTracker::alloc(heap_tags_t::web, size);
+}
+void WebArenaAllocator::deallocate(void *ptr) {
+  if(ptr == g_arena) g_arenaInUse = false;
+  else HeapTracker::free(heap_tags_t::web, ptr);
+}
+void *WebArenaAllocator::reallocate(void *ptr, size_t size) {
+  if(ptr != g_arena) return HeapTracker::realloc(heap_tags_t::web, ptr, size);
+  if(size <= WEB_ARENA_SIZE) return ptr;
+  // Growing past the arena moves the pool to the heap.
+  misses++;
+  void *p = HeapTracker::alloc(heap_tags_t::web, size);
+  if(p) {
+    memcpy(p, g_arena, WEB_ARENA_SIZE);
+    g_arenaInUse = false;
+  }
+  return p;
+}
+// The request body copied out of the server so the document can be parsed in place and
+// point into it.  A body that does not fit the static buffer or a nested request uses
+// the tracked heap.
+struct WebRequestBody {
+  char *data = nullptr;
+  size_t len = 0;
+  bool load(LockingServer &server) {
+    const char *plain = server.argPtr("plain");
+    this->len = plain ? strlen(plain) : 0;
+    if(this->len == 0) return true;
+    if(!g_bodyInUse && this->len < WEB_BODY_SIZE) {
+      g_bodyInUse = true;
+      this->data = g_body;
+    }
+    else this->data = (char *)HeapTracker::alloc(heap_tags_t::web, this->len + 1);
+    if(!this->data) return false;
+    memcpy(this->data, plain, this->len + 1);
+    return true;
+  }
+  ~WebRequestBody() {
+    if(this->data == g_body) g_bodyInUse = false;
+    else HeapTracker::free(heap_tags_t::web, this->data);
+  }
+};
+WebRequest::WebRequest(LockingServer &server, size_t docSize) : server(server), doc(docSize) { this->method = server.method(); }
+DeserializationError WebRequest::parse(char *json) {
+  // The body is parsed in place so the strings point into it rather than being copied
+  // into the document.  The caller keeps the body alive for the life of the request.
+  DeserializationError err = deserializeJson(this->doc, json);
+  if(!err) this->body = this->doc.as<JsonObject>();
+  return err;
+}
+bool WebRequest::hasArg(const char *name) {
+  if(this->server.argPtr(name)) return true;
+  return !this->body.isNull() && !this->body[name].isNull();
+}
+String WebRequest::arg(const char *name, const char *def) {
+  const char *val = this->server.argPtr(name);
+  if(val) return String(val);
+  if(this->body.isNull()) return String(def);
+  JsonVariant var = this->body[name];
+  if(var.isNull()) return String(def);
+  if(var.is<const char *>()) return String(var.as<const char *>());
+  String str;
+  serializeJson(var, str);
+  return str;
+}
+// Returns a pointer into the query string, form or body rather than a copy.  Values in
+// the body that are not strings read as the default.
+const char *WebRequest::argStr(const char *name, const char *def) {
+  const char *val = this->server.argPtr(name);
+  if(val) return val;
+  if(this->body.isNull()) return def;
+  val = this->body[name].as<const char *>();
+  return val ? val : def;
+}
+long WebRequest::argInt(const char *name, long def) {
+  const char *str = this->server.argPtr(name);
+  if(str) return atol(str);
+  if(this->body.isNull()) return def;
+  JsonVariant val = this->body[name];
+  if(val.isNull()) return def;
+  if(val.is<const char *>()) return atol(val.as<const char *>());
+  if(val.is<bool>()) return val.as<bool>() ? 1 : 0;
+  return val.as<long>();
+}
+bool WebRequest::argBool(const char *name, bool def) {
+  const char *str = this->server.argPtr(name);
+  if(str) return toBoolean(str, def);
+  if(this->body.isNull()) return def;
+  JsonVariant val = this->body[name];
+  if(val.isNull()) return def;
+  if(val.is<const char *>()) return toBoolean(val.as<const char *>(), def);
+  if(val.is<bool>()) return val.as<bool>();
+  return val.as<long>() != 0;
+}
+// The services that are offered on both the ui port and the api port.  A zero document
+// size means the route takes no body and WEB_DOC_FROM_BODY sizes the document from
+// the body for routes that take an entire configuration.
+#define WEB_DOC_FROM_BODY 0xFFFF
+static constexpr web_route_t g_routes[] = {
+  {"/discovery", WEB_METHOD_READ, web_auth_t::none, 0, &Web::handleDiscovery},
+  {"/login", WEB_METHOD_READ, web_auth_t::none, 512, &Web::handleLogin},
+  {"/loginContext", WEB_METHOD_READ, web_auth_t::none, 0, &Web::handleLoginContext},
+  {"/controller", WEB_METHOD_READ, web_auth_t::api, 0, &Web::handleController},
+  {"/bootProfile", WEB_METHOD_READ, web_auth_t::api, 0, &Web::handleBootProfile},
+  // Scrapers do not log in so the metrics are open like discovery.
+  {"/metrics", WEB_METHOD_GET, web_auth_t::none, 0, &Web::handleMetrics},
+  {"/rooms", WEB_METHOD_READ, web_auth_t::api, 0, &Web::handleGetRooms},
+  // The Dinplug page has no login and lists these for its pickers.
+  {"/shades", WEB_METHOD_READ, web_auth_t::none, 0, &Web::handleGetShades},
+  {"/groups", WEB_METHOD_READ, web_auth_t::none, 0, &Web::handleGetGroups},
+  {"/repeaters", WEB_METHOD_READ, web_auth_t::api, 0, &Web::handleGetRepeaters},
+  {"/shadeCommand", WEB_METHOD_READ | WEB_METHOD_PUT, web_auth_t::api, 512, &Web::handleShadeCommand},
+  {"/groupCommand", WEB_METHOD_READ | WEB_METHOD_PUT, web_auth_t::api, 256, &Web::handleGroupCommand},
+  {"/tiltCommand", WEB_METHOD_READ | WEB_METHOD_PUT, web_auth_t::api, 256, &Web::handleTiltCommand},
+  {"/repeatCommand", WEB_METHOD_READ | WEB_METHOD_PUT, web_auth_t::api, 512, &Web::handleRepeatCommand},
+  {"/setPositions", WEB_METHOD_READ | WEB_METHOD_PUT, web_auth_t::api, 512, &Web::handleSetPositions},
+  {"/setSensor", WEB_METHOD_READ | WEB_METHOD_PUT, web_auth_t::api, 512, &Web::handleSetSensor},
+  {"/room", WEB_METHOD_READ | WEB_METHOD_PUT, web_auth_t::config, 512, &Web::handleRoom},
+  {"/shade", WEB_METHOD_READ | WEB_METHOD_PUT, web_auth_t::config, 512, &Web::handleShade},
+  {"/group", WEB_METHOD_READ | WEB_METHOD_PUT, web_auth_t::config, 512, &Web::handleGroup},
+  {"/provision", WEB_METHOD_WRITE, web_auth_t::config, WEB_DOC_FROM_BODY, &Web::handleProvision},
+  {"/backup", WEB_METHOD_READ, web_auth_t::config, 0, &Web::handleBackup},
+  {"/downloadFirmware", WEB_METHOD_READ | WEB_METHOD_PUT, web_auth_t::config, 0, &Web::handleDownloadFirmware},
+  {"/reboot", WEB_METHOD_WRITE, web_auth_t::config, 0, &Web::handleReboot},
+  // The Dinplug page has no login of its own.
+  {"/dinplug/settings", WEB_METHOD_READ | WEB_METHOD_PUT, web_auth_t::none, 512, &Web::handleDinplugSettings},
+  {"/dinplug/mappings", WEB_METHOD_ANY, web_auth_t::none, 1024, &Web::handleDinplugMappings},
+  {"/dinplug/connect", WEB_METHOD_WRITE, web_auth_t::none, 256, &Web::handleDinplugConnect}
+};
+#define WEB_ROUTE_COUNT (sizeof(g_routes) / sizeof(g_routes[0]))
+static uint8_t webMethodFlag(HTTPMethod method) {
+  switch(method) {
+    case HTTP_GET: return WEB_METHOD_GET;
+    case HTTP_POST: return WEB_METHOD_POST;
+    case HTTP_PUT: return WEB_METHOD_PUT;
+    case HTTP_DELETE: return WEB_METHOD_DELETE;
+    default: return 0;
+  }
+}
+void Web::dispatch(LockingServer &server, uint8_t index) {
+  const web_route_t &route = g_routes[index];
+  this->sendCORSHeaders(server);
+  HTTPMethod method = server.method();
+  if(method == HTTP_OPTIONS) { server.send(200, "OK"); return; }
+  if((webMethodFlag(method) & route.methods) == 0) {
+    server.send(405, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Invalid Http method\"}"));
+    return;
+  }
+  if(route.auth != web_auth_t::none && !this->isAuthenticated(server, route.auth == web_auth_t::config)) return;
+  uint32_t start = micros();
+  // Copy the body out of the server once.  It must outlive the request since the
+  // document points into it.
+  WebRequestBody body;
+  if(route.docSize > 0 && !body.load(server)) {
+    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Out of memory reading the request body\"}"));
+    return;
+  }
+  size_t docSize = body.len > 0 ? route.docSize : 0;
+  if(docSize == WEB_DOC_FROM_BODY) docSize = body.len * 2 + 1024;
+  WebRequest req(server, docSize);
+  if(body.len > 0) {
+    DeserializationError err = req.parse(body.data);
+    if(err) {
+      this->handleDeserializationError(server, err);
+      return;
+    }
+  }
+  (this->*route.handler)(req);
+  uint32_t elapsed = micros() - start;
+  metrics.observe(metric_families_t::http, route.path, elapsed);
+  if(elapsed > 100000) Serial.printf("Timing %s: %lums\n", route.path, elapsed / 1000);
 }
 void Web::sendCORSHeaders(WebServer &server) { 
-    //server.sendHeader(F("Connection"), F("Keep-Alive")); 
-    //server.sendHeader(F("Keep-Alive"), F("timeout=5, max=1000"));
     //server.sendHeader(F("Access-Control-Allow-Origin"), F("*"));
     //server.sendHeader(F("Access-Control-Max-Age"), F("600"));
     //server.sendHeader(F("Access-Control-Allow-Methods"), F("PUT,POST,GET,OPTIONS"));
     //server.sendHeader(F("Access-Control-Allow-Headers"), F("*"));
 }
-void Web::sendCacheHeaders(uint32_t seconds) {
-  server.sendHeader(F("Cache-Control"), F("public, max-age=604800, immutable"));
+void Web::sendCacheHeaders(uint32_t seconds, bool immutable) {
+  // A zero age makes the browser revalidate against the ETag each time so files
+  // without a content hash in their name are picked up after an upgrade.
+  char cache[48];
+  if(seconds == 0) strcpy(cache, "no-cache");
+  else snprintf(cache, sizeof(cache), "public, max-age=%u%s", seconds, immutable ? ", immutable" : "");
+  server.sendHeader(F("Cache-Control"), cache);
 }
 void Web::end() {
   //server.end();
@@ -78,57 +502,94 @@ void Web::handleDeserializationError(WebServer &server, DeserializationError &er
       break;
     }
 }
+// Compares every character so the time taken does not say how much of the key matched.
+static bool tokenEquals(const char *a, const char *b, size_t len) {
+  uint8_t diff = 0;
+  for(size_t i = 0; i < len; i++) diff |= a[i] ^ b[i];
+  return diff == 0;
+}
 bool Web::isAuthenticated(WebServer &server, bool cfg) {
-  Serial.println("Checking authentication");
   if(settings.Security.type == security_types::None) return true;
   else if(!cfg && (settings.Security.permissions & static_cast<uint8_t>(security_permissions::ConfigOnly)) == 0x01) return true;
   else if(server.hasHeader("apikey")) {
     // Api key was supplied.
-    Serial.println("Checking API Key...");
+    uint32_t start = micros();
+    uint32_t hits = this->tokenHits;
     char token[65];
-    memset(token, 0x00, sizeof(token));
     this->createAPIToken(server.client().remoteIP(), token);
     // Compare the tokens.
-    if(String(token) != server.header("apikey")) return false;
+    const String &key = server.header("apikey");
+    bool valid = key.length() == 64 && tokenEquals(token, key.c_str(), 64);
+    metrics.observe(metric_families_t::auth, this->tokenHits != hits ? "cached" : "computed", micros() - start);
+    if(!valid) {
+      server.send(401, _encoding_text, "Unauthorized API Key");
+      return false;
+    }
     server.sendHeader("apikey", token);
   }
   else {
     // Send a 401
     Serial.println("Not authenticated...");
-    server.send(401, "Unauthorized API Key");
+    server.send(401, _encoding_text, "Unauthorized API Key");
     return false;
   }
   return true;
 }
 bool Web::createAPIPinToken(const IPAddress ipAddress, const char *pin, char *token) {
-  return this->createAPIToken((String(pin) + ":" + ipAddress.toString()).c_str(), token);
+  char payload[24];
+  snprintf(payload, sizeof(payload), "%s:%u.%u.%u.%u", pin, ipAddress[0], ipAddress[1], ipAddress[2], ipAddress[3]);
+  return this->createAPIToken(payload, token);
 }
 bool Web::createAPIPasswordToken(const IPAddress ipAddress, const char *username, const char *password, char *token) {
-  return this->createAPIToken((String(username) + ":" + String(password) + ":" + ipAddress.toString()).c_str(), token);
+  char payload[88];
+  snprintf(payload, sizeof(payload), "%s:%s:%u.%u.%u.%u", username, password, ipAddress[0], ipAddress[1], ipAddress[2], ipAddress[3]);
+  return this->createAPIToken(payload, token);
 }
 bool Web::createAPIToken(const char *payload, char *token) {
+    static const char hex[] = "0123456789abcdef";
     byte hmacResult[32];
     mbedtls_md_context_t ctx;
     mbedtls_md_type_t md_type = MBEDTLS_MD_SHA256;
+    mbedtls_md_init(&ctx);
     mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(md_type), 1);
     mbedtls_md_hmac_starts(&ctx, (const unsigned char *)settings.serverId, strlen(settings.serverId));
     mbedtls_md_hmac_update(&ctx, (const unsigned char *)payload, strlen(payload)); 
     mbedtls_md_hmac_finish(&ctx, hmacResult);
-    Serial.print("Hash: ");
-    token[0] = '\0';
-    for(int i = 0; i < sizeof(hmacResult); i++){
-        char str[3];
-        sprintf(str, "%02x", (int)hmacResult[i]);
-        strcat(token, str);
-    }
-    Serial.println(token);
+    mbedtls_md_free(&ctx);
+    for(uint8_t i = 0; i < sizeof(hmacResult); i++) {
+      token[i * 2] = hex[hmacResult[i] >> 4];
+      token[i * 2 + 1] = hex[hmacResult[i] & 0x0F];
+    }
+    token[sizeof(hmacResult) * 2] = '\0';
     return true;
 }
 bool Web::createAPIToken(const IPAddress ipAddress, char *token) {
-    String payload;
+    // The token only depends on the client address and the security settings so
+    // it is kept until the settings change rather than hashed on every request.
+    uint32_t ip = static_cast<uint32_t>(ipAddress);
+    web_token_t *slot = &this->tokens[0];
+    for(uint8_t i = 0; i < WEB_TOKEN_CACHE_SIZE; i++) {
+      web_token_t *t = &this->tokens[i];
+      if(t->ip == ip && t->revision == settings.Security.revision && t->token[0] != '\0') {
+        t->lastUsed = millis();
+        this->tokenHits++;
+        memcpy(token, t->token, sizeof(t->token));
+        return true;
+      }
+      if(t->lastUsed < slot->lastUsed) slot = t;
+    }
+    this->tokenMisses++;
     if(settings.Security.type == security_types::Password) createAPIPasswordToken(ipAddress, settings.Security.username, settings.Security.password, token);
     else if(settings.Security.type == security_types::PinEntry) createAPIPinToken(ipAddress, settings.Security.pin, token);
-    else createAPIToken(ipAddress.toString().c_str(), token);
+    else {
+      char payload[16];
+      snprintf(payload, sizeof(payload), "%u.%u.%u.%u", ipAddress[0], ipAddress[1], ipAddress[2], ipAddress[3]);
+      createAPIToken(payload, token);
+    }
+    slot->ip = ip;
+    slot->revision = settings.Security.revision;
+    slot->lastUsed = millis();
+    memcpy(slot->token, token, sizeof(slot->token));
     return true;
 }
 void Web::handleLogout(WebServer &server) {
@@ -138,9 +599,8 @@ void Web::handleLogout(WebServer &server) {
   server.sendHeader("Set-Cookie", "ESPSOMFYID=0");
   server.send(301);
 }
-void Web::handleLogin(WebServer &server) {
-    webServer.sendCORSHeaders(server);
-    if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
+void Web::handleLogin(WebRequest &req) {
+    WebServer &server = req.server;
     StaticJsonDocument<256> doc;
     JsonObject obj = doc.to<JsonObject>();
     char token[65];
@@ -159,28 +619,9 @@ void Web::handleLogin(WebServer &server) {
     char username[33] = "";
     char password[33] = "";
     char pin[5] = "";
-    memset(username, 0x00, sizeof(username));
-    memset(password, 0x00, sizeof(password));
-    memset(pin, 0x00, sizeof(pin));
-    if(server.hasArg("plain")) {
-      DynamicJsonDocument docin(512);
-      DeserializationError err = deserializeJson(docin, server.arg("plain"));
-      if (err) {
-        this->handleDeserializationError(server, err);
-        return;
-      }
-      else {
-          JsonObject objin = docin.as<JsonObject>();
-          if(objin.containsKey("username") && objin["username"]) strlcpy(username, objin["username"], sizeof(username));
-          if(objin.containsKey("password") && objin["password"]) strlcpy(password, objin["password"], sizeof(password));
-          if(objin.containsKey("pin") && objin["pin"]) strlcpy(pin, objin["pin"], sizeof(pin));
-      }
-    }
-    else {
-      if(server.hasArg("username")) strlcpy(username, server.arg("username").c_str(), sizeof(username));
-      if(server.hasArg("password")) strlcpy(password, server.arg("password").c_str(), sizeof(password));
-      if(server.hasArg("pin")) strlcpy(pin, server.arg("pin").c_str(), sizeof(pin));
-    }
+    strlcpy(username, req.arg("username").c_str(), sizeof(username));
+    strlcpy(password, req.arg("password").c_str(), sizeof(password));
+    strlcpy(pin, req.arg("pin").c_str(), sizeof(pin));
     // At this point we should have all the data we need to login.
     if(settings.Security.type == security_types::PinEntry) {
       Serial.print("Validating pin ");
@@ -210,6 +651,68 @@ void Web::handleLogin(WebServer &server) {
     server.send(200, _encoding_json, g_content);
     return;
 }
+#define WEB_MAX_ETAGS 16
+struct web_etag_t {
+  char filename[32] = "";
+  char etag[12] = "";
+};
+static web_etag_t g_etags[WEB_MAX_ETAGS];
+static bool getFileETag(File &file, const char *filename, bool gzipped, char *etag, size_t size) {
+  if(gzipped) {
+    // The gzip trailer holds the CRC32 and length of the uncompressed content so the
+    // build has already hashed the content for us.
+    uint8_t trailer[8];
+    if(file.size() < sizeof(trailer) || !file.seek(file.size() - sizeof(trailer), SeekSet) || file.read(trailer, sizeof(trailer)) != sizeof(trailer)) {
+      file.seek(0, SeekSet);
+      return false;
+    }
+    file.seek(0, SeekSet);
+    uint32_t crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+    snprintf(etag, size, "\"%08x\"", crc);
+    return true;
+  }
+  // Files that are not compressed are hashed the first time they are requested.  The
+  // file system only changes with an image update which reboots so the hash is kept
+  // for the life of the process.
+  for(uint8_t i = 0; i < WEB_MAX_ETAGS; i++) {
+    if(strcmp(g_etags[i].filename, filename) == 0) {
+      strlcpy(etag, g_etags[i].etag, size);
+      return true;
+    }
+  }
+  web_etag_t *slot = nullptr;
+  for(uint8_t i = 0; i < WEB_MAX_ETAGS; i++) {
+    if(g_etags[i].filename[0] == '\0') {
+      slot = &g_etags[i];
+      break;
+    }
+  }
+  if(!slot || strlen(filename) >= sizeof(slot->filename)) return false;
+  uint32_t hash = 2166136261UL;
+  uint8_t buff[256];
+  size_t len;
+  while((len = file.read(buff, sizeof(buff))) > 0) {
+    for(size_t i = 0; i < len; i++) hash = (hash ^ buff[i]) * 16777619UL;
+  }
+  file.seek(0, SeekSet);
+  snprintf(slot->etag, sizeof(slot->etag), "\"%08x\"", hash);
+  strlcpy(slot->filename, filename, sizeof(slot->filename));
+  strlcpy(etag, slot->etag, size);
+  return true;
+}
+// If-None-Match may carry a list of tags and weak tags are compared by their value.
+static bool etagMatches(const char *header, const char *etag) {
+  size_t len = strlen(etag);
+  const char *p = header;
+  while(*p) {
+    while(*p == ' ' || *p == '\t' || *p == ',') p++;
+    if(*p == '*') return true;
+    if(strncmp(p, "W/", 2) == 0) p += 2;
+    if(strncmp(p, etag, len) == 0 && (p[len] == '\0' || p[len] == ',' || p[len] == ' ' || p[len] == '\t')) return true;
+    while(*p && *p != ',') p++;
+  }
+  return false;
+}
 void Web::handleStreamFile(WebServer &server, const char *filename, const char *encoding) {
   if(git.lockFS) {
     server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Filesystem update in progress\"}"));
@@ -218,64 +721,138 @@ void Web::handleStreamFile(WebServer &server, const char *filename, const char *
   webServer.sendCORSHeaders(server);
   if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
   esp_task_wdt_reset();
-  // Load the index html page from the data directory.
-  Serial.print("Loading file ");
-  Serial.println(filename);
-  File file = LittleFS.open(filename, "r");
+  uint32_t start = millis();
+  // The file system image carries a gzip compressed copy of the larger text assets.  Serve
+  // that when the client accepts it so far fewer bytes cross the wire.
+  char gzname[40];
+  snprintf(gzname, sizeof(gzname), "%s.gz", filename);
+  bool variant = LittleFS.exists(gzname);
+  bool gzipped = variant && strstr(server.header("Accept-Encoding").c_str(), "gzip") != nullptr;
+  File file = LittleFS.open(gzipped ? gzname : filename, "r");
   if (!file) {
     Serial.print("Error opening");
     Serial.println(filename);
     server.send(500, _encoding_text, "Error opening file");
+    return;
+  }
+  // Any response for a file with a compressed copy depends on Accept-Encoding, including
+  // the 304 and the uncompressed body, so a shared cache keys on it.
+  if(variant) server.sendHeader(F("Vary"), F("Accept-Encoding"));
+  char etag[12];
+  if(getFileETag(file, filename, gzipped, etag, sizeof(etag))) {
+    server.sendHeader(F("ETag"), etag);
+    if(etagMatches(server.header("If-None-Match").c_str(), etag)) {
+      file.close();
+      server.send(304);
+      return;
+    }
   }
-  esp_task_wdt_delete(NULL);
-  server.streamFile(file, encoding);
+  // Nothing shared is touched while the file is written to the client so the
+  // loop task is allowed to run while a slow client drains it.
+  bool held = this->beginWrite();
+  // Without the web task the file goes out from the watched loop task.
+  if(!this->task) esp_task_wdt_delete(NULL);
+  // streamFile adds the Content-Encoding header when the file name ends in .gz.
+  size_t sent = server.streamFile(file, encoding);
   file.close();
-  esp_task_wdt_add(NULL);
-  esp_task_wdt_reset();
+  if(!this->task) {
+    esp_task_wdt_add(NULL);
+    esp_task_wdt_reset();
+  }
+  this->endWrite(held);
+  Serial.printf("Sent %s%s %u bytes in %lums\n", filename, gzipped ? ".gz" : "", sent, millis() - start);
 }
-void Web::handleController(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  HTTPMethod method = server.method();
-  settings.printAvailHeap();
-  if (method == HTTP_POST || method == HTTP_GET) {
-    JsonResponse resp;
-    resp.beginResponse(&server, g_content, sizeof(g_content));
-    resp.beginObject();
-    resp.addElem("maxRooms", (uint8_t)SOMFY_MAX_ROOMS);
-    resp.addElem("maxShades", (uint8_t)SOMFY_MAX_SHADES);
-    resp.addElem("maxGroups", (uint8_t)SOMFY_MAX_GROUPS);
-    resp.addElem("maxGroupedShades", (uint8_t)SOMFY_MAX_GROUPED_SHADES);
-    resp.addElem("maxLinkedRemotes", (uint8_t)SOMFY_MAX_LINKED_REMOTES);
-    resp.addElem("startingAddress", (uint32_t)somfy.startingAddress);
-    resp.beginObject("transceiver");
-    somfy.transceiver.toJSON(resp);
-    resp.endObject();
-    resp.beginObject("version");
-    git.toJSON(resp);
-    resp.endObject();
-    resp.beginArray("rooms");
-    somfy.toJSONRooms(resp);
-    resp.endArray();
-    resp.beginArray("shades");
-    somfy.toJSONShades(resp);
-    resp.endArray();
-    resp.beginArray("groups");
-    somfy.toJSONGroups(resp);
-    resp.endArray();
-    resp.beginArray("repeaters");
-    somfy.toJSONRepeaters(resp);
-    resp.endArray();
-    resp.endObject();
-    resp.endResponse();
+void Web::handleAsset(WebServer &server) {
+  // Bundled assets carry a hash of their content in the name so they never change
+  // and can be cached for good.
+  String name = server.pathArg(0);
+  if(name.length() == 0 || name.length() > 32 || name.indexOf('/') >= 0 || name.indexOf("..") >= 0) {
+    server.send(404, _encoding_text, "Not Found");
+    return;
+  }
+  const char *encoding = "application/octet-stream";
+  if(name.endsWith(".js")) encoding = "text/javascript";
+  else if(name.endsWith(".css")) encoding = "text/css";
+  char filename[48];
+  snprintf(filename, sizeof(filename), "/assets/%s", name.c_str());
+  if(!LittleFS.exists(filename)) {
+    server.send(404, _encoding_text, "Not Found");
+    return;
   }
-  else server.send(404, _encoding_text, _response_404);
+  this->sendCacheHeaders(31536000, true);
+  this->handleStreamFile(server, filename, encoding);
 }
-void Web::handleLoginContext(WebServer &server) {
-    webServer.sendCORSHeaders(server);
-    if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
+void Web::handleController(WebRequest &req) {
+  WebServer &server = req.server;
+  settings.printAvailHeap();
+  JsonResponse resp;
+  resp.beginResponse(&server, g_content, sizeof(g_content));
+  resp.beginObject();
+  resp.addElem("maxRooms", (uint8_t)SOMFY_MAX_ROOMS);
+  resp.addElem("maxShades", (uint8_t)SOMFY_MAX_SHADES);
+  resp.addElem("maxGroups", (uint8_t)SOMFY_MAX_GROUPS);
+  resp.addElem("maxGroupedShades", (uint8_t)SOMFY_MAX_GROUPED_SHADES);
+  resp.addElem("maxLinkedRemotes", (uint8_t)SOMFY_MAX_LINKED_REMOTES);
+  resp.addElem("startingAddress", (uint32_t)somfy.startingAddress);
+  resp.beginObject("transceiver");
+  somfy.transceiver.toJSON(resp);
+  resp.endObject();
+  resp.beginObject("version");
+  git.toJSON(resp);
+  resp.endObject();
+  resp.beginArray("rooms");
+  somfy.toJSONRooms(resp);
+  resp.endArray();
+  resp.beginArray("shades");
+  somfy.toJSONShades(resp);
+  resp.endArray();
+  resp.beginArray("groups");
+  somfy.toJSONGroups(resp);
+  resp.endArray();
+  resp.beginArray("repeaters");
+  somfy.toJSONRepeaters(resp);
+  resp.endArray();
+  resp.beginObject("rollingCodes");
+  somfy.rollingCodeStats.toJSON(resp);
+  resp.endObject();
+  resp.endObject();
+  resp.endResponse();
+}
+void Web::handleBootProfile(WebRequest &req) {
+  JsonResponse resp;
+  resp.beginResponse(&req.server, g_content, sizeof(g_content));
+  resp.beginObject();
+  boot.toJSON(resp);
+  resp.endObject();
+  resp.endResponse();
+}
+void Web::handleMetrics(WebRequest &req) {
+  StreamResponse resp;
+  resp.beginResponse(&req.server, "text/plain; version=0.0.4", g_content, sizeof(g_content));
+  metrics.writeHistograms(resp);
+  Metrics::writeCounter(resp, "espsomfy_rf_frames_received_total", "Frames received by the radio.", somfy.transceiver.stats.received);
+  Metrics::writeCounter(resp, "espsomfy_rf_frames_invalid_total", "Received frames that failed to decode.", somfy.transceiver.stats.invalid);
+  Metrics::writeCounter(resp, "espsomfy_rf_frames_dropped_total", "Received frames lost to a full receive queue.", somfy.transceiver.stats.dropped());
+  Metrics::writeCounter(resp, "espsomfy_rf_frames_sent_total", "Frames sent by the radio including repeats.", somfy.transceiver.stats.sent);
+  Metrics::writeCounter(resp, "espsomfy_web_commands_queued_total", "Http commands queued for the radio.", this->commandsQueued);
+  Metrics::writeCounter(resp, "espsomfy_web_commands_dropped_total", "Http commands refused because the queue was full.", this->commandsDropped);
+  Metrics::writeCounter(resp, "espsomfy_rolling_code_writes_total", "NVS writes made to reserve rolling codes.", somfy.rollingCodeStats.writes);
+  Metrics::writeCounter(resp, "espsomfy_metrics_series_dropped_total", "Observations lost because the series table was full.", metrics.seriesDropped);
+  Metrics::writeGauge(resp, "espsomfy_uptime_seconds", "Seconds since boot.", millis() / 1000);
+  Metrics::writeCounter(resp, "espsomfy_http_token_cache_hits_total", "Api keys checked against a cached token.", this->tokenHits);
+  Metrics::writeCounter(resp, "espsomfy_http_token_cache_misses_total", "Api tokens that had to be hashed.", this->tokenMisses);
+  Metrics::writeCounter(resp, "espsomfy_http_keepalive_reused_total", "Api requests served on a persistent connection.", apiServer.reused);
+  Metrics::writeGauge(resp, "espsomfy_http_keepalive_connections", "Idle persistent api connections.", apiServer.parkedCount());
+  Metrics::writeCounter(resp, "espsomfy_http_arena_hits_total", "Request bodies parsed in the static arena.", WebArenaAllocator::hits);
+  Metrics::writeCounter(resp, "espsomfy_http_arena_misses_total", "Request bodies that fell back to the heap.", WebArenaAllocator::misses);
+  sockEmit.writeMetrics(resp);
+  telnet.writeMetrics(resp);
+  HeapTracker::writeMetrics(resp);
+  resp.endResponse();
+}
+void Web::handleLoginContext(WebRequest &req) {
     JsonResponse resp;
-    resp.beginResponse(&server, g_content, sizeof(g_content));
+    resp.beginResponse(&req.server, g_content, sizeof(g_content));
     resp.beginObject();
     resp.addElem("type", static_cast<uint8_t>(settings.Security.type));
     resp.addElem("permissions", settings.Security.permissions);
@@ -286,336 +863,197 @@ void Web::handleLoginContext(WebServer &server) {
     resp.endObject();
     resp.endResponse();
 }
-void Web::handleGetRepeaters(WebServer &server) {
-    webServer.sendCORSHeaders(server);
-    if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    HTTPMethod method = server.method();
-    if (method == HTTP_POST || method == HTTP_GET) {
-      JsonResponse resp;
-      resp.beginResponse(&server, g_content, sizeof(g_content));
-      resp.beginArray();
-      somfy.toJSONRepeaters(resp);
-      resp.endArray();
-      resp.endResponse();
-    }
-    else server.send(404, _encoding_text, _response_404);
+void Web::handleGetRepeaters(WebRequest &req) {
+    JsonResponse resp;
+    resp.beginResponse(&req.server, g_content, sizeof(g_content));
+    resp.beginArray();
+    somfy.toJSONRepeaters(resp);
+    resp.endArray();
+    resp.endResponse();
 }
-void Web::handleGetRooms(WebServer &server) {
-    webServer.sendCORSHeaders(server);
-    if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    HTTPMethod method = server.method();
-    if (method == HTTP_POST || method == HTTP_GET) {
-      JsonResponse resp;
-      resp.beginResponse(&server, g_content, sizeof(g_content));
-      resp.beginArray();
-      somfy.toJSONRooms(resp);
-      resp.endArray();
-      resp.endResponse();
-    }
-    else server.send(404, _encoding_text, _response_404);
+void Web::handleGetRooms(WebRequest &req) {
+    JsonResponse resp;
+    resp.beginResponse(&req.server, g_content, sizeof(g_content));
+    resp.beginArray();
+    somfy.toJSONRooms(resp);
+    resp.endArray();
+    resp.endResponse();
 }
-void Web::handleGetShades(WebServer &server) {
-    webServer.sendCORSHeaders(server);
-    if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    HTTPMethod method = server.method();
-    if (method == HTTP_POST || method == HTTP_GET) {
-      JsonResponse resp;
-      resp.beginResponse(&server, g_content, sizeof(g_content));
-      resp.beginArray();
-      somfy.toJSONShades(resp);
-      resp.endArray();
-      resp.endResponse();
-    }
-    else server.send(404, _encoding_text, _response_404);
+void Web::handleGetShades(WebRequest &req) {
+    JsonResponse resp;
+    resp.beginResponse(&req.server, g_content, sizeof(g_content));
+    resp.beginArray();
+    somfy.toJSONShades(resp);
+    resp.endArray();
+    resp.endResponse();
 }
-void Web::handleGetGroups(WebServer &server) {
-    webServer.sendCORSHeaders(server);
-    if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    HTTPMethod method = server.method();
-    if (method == HTTP_POST || method == HTTP_GET) {
-      JsonResponse resp;
-      resp.beginResponse(&server, g_content, sizeof(g_content));
-      resp.beginArray();
-      somfy.toJSONGroups(resp);
-      resp.endArray();
-      resp.endResponse();
-    }
-    else server.send(404, _encoding_text, _response_404);
+void Web::handleGetGroups(WebRequest &req) {
+    JsonResponse resp;
+    resp.beginResponse(&req.server, g_content, sizeof(g_content));
+    resp.beginArray();
+    somfy.toJSONGroups(resp);
+    resp.endArray();
+    resp.endResponse();
 }
-void Web::handleShadeCommand(WebServer& server) {
-  webServer.sendCORSHeaders(server);
-  if (server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  HTTPMethod method = server.method();
-  uint8_t shadeId = 255;
+void Web::handleShadeCommand(WebRequest &req) {
+  WebServer &server = req.server;
+  if(!req.hasArg("shadeId")) {
+    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No shade id was supplied.\"}"));
+    return;
+  }
+  uint8_t shadeId = req.argInt("shadeId", 255);
   uint8_t target = 255;
-  uint8_t stepSize = 0;
-  int8_t repeat = -1;
   somfy_commands command = somfy_commands::My;
-  if (method == HTTP_GET || method == HTTP_PUT || method == HTTP_POST) {
-    if (server.hasArg("shadeId")) {
-      shadeId = atoi(server.arg("shadeId").c_str());
-      if (server.hasArg("command")) command = translateSomfyCommand(server.arg("command"));
-      else if (server.hasArg("target")) target = atoi(server.arg("target").c_str());
-      if (server.hasArg("repeat")) repeat = atoi(server.arg("repeat").c_str());
-      if(server.hasArg("stepSize")) stepSize = atoi(server.arg("stepSize").c_str());
-    }
-    else if (server.hasArg("plain")) {
-      Serial.println("Sending Shade Command");
-      DynamicJsonDocument doc(512);
-      DeserializationError err = deserializeJson(doc, server.arg("plain"));
-      if (err) {
-        this->handleDeserializationError(server, err);
-        return;
-      }
-      else {
-        JsonObject obj = doc.as<JsonObject>();
-        if (obj.containsKey("shadeId")) shadeId = obj["shadeId"];
-        else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No shade id was supplied.\"}"));
-        if (obj.containsKey("command")) {
-            String scmd = obj["command"];
-            command = translateSomfyCommand(scmd);
-        }
-        else if (obj.containsKey("target")) {
-            target = obj["target"].as<uint8_t>();
-        }
-        if (obj.containsKey("repeat")) repeat = obj["repeat"].as<uint8_t>();
-        if(obj.containsKey("stepSize")) stepSize = obj["stepSize"].as<uint8_t>();
-      }
+  if(req.hasArg("command")) command = translateSomfyCommand(req.argStr("command"));
+  else if(req.hasArg("target")) target = req.argInt("target", 255);
+  SomfyShade* shade = somfy.getShadeById(shadeId);
+  if (shade) {
+    // Send the command to the shade.
+    web_command_t cmd;
+    cmd.type = target <= 100 ? web_cmd_types_t::shadeTarget : web_cmd_types_t::shade;
+    cmd.id = shadeId;
+    cmd.command = command;
+    cmd.target = target;
+    cmd.repeat = req.argInt("repeat", -1);
+    cmd.stepSize = req.argInt("stepSize", 0);
+    if(!this->queueCommand(cmd)) {
+      server.send(503, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Command queue is full.\"}"));
+      return;
     }
-    else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No shade object supplied.\"}"));
-    SomfyShade* shade = somfy.getShadeById(shadeId);
-    if (shade) {
-      Serial.print("Received:");
-      Serial.println(server.arg("plain"));
-      // Send the command to the shade.
-      if (target <= 100)
-          shade->moveToTarget(shade->transformPosition(target));
-      else
-          shade->sendCommand(command, repeat > 0 ? repeat : shade->repeats, stepSize);
-      JsonResponse resp;
-      resp.beginResponse(&server, g_content, sizeof(g_content));
-      resp.beginObject();
-      shade->toJSONRef(resp);
-      resp.endObject();
-      resp.endResponse();
+    JsonResponse resp;
+    resp.beginResponse(&server, g_content, sizeof(g_content));
+    resp.beginObject();
+    shade->toJSONRef(resp);
+    resp.endObject();
+    resp.endResponse();
+  }
+  else {
+    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Shade with the specified id not found.\"}"));
+  }
+}
+void Web::handleRepeatCommand(WebRequest &req) {
+  WebServer &server = req.server;
+  uint8_t shadeId = req.argInt("shadeId", 255);
+  uint8_t groupId = shadeId == 255 ? req.argInt("groupId", 255) : 255;
+  somfy_commands command = somfy_commands::My;
+  if(req.hasArg("command")) command = translateSomfyCommand(req.argStr("command"));
+  web_command_t cmd;
+  cmd.command = command;
+  cmd.repeat = req.argInt("repeat", -1);
+  cmd.stepSize = req.argInt("stepSize", 0);
+  if(shadeId != 255) {
+    SomfyShade *shade = somfy.getShadeById(shadeId);
+    if(!shade) {
+      server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Shade reference could not be found.\"}"));
+      return;        
+    }
+    cmd.type = web_cmd_types_t::shadeRepeat;
+    cmd.id = shadeId;
+    if(!this->queueCommand(cmd)) {
+      server.send(503, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Command queue is full.\"}"));
+      return;
     }
-    else {
-        server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Shade with the specified id not found.\"}"));
+    JsonResponse resp;
+    resp.beginResponse(&server, g_content, sizeof(g_content));
+    resp.beginArray();
+    shade->toJSONRef(resp);
+    resp.endArray();
+    resp.endResponse();
+  }
+  else if(groupId != 255) {
+    SomfyGroup * group = somfy.getGroupById(groupId);
+    if(!group) {
+      server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Group reference could not be found.\"}"));
+      return;        
+    }
+    cmd.type = web_cmd_types_t::groupRepeat;
+    cmd.id = groupId;
+    if(!this->queueCommand(cmd)) {
+      server.send(503, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Command queue is full.\"}"));
+      return;
     }
+    JsonResponse resp;
+    resp.beginResponse(&server, g_content, sizeof(g_content));
+    resp.beginObject();
+    group->toJSONRef(resp);
+    resp.endObject();
+    resp.endResponse();
   }
   else
-    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Invalid Http method\"}"));
+    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No shade or group id was supplied.\"}"));
 }
-void Web::handleRepeatCommand(WebServer& server) {
-  webServer.sendCORSHeaders(server);
-  HTTPMethod method = server.method();
-  if (method == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  uint8_t shadeId = 255;
-  uint8_t groupId = 255;
-  uint8_t stepSize = 0;
-  int8_t repeat = -1;
+void Web::handleGroupCommand(WebRequest &req) {
+  WebServer &server = req.server;
+  if(!req.hasArg("groupId")) {
+    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No group id was supplied.\"}"));
+    return;
+  }
+  uint8_t groupId = req.argInt("groupId", 255);
   somfy_commands command = somfy_commands::My;
-  if (method == HTTP_GET || method == HTTP_PUT || method == HTTP_POST) {
-    if(server.hasArg("shadeId")) shadeId = atoi(server.arg("shadeId").c_str());
-    else if(server.hasArg("groupId")) groupId = atoi(server.arg("groupId").c_str());
-    if(server.hasArg("command")) command = translateSomfyCommand(server.arg("command"));
-    if(server.hasArg("repeat")) repeat = atoi(server.arg("repeat").c_str());
-    if(server.hasArg("stepSize")) stepSize = atoi(server.arg("stepSize").c_str());
-    if(shadeId == 255 && groupId == 255 && server.hasArg("plain")) {
-      DynamicJsonDocument doc(512);
-      DeserializationError err = deserializeJson(doc, server.arg("plain"));
-      if (err) {
-        this->handleDeserializationError(server, err);
-        return;
-      }
-      else {
-        JsonObject obj = doc.as<JsonObject>();
-        if (obj.containsKey("shadeId")) shadeId = obj["shadeId"];
-        if(obj.containsKey("groupId")) groupId = obj["groupId"];
-        if(obj.containsKey("stepSize")) stepSize = obj["stepSize"];
-        if (obj.containsKey("command")) {
-            String scmd = obj["command"];
-            command = translateSomfyCommand(scmd);
-        }
-        if (obj.containsKey("repeat")) repeat = obj["repeat"].as<uint8_t>();
-      }
-    }
-    //DynamicJsonDocument sdoc(512);
-    //JsonObject sobj = sdoc.to<JsonObject>();
-    if(shadeId != 255) {
-      SomfyShade *shade = somfy.getShadeById(shadeId);
-      if(!shade) {
-        server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Shade reference could not be found.\"}"));
-        return;        
-      }
-      if(shade->shadeType == shade_types::garage1 && command == somfy_commands::Prog) command = somfy_commands::Toggle;
-      if(!shade->isLastCommand(command)) {
-        // We are going to send this as a new command.
-        shade->sendCommand(command, repeat >= 0 ? repeat : shade->repeats, stepSize);
-      }
-      else {
-        shade->repeatFrame(repeat >= 0 ? repeat : shade->repeats);
-      }
-      JsonResponse resp;
-      resp.beginResponse(&server, g_content, sizeof(g_content));
-      resp.beginArray();
-      shade->toJSONRef(resp);
-      resp.endArray();
-      resp.endResponse();
-    }
-    else if(groupId != 255) {
-      SomfyGroup * group = somfy.getGroupById(groupId);
-      if(!group) {
-        server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Group reference could not be found.\"}"));
-        return;        
-      }
-      if(!group->isLastCommand(command)) {
-        // We are going to send this as a new command.
-        group->sendCommand(command, repeat >= 0 ? repeat : group->repeats, stepSize);
-      }
-      else
-        group->repeatFrame(repeat >= 0 ? repeat : group->repeats);
-      JsonResponse resp;
-      resp.beginResponse(&server, g_content, sizeof(g_content));
-      resp.beginObject();
-      group->toJSONRef(resp);
-      resp.endObject();
-      resp.endResponse();
-        
-      //group->toJSON(sobj);
-      //serializeJson(sdoc, g_content);
-      //server.send(200, _encoding_json, g_content);
+  if(req.hasArg("command")) command = translateSomfyCommand(req.argStr("command"));
+  SomfyGroup * group = somfy.getGroupById(groupId);
+  if (group) {
+    // Send the command to the group.
+    web_command_t cmd;
+    cmd.type = web_cmd_types_t::group;
+    cmd.id = groupId;
+    cmd.command = command;
+    cmd.repeat = req.argInt("repeat", -1);
+    cmd.stepSize = req.argInt("stepSize", 0);
+    if(!this->queueCommand(cmd)) {
+      server.send(503, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Command queue is full.\"}"));
+      return;
     }
+    JsonResponse resp;
+    resp.beginResponse(&server, g_content, sizeof(g_content));
+    resp.beginObject();
+    group->toJSONRef(resp);
+    resp.endObject();
+    resp.endResponse();
   }
   else {
-    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Invalid Http method\"}"));
+    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Group with the specified id not found.\"}"));
   }
 }
-void Web::handleGroupCommand(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  HTTPMethod method = server.method();
-  uint8_t groupId = 255;
-  uint8_t stepSize = 0;
-  int8_t repeat = -1;
-  somfy_commands command = somfy_commands::My;
-  if (method == HTTP_GET || method == HTTP_PUT || method == HTTP_POST) {
-    if (server.hasArg("groupId")) {
-      groupId = atoi(server.arg("groupId").c_str());
-      if (server.hasArg("command")) command = translateSomfyCommand(server.arg("command"));
-      if(server.hasArg("repeat")) repeat = atoi(server.arg("repeat").c_str());
-      if(server.hasArg("stepSize")) stepSize = atoi(server.arg("stepSize").c_str());
-    }
-    else if (server.hasArg("plain")) {
-      Serial.println("Sending Group Command");
-      DynamicJsonDocument doc(256);
-      DeserializationError err = deserializeJson(doc, server.arg("plain"));
-      if (err) {
-        this->handleDeserializationError(server, err);
-        return;
-      }
-      else {
-        JsonObject obj = doc.as<JsonObject>();
-        if (obj.containsKey("groupId")) groupId = obj["groupId"];
-        else {
-          server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No group id was supplied.\"}"));
-          return;
-        }
-        if (obj.containsKey("command")) {
-          String scmd = obj["command"];
-          command = translateSomfyCommand(scmd);
-        }
-        if(obj.containsKey("repeat")) repeat = obj["repeat"].as<uint8_t>();
-        if(obj.containsKey("stepSize")) stepSize = obj["stepSize"].as<uint8_t>();
-      }
-    }
-    else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No group object supplied.\"}"));
-    SomfyGroup * group = somfy.getGroupById(groupId);
-    if (group) {
-      Serial.print("Received:");
-      Serial.println(server.arg("plain"));
-      // Send the command to the group.
-      group->sendCommand(command, repeat >= 0 ? repeat : group->repeats, stepSize);
-      JsonResponse resp;
-      resp.beginResponse(&server, g_content, sizeof(g_content));
-      resp.beginObject();
-      group->toJSONRef(resp);
-      resp.endObject();
-      resp.endResponse();
-    }
-    else {
-      server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Group with the specified id not found.\"}"));
-    }
+void Web::handleTiltCommand(WebRequest &req) {
+  WebServer &server = req.server;
+  if(!req.hasArg("shadeId")) {
+    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No shade id was supplied.\"}"));
+    return;
   }
-  else
-    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Invalid Http method\"}"));
-}
-void Web::handleTiltCommand(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  HTTPMethod method = server.method();
-  uint8_t shadeId = 255;
+  uint8_t shadeId = req.argInt("shadeId", 255);
   uint8_t target = 255;
   somfy_commands command = somfy_commands::My;
-  if (method == HTTP_GET || method == HTTP_PUT || method == HTTP_POST) {
-    if (server.hasArg("shadeId")) {
-      shadeId = atoi(server.arg("shadeId").c_str());
-      if (server.hasArg("command")) command = translateSomfyCommand(server.arg("command"));
-      else if(server.hasArg("target")) target = atoi(server.arg("target").c_str());
-    }
-    else if (server.hasArg("plain")) {
-      Serial.println("Sending Shade Tilt Command");
-      DynamicJsonDocument doc(256);
-      DeserializationError err = deserializeJson(doc, server.arg("plain"));
-      if (err) {
-        this->handleDeserializationError(server, err);
-        return;
-      }
-      else {
-        JsonObject obj = doc.as<JsonObject>();
-        if (obj.containsKey("shadeId")) shadeId = obj["shadeId"];
-        else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No shade id was supplied.\"}"));
-        if (obj.containsKey("command")) {
-          String scmd = obj["command"];
-          command = translateSomfyCommand(scmd);
-        }
-        else if(obj.containsKey("target")) {
-          target = obj["target"].as<uint8_t>();
-        }
-      }
-    }
-    else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No shade object supplied.\"}"));
-    SomfyShade* shade = somfy.getShadeById(shadeId);
-    if (shade) {
-      Serial.print("Received:");
-      Serial.println(server.arg("plain"));
-      // Send the command to the shade.
-      if(target <= 100)
-        shade->moveToTiltTarget(shade->transformPosition(target));
-      else
-        shade->sendTiltCommand(command);
-      JsonResponse resp;
-      resp.beginResponse(&server, g_content, sizeof(g_content));
-      resp.beginObject();
-      shade->toJSONRef(resp);
-      resp.endObject();
-      resp.endResponse();
+  if(req.hasArg("command")) command = translateSomfyCommand(req.argStr("command"));
+  else if(req.hasArg("target")) target = req.argInt("target", 255);
+  SomfyShade* shade = somfy.getShadeById(shadeId);
+  if (shade) {
+    // Send the command to the shade.
+    web_command_t cmd;
+    cmd.type = target <= 100 ? web_cmd_types_t::tiltTarget : web_cmd_types_t::tilt;
+    cmd.id = shadeId;
+    cmd.command = command;
+    cmd.target = target;
+    if(!this->queueCommand(cmd)) {
+      server.send(503, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Command queue is full.\"}"));
+      return;
     }
-    else {
-      server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Shade with the specified id not found.\"}"));
-    }  
+    JsonResponse resp;
+    resp.beginResponse(&server, g_content, sizeof(g_content));
+    resp.beginObject();
+    shade->toJSONRef(resp);
+    resp.endObject();
+    resp.endResponse();
   }
-  else
-    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Invalid Http method\"}"));
+  else {
+    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Shade with the specified id not found.\"}"));
+  }  
 }
-void Web::handleRoom(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  HTTPMethod method = server.method();
-  if (method == HTTP_GET) {
-    if (server.hasArg("roomId")) {
-      int roomId = atoi(server.arg("roomId").c_str());
-      SomfyRoom* room = somfy.getRoomById(roomId);
+void Web::handleRoom(WebRequest &req) {
+  WebServer &server = req.server;
+  if (req.method == HTTP_GET) {
+    if (req.hasArg("roomId")) {
+      SomfyRoom* room = somfy.getRoomById(req.argInt("roomId", 255));
       if (room) {
         JsonResponse resp;
         resp.beginResponse(&server, g_content, sizeof(g_content));
@@ -630,54 +1068,38 @@ void Web::handleRoom(WebServer &server) {
       server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"You must supply a valid room id.\"}"));
     }
   }
-  else if (method == HTTP_PUT || method == HTTP_POST) {
+  else if (req.hasBody()) {
     // We are updating an existing room.
-    if (server.hasArg("plain")) {
-      Serial.println("Updating a room");
-      DynamicJsonDocument doc(512);
-      DeserializationError err = deserializeJson(doc, server.arg("plain"));
-      if (err) {
-        this->handleDeserializationError(server, err);
-        return;
-      }
-      else {
-        JsonObject obj = doc.as<JsonObject>();
-        if (obj.containsKey("roomId")) {
-          SomfyRoom* room = somfy.getRoomById(obj["roomId"]);
-          if (room) {
-            uint8_t err = room->fromJSON(obj);
-            if(err == 0) {
-              room->save();
-              JsonResponse resp;
-              resp.beginResponse(&server, g_content, sizeof(g_content));
-              resp.beginObject();
-              room->toJSON(resp);
-              resp.endObject();
-              resp.endResponse();
-            }
-            else {
-              snprintf(g_content, sizeof(g_content), "{\"status\":\"DATA\",\"desc\":\"Data Error.\", \"code\":%d}", err);
-              server.send(500, _encoding_json, g_content);
-            }
-          }
-          else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Room Id not found.\"}"));
+    Serial.println("Updating a room");
+    if (req.body.containsKey("roomId")) {
+      SomfyRoom* room = somfy.getRoomById(req.body["roomId"]);
+      if (room) {
+        uint8_t err = room->fromJSON(req.body);
+        if(err == 0) {
+          room->save();
+          JsonResponse resp;
+          resp.beginResponse(&server, g_content, sizeof(g_content));
+          resp.beginObject();
+          room->toJSON(resp);
+          resp.endObject();
+          resp.endResponse();
+        }
+        else {
+          snprintf(g_content, sizeof(g_content), "{\"status\":\"DATA\",\"desc\":\"Data Error.\", \"code\":%d}", err);
+          server.send(500, _encoding_json, g_content);
         }
-        else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No room id was supplied.\"}"));
       }
+      else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Room Id not found.\"}"));
     }
-    else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No room object supplied.\"}"));
+    else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No room id was supplied.\"}"));
   }
-  else
-    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Invalid Http method\"}"));
+  else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No room object supplied.\"}"));
 }
-void Web::handleShade(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  HTTPMethod method = server.method();
-  if (method == HTTP_GET) {
-    if (server.hasArg("shadeId")) {
-      int shadeId = atoi(server.arg("shadeId").c_str());
-      SomfyShade* shade = somfy.getShadeById(shadeId);
+void Web::handleShade(WebRequest &req) {
+  WebServer &server = req.server;
+  if (req.method == HTTP_GET) {
+    if (req.hasArg("shadeId")) {
+      SomfyShade* shade = somfy.getShadeById(req.argInt("shadeId", 255));
       if (shade) {
         JsonResponse resp;
         resp.beginResponse(&server, g_content, sizeof(g_content));
@@ -692,54 +1114,38 @@ void Web::handleShade(WebServer &server) {
       server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"You must supply a valid shade id.\"}"));
     }
   }
-  else if (method == HTTP_PUT || method == HTTP_POST) {
+  else if (req.hasBody()) {
     // We are updating an existing shade.
-    if (server.hasArg("plain")) {
-      Serial.println("Updating a shade");
-      DynamicJsonDocument doc(512);
-      DeserializationError err = deserializeJson(doc, server.arg("plain"));
-      if (err) {
-        this->handleDeserializationError(server, err);
-        return;
-      }
-      else {
-        JsonObject obj = doc.as<JsonObject>();
-        if (obj.containsKey("shadeId")) {
-          SomfyShade* shade = somfy.getShadeById(obj["shadeId"]);
-          if (shade) {
-            uint8_t err = shade->fromJSON(obj);
-            if(err == 0) {
-              shade->save();
-              JsonResponse resp;
-              resp.beginResponse(&server, g_content, sizeof(g_content));
-              resp.beginObject();
-              shade->toJSON(resp);
-              resp.endObject();
-              resp.endResponse();
-            }
-            else {
-              snprintf(g_content, sizeof(g_content), "{\"status\":\"DATA\",\"desc\":\"Data Error.\", \"code\":%d}", err);
-              server.send(500, _encoding_json, g_content);
-            }
-          }
-          else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Shade Id not found.\"}"));
+    Serial.println("Updating a shade");
+    if (req.body.containsKey("shadeId")) {
+      SomfyShade* shade = somfy.getShadeById(req.body["shadeId"]);
+      if (shade) {
+        uint8_t err = shade->fromJSON(req.body);
+        if(err == 0) {
+          shade->save();
+          JsonResponse resp;
+          resp.beginResponse(&server, g_content, sizeof(g_content));
+          resp.beginObject();
+          shade->toJSON(resp);
+          resp.endObject();
+          resp.endResponse();
+        }
+        else {
+          snprintf(g_content, sizeof(g_content), "{\"status\":\"DATA\",\"desc\":\"Data Error.\", \"code\":%d}", err);
+          server.send(500, _encoding_json, g_content);
         }
-        else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No shade id was supplied.\"}"));
       }
+      else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Shade Id not found.\"}"));
     }
-    else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No shade object supplied.\"}"));
+    else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No shade id was supplied.\"}"));
   }
-  else
-    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Invalid Http method\"}"));
+  else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No shade object supplied.\"}"));
 }
-void Web::handleGroup(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  HTTPMethod method = server.method();
-  if (method == HTTP_GET) {
-    if (server.hasArg("groupId")) {
-      int groupId = atoi(server.arg("groupId").c_str());
-      SomfyGroup* group = somfy.getGroupById(groupId);
+void Web::handleGroup(WebRequest &req) {
+  WebServer &server = req.server;
+  if (req.method == HTTP_GET) {
+    if (req.hasArg("groupId")) {
+      SomfyGroup* group = somfy.getGroupById(req.argInt("groupId", 255));
       if (group) {
         JsonResponse resp;
         resp.beginResponse(&server, g_content, sizeof(g_content));
@@ -754,86 +1160,71 @@ void Web::handleGroup(WebServer &server) {
       server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"You must supply a valid shade id.\"}"));
     }
   }
-  else if (method == HTTP_PUT || method == HTTP_POST) {
+  else if (req.hasBody()) {
     // We are updating an existing group.
-    if (server.hasArg("plain")) {
-      Serial.println("Updating a group");
-      DynamicJsonDocument doc(512);
-      DeserializationError err = deserializeJson(doc, server.arg("plain"));
-      if (err) {
-        this->handleDeserializationError(server, err);
-        return;
-      }
-      else {
-        JsonObject obj = doc.as<JsonObject>();
-        if (obj.containsKey("groupId")) {
-          SomfyGroup* group = somfy.getGroupById(obj["groupId"]);
-          if (group) {
-            group->fromJSON(obj);
-            group->save();
-            JsonResponse resp;
-            resp.beginResponse(&server, g_content, sizeof(g_content));
-            resp.beginObject();
-            group->toJSON(resp);
-            resp.endObject();
-            resp.endResponse();
-          }
-          else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Group Id not found.\"}"));
-        }
-        else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No group id was supplied.\"}"));
+    Serial.println("Updating a group");
+    if (req.body.containsKey("groupId")) {
+      SomfyGroup* group = somfy.getGroupById(req.body["groupId"]);
+      if (group) {
+        group->fromJSON(req.body);
+        group->save();
+        JsonResponse resp;
+        resp.beginResponse(&server, g_content, sizeof(g_content));
+        resp.beginObject();
+        group->toJSON(resp);
+        resp.endObject();
+        resp.endResponse();
       }
+      else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Group Id not found.\"}"));
     }
-    else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No group object supplied.\"}"));
+    else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No group id was supplied.\"}"));
   }
-  else
-    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Invalid Http method\"}"));
-}
-void Web::handleDiscovery(WebServer &server) {
-  HTTPMethod method = apiServer.method();
-  if (method == HTTP_POST || method == HTTP_GET) {
-    Serial.println("Discovery Requested");
-    char connType[10] = "Unknown";
-    if(net.connType == conn_types_t::ethernet) strcpy(connType, "Ethernet");
-    else if(net.connType == conn_types_t::wifi) strcpy(connType, "Wifi");
+  else server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No group object supplied.\"}"));
+}
+void Web::handleDiscovery(WebRequest &req) {
+  Serial.println("Discovery Requested");
+  char connType[10] = "Unknown";
+  if(net.connType == conn_types_t::ethernet) strcpy(connType, "Ethernet");
+  else if(net.connType == conn_types_t::wifi) strcpy(connType, "Wifi");
 
-    JsonResponse resp;
-    resp.beginResponse(&server, g_content, sizeof(g_content));
-    resp.beginObject();
-    resp.addElem("serverId", settings.serverId);
-    resp.addElem("version", settings.fwVersion.name);
-    resp.addElem("latest", git.latest.name);
-    resp.addElem("model", "ESPSomfyRTS");
-    resp.addElem("hostname", settings.hostname);
-    resp.addElem("authType", static_cast<uint8_t>(settings.Security.type));
-    resp.addElem("permissions", settings.Security.permissions);
-    resp.addElem("chipModel", settings.chipModel);
-    resp.addElem("connType", connType);
-    resp.addElem("checkForUpdate", settings.checkForUpdate);
-    resp.beginObject("memory");
-    resp.addElem("max", ESP.getMaxAllocHeap());
-    resp.addElem("free", ESP.getFreeHeap());
-    resp.addElem("min", ESP.getMinFreeHeap());
-    resp.addElem("total", ESP.getHeapSize());
-    resp.endObject();
-    resp.beginArray("rooms");
-    somfy.toJSONRooms(resp);
-    resp.endArray();
-    resp.beginArray("shades");
-    somfy.toJSONShades(resp);
-    resp.endArray();
-    resp.beginArray("groups");
-    somfy.toJSONGroups(resp);
-    resp.endArray();
-    resp.endObject();
-    resp.endResponse();
-    net.needsBroadcast = true;
-  }
-  else
-    server.send(500, _encoding_text, "Invalid http method");
+  JsonResponse resp;
+  resp.beginResponse(&req.server, g_content, sizeof(g_content));
+  resp.beginObject();
+  resp.addElem("serverId", settings.serverId);
+  resp.addElem("version", settings.fwVersion.name);
+  resp.addElem("latest", git.latest.name);
+  resp.addElem("model", "ESPSomfyRTS");
+  resp.addElem("hostname", settings.hostname);
+  resp.addElem("authType", static_cast<uint8_t>(settings.Security.type));
+  resp.addElem("permissions", settings.Security.permissions);
+  resp.addElem("chipModel", settings.chipModel);
+  resp.addElem("connType", connType);
+  resp.addElem("checkForUpdate", settings.checkForUpdate);
+  resp.beginObject("memory");
+  resp.addElem("max", ESP.getMaxAllocHeap());
+  resp.addElem("free", ESP.getFreeHeap());
+  resp.addElem("min", ESP.getMinFreeHeap());
+  resp.addElem("total", ESP.getHeapSize());
+  resp.endObject();
+  resp.beginArray("rooms");
+  somfy.toJSONRooms(resp);
+  resp.endArray();
+  resp.beginArray("shades");
+  somfy.toJSONShades(resp);
+  resp.endArray();
+  resp.beginArray("groups");
+  somfy.toJSONGroups(resp);
+  resp.endArray();
+  resp.endObject();
+  resp.endResponse();
+  net.needsBroadcast = true;
 }
-void Web::handleBackup(WebServer &server, bool attach) {
-  webServer.sendCORSHeaders(server);
-  if(server.hasArg("attach")) attach = toBoolean(server.arg("attach").c_str(), attach);
+void Web::handleBackup(WebRequest &req) {
+  WebServer &server = req.server;
+  bool attach = req.argBool("attach", false);
+  uint32_t since = strtoul(req.arg("since", "0").c_str(), nullptr, 10);
+  bool deflate = req.argBool("deflate", false);
+  bool diff = since > 0 && since <= somfy.configRevision;
   if(attach) {
     char filename[120];
     Timestamp ts;
@@ -850,42 +1241,59 @@ void Web::handleBackup(WebServer &server, bool attach) {
           break;
       }
     }
-    snprintf(filename, sizeof(filename), "attachment; filename=\"ESPSomfyRTS %s.backup\"", iso);
+    snprintf(filename, sizeof(filename), "attachment; filename=\"ESPSomfyRTS %s.%s\"", iso, diff ? "diff" : "backup");
     Serial.println(filename);
     server.sendHeader(F("Content-Disposition"), filename);
-    server.sendHeader(F("Access-Control-Expose-Headers"), F("Content-Disposition"));
   }
-  Serial.println("Saving current shade information");
-  somfy.writeBackup();
-  File file = LittleFS.open("/controller.backup", "r");
-  if (!file) {
-    Serial.println("Error opening shades.cfg");
-    server.send(500, _encoding_text, "shades.cfg");
-    return;
+  char rev[12];
+  snprintf(rev, sizeof(rev), "%u", somfy.configRevision);
+  server.sendHeader(F("X-Config-Revision"), rev);
+  server.sendHeader(F("Access-Control-Expose-Headers"), F("Content-Disposition, X-Config-Revision"));
+  if(deflate) server.sendHeader(F("Content-Encoding"), F("deflate"));
+  Serial.printf("Streaming %s backup revision %u since %u\n", diff ? "diff" : "full", somfy.configRevision, since);
+  // The records are written straight from memory to the response so no
+  // temporary backup file is written to the file system.
+  esp_task_wdt_reset();
+  StreamResponse resp;
+  DeflateStream zip;
+  ShadeConfigFile file;
+  resp.beginResponse(&server, _encoding_text, g_content, sizeof(g_content));
+  if(deflate) {
+    zip.begin(&resp);
+    file.beginStream(&zip);
   }
-  server.streamFile(file, _encoding_text);
-  file.close();
+  else file.beginStream(&resp);
+  file.backup(&somfy, since);
+  file.end();
+  if(deflate) zip.end();
+  resp.endResponse();
 }
-void Web::handleSetPositions(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  uint8_t shadeId = (server.hasArg("shadeId")) ? atoi(server.arg("shadeId").c_str()) : 255;
-  int8_t pos = (server.hasArg("position")) ? atoi(server.arg("position").c_str()) : -1;
-  int8_t tiltPos = (server.hasArg("tiltPosition")) ? atoi(server.arg("tiltPosition").c_str()) : -1;
-  if(server.hasArg("plain")) {
-    DynamicJsonDocument doc(512);
-    DeserializationError err = deserializeJson(doc, server.arg("plain"));
-    if (err) {
-      this->handleDeserializationError(server, err);
-      return;
-    }
-    else {
-      JsonObject obj = doc.as<JsonObject>();
-      if(obj.containsKey("shadeId")) shadeId = obj["shadeId"];
-      if(obj.containsKey("position")) pos = obj["position"];
-      if(obj.containsKey("tiltPosition")) tiltPos = obj["tiltPosition"];
-    }
+void Web::handleProvision(WebRequest &req) {
+  WebServer &server = req.server;
+  if(!req.hasBody()) {
+    server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"No provisioning document supplied.\"}"));
+    return;
+  }
+  provision_result_t result;
+  if(!somfy.provision(req.body, result)) {
+    snprintf(g_content, sizeof(g_content), "{\"status\":\"ERROR\",\"desc\":\"%s\"}", result.desc);
+    server.send(400, _encoding_json, g_content);
+    return;
   }
+  JsonResponse resp;
+  resp.beginResponse(&server, g_content, sizeof(g_content));
+  resp.beginObject();
+  resp.addElem("status", "OK");
+  resp.addElem("revision", somfy.configRevision);
+  result.toJSON(resp);
+  resp.endObject();
+  resp.endResponse();
+}
+void Web::handleSetPositions(WebRequest &req) {
+  WebServer &server = req.server;
+  uint8_t shadeId = req.argInt("shadeId", 255);
+  int8_t pos = req.argInt("position", -1);
+  int8_t tiltPos = req.argInt("tiltPosition", -1);
   if(shadeId != 255) {
     SomfyShade *shade = somfy.getShadeById(shadeId);
     if(shade) {
@@ -906,40 +1314,13 @@ void Web::handleSetPositions(WebServer &server) {
     server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"shadeId was not provided\"}"));
   }
 }
-void Web::handleSetSensor(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  uint8_t shadeId = (server.hasArg("shadeId")) ? atoi(server.arg("shadeId").c_str()) : 255;
-  uint8_t groupId = (server.hasArg("groupId")) ? atoi(server.arg("groupId").c_str()) : 255;
-  int8_t sunny = (server.hasArg("sunny")) ? toBoolean(server.arg("sunny").c_str(), false) ? 1 : 0 : -1;
-  int8_t windy = (server.hasArg("windy")) ? atoi(server.arg("windy").c_str()) : -1;
-  int8_t repeat = (server.hasArg("repeat")) ? atoi(server.arg("repeat").c_str()) : -1;
-  if(server.hasArg("plain")) {
-    DynamicJsonDocument doc(512);
-    DeserializationError err = deserializeJson(doc, server.arg("plain"));
-    if (err) {
-      this->handleDeserializationError(server, err);
-      return;
-    }
-    else {
-      JsonObject obj = doc.as<JsonObject>();
-      if(obj.containsKey("shadeId")) shadeId = obj["shadeId"].as<uint8_t>();
-      if(obj.containsKey("groupId")) groupId = obj["groupId"].as<uint8_t>();
-      if(obj.containsKey("sunny")) {
-        if(obj["sunny"].is<bool>())
-          sunny = obj["sunny"].as<bool>() ? 1 : 0;
-        else
-          sunny = obj["sunny"].as<int8_t>();
-      }
-      if(obj.containsKey("windy")) {
-        if(obj["windy"].is<bool>())
-          windy = obj["windy"].as<bool>() ? 1 : 0;
-        else
-          windy = obj["windy"].as<int8_t>();
-      }
-      if(obj.containsKey("repeat")) repeat = obj["repeat"].as<uint8_t>();
-    }
-  }
+void Web::handleSetSensor(WebRequest &req) {
+  WebServer &server = req.server;
+  uint8_t shadeId = req.argInt("shadeId", 255);
+  uint8_t groupId = req.argInt("groupId", 255);
+  int8_t sunny = req.hasArg("sunny") ? (req.argBool("sunny") ? 1 : 0) : -1;
+  int8_t windy = req.hasArg("windy") ? (req.argBool("windy") ? 1 : 0) : -1;
+  int8_t repeat = req.argInt("repeat", -1);
   if(shadeId != 255) {
     SomfyShade *shade = somfy.getShadeById(shadeId);
     if(shade) {
@@ -975,23 +1356,23 @@ void Web::handleSetSensor(WebServer &server) {
     server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"shadeId was not provided\"}"));
   }
 }
-void Web::handleDownloadFirmware(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
+void Web::handleDownloadFirmware(WebRequest &req) {
+  WebServer &server = req.server;
   GitRepo repo;
   GitRelease *rel = nullptr;
   int8_t err = repo.getReleases();
   Serial.println("downloadFirmware called...");
   if(err == 0) {
-    if(server.hasArg("ver")) {
-      if(strcmp(server.arg("ver").c_str(), "latest") == 0) rel = &repo.releases[0];
-      else if(strcmp(server.arg("ver").c_str(), "main") == 0) {
+    if(req.hasArg("ver")) {
+      String ver = req.arg("ver");
+      if(strcmp(ver.c_str(), "latest") == 0) rel = &repo.releases[0];
+      else if(strcmp(ver.c_str(), "main") == 0) {
         rel = &repo.releases[GIT_MAX_RELEASES];
       }
       else {
         for(uint8_t i = 0; i < GIT_MAX_RELEASES; i++) {
           if(repo.releases[i].id == 0) continue;
-          if(strcmp(repo.releases[i].name, server.arg("ver").c_str()) == 0) {
+          if(strcmp(repo.releases[i].name, ver.c_str()) == 0) {
             rel = &repo.releases[i];  
           }
         }
@@ -1043,73 +1424,54 @@ void Web::handleNotFound(WebServer &server) {
     snprintf(g_content, sizeof(g_content), "404 Service Not Found: %s", server.uri().c_str());
     server.send(404, _encoding_text, g_content);
 }
-void Web::handleReboot(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  HTTPMethod method = server.method();
-  if (method == HTTP_POST || method == HTTP_PUT) {
-    Serial.println("Rebooting ESP...");
-    rebootDelay.reboot = true;
-    rebootDelay.rebootTime = millis() + 500;
-    server.send(200, "application/json", "{\"status\":\"OK\",\"desc\":\"Successfully started reboot\"}");
-  }
-  else {
-    server.send(201, _encoding_json, "{\"status\":\"ERROR\",\"desc\":\"Invalid HTTP Method: \"}");
-  }
+void Web::handleReboot(WebRequest &req) {
+  Serial.println("Rebooting ESP...");
+  rebootDelay.reboot = true;
+  rebootDelay.rebootTime = millis() + 500;
+  req.server.send(200, "application/json", "{\"status\":\"OK\",\"desc\":\"Successfully started reboot\"}");
 }
-void Web::handleDinplugSettings(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  if(server.method() == HTTP_GET) {
-    DynamicJsonDocument doc(1024);
+void Web::handleDinplugSettings(WebRequest &req) {
+  WebServer &server = req.server;
+  if(req.method == HTTP_GET) {
+    WebJsonDocument doc(1024);
     JsonObject obj = doc.to<JsonObject>();
     dinplugBridge.toJSON(obj);
     serializeJson(doc, g_content);
     server.send(200, _encoding_json, g_content);
     return;
   }
-  if(server.method() != HTTP_POST && server.method() != HTTP_PUT) {
-    server.send(405, _encoding_json, "{\"status\":\"ERROR\",\"desc\":\"Invalid HTTP Method\"}");
-    return;
-  }
-  DynamicJsonDocument doc(512);
-  DeserializationError err = deserializeJson(doc, server.arg("plain"));
-  if(err) {
-    webServer.handleDeserializationError(server, err);
-    return;
-  }
-  JsonObject obj = doc.as<JsonObject>();
   String msg;
-  if(obj.containsKey("gatewayHost")) {
-    if(!dinplugBridge.setGatewayHost(obj["gatewayHost"] | "", msg)) {
+  if(req.hasArg("gatewayHost")) {
+    if(!dinplugBridge.setGatewayHost(req.arg("gatewayHost").c_str(), msg)) {
       server.send(400, _encoding_json, msg);
       return;
     }
   }
-  if(obj.containsKey("autoConnect")) dinplugBridge.setAutoConnect(obj["autoConnect"] | false, msg);
-  DynamicJsonDocument respDoc(1024);
+  if(req.hasArg("autoConnect")) dinplugBridge.setAutoConnect(req.argBool("autoConnect"), msg);
+  WebJsonDocument respDoc(1024);
   JsonObject resp = respDoc.to<JsonObject>();
   dinplugBridge.toJSON(resp);
   serializeJson(respDoc, g_content);
   server.send(200, _encoding_json, g_content);
 }
 
-void Web::handleDinplugMappings(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  if(server.method() == HTTP_GET) {
-    DynamicJsonDocument doc(8192);
-    JsonObject obj = doc.to<JsonObject>();
-    JsonArray arr = obj.createNestedArray("mappings");
-    dinplugBridge.mappingsToJSON(arr);
-    serializeJson(doc, g_content);
-    server.send(200, _encoding_json, g_content);
+void Web::handleDinplugMappings(WebRequest &req) {
+  WebServer &server = req.server;
+  if(req.method == HTTP_GET) {
+    JsonResponse resp;
+    resp.beginResponse(&server, g_content, sizeof(g_content));
+    resp.beginObject();
+    resp.beginArray("mappings");
+    dinplugBridge.mappingsToJSON(resp);
+    resp.endArray();
+    resp.endObject();
+    resp.endResponse();
     return;
   }
-  if(server.method() == HTTP_DELETE) {
-    String msg;
-    if(server.hasArg("index")) {
-      if(!dinplugBridge.removeMapping(static_cast<uint8_t>(server.arg("index").toInt()), msg)) {
+  String msg;
+  if(req.method == HTTP_DELETE) {
+    if(req.hasArg("index")) {
+      if(!dinplugBridge.removeMapping(static_cast<uint16_t>(req.argInt("index")), msg)) {
         server.send(400, _encoding_json, msg);
         return;
       }
@@ -1120,25 +1482,13 @@ void Web::handleDinplugMappings(WebServer &server) {
     server.send(200, _encoding_json, msg);
     return;
   }
-  if(server.method() != HTTP_POST && server.method() != HTTP_PUT) {
-    server.send(405, _encoding_json, "{\"status\":\"ERROR\",\"desc\":\"Invalid HTTP Method\"}");
-    return;
-  }
-  DynamicJsonDocument doc(1024);
-  DeserializationError err = deserializeJson(doc, server.arg("plain"));
-  if(err) {
-    webServer.handleDeserializationError(server, err);
-    return;
-  }
-  JsonObject obj = doc.as<JsonObject>();
-  String msg;
-  if(!dinplugBridge.addMapping(obj["keypadId"] | 0,
-                               obj["buttonId"] | 0,
-                               obj["action"] | "press",
-                               obj["targetType"] | "shade",
-                               obj["targetId"] | 0,
-                               obj["command"] | "My",
-                               obj["value"] | 0,
+  if(!dinplugBridge.addMapping(req.argInt("keypadId"),
+                               req.argInt("buttonId"),
+                               req.arg("action", "press").c_str(),
+                               req.arg("targetType", "shade").c_str(),
+                               req.argInt("targetId"),
+                               req.arg("command", "My").c_str(),
+                               req.argInt("value"),
                                msg)) {
     server.send(400, _encoding_json, msg);
     return;
@@ -1146,71 +1496,34 @@ void Web::handleDinplugMappings(WebServer &server) {
   server.send(200, _encoding_json, msg);
 }
 
-void Web::handleDinplugConnect(WebServer &server) {
-  webServer.sendCORSHeaders(server);
-  if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-  if(server.method() != HTTP_POST && server.method() != HTTP_PUT) {
-    server.send(405, _encoding_json, "{\"status\":\"ERROR\",\"desc\":\"Invalid HTTP Method\"}");
-    return;
-  }
-  DynamicJsonDocument doc(256);
-  if(server.arg("plain").length() > 0) {
-    DeserializationError err = deserializeJson(doc, server.arg("plain"));
-    if(err) {
-      webServer.handleDeserializationError(server, err);
-      return;
-    }
-  }
-  const bool connect = !doc["connect"].isNull() ? static_cast<bool>(doc["connect"]) : true;
+void Web::handleDinplugConnect(WebRequest &req) {
+  const bool connect = req.argBool("connect", true);
   String msg;
   if(connect) dinplugBridge.connectNow(msg);
   else dinplugBridge.disconnect(msg);
-  server.send(200, _encoding_json, msg);
+  req.server.send(200, _encoding_json, msg);
 }
 
 void Web::begin() {
   Serial.println("Creating Web MicroServices...");
   server.enableCORS(true);
-  const char *keys[1] = {"apikey"};
-  server.collectHeaders(keys, 1);
+  const char *keys[4] = {"apikey", "Accept-Encoding", "If-None-Match", "Connection"};
+  server.collectHeaders(keys, 3);
   // API Server Handlers
-  apiServer.collectHeaders(keys, 1);  
+  apiServer.collectHeaders(keys, 4);
   apiServer.enableCORS(true);
-  apiServer.on("/discovery", []() { webServer.handleDiscovery(apiServer); });
-  apiServer.on("/rooms", []() {webServer.handleGetRooms(apiServer); });
-  apiServer.on("/shades", []() { webServer.handleGetShades(apiServer); });
-  apiServer.on("/groups", []() { webServer.handleGetGroups(apiServer); });
-  apiServer.on("/login", []() { webServer.handleLogin(apiServer); });
+  // Both servers answer the same routed services so they are registered from one table.
+  for(uint8_t i = 0; i < WEB_ROUTE_COUNT; i++) {
+    apiServer.on(g_routes[i].path, [i]() { webServer.dispatch(apiServer, i); });
+    server.on(g_routes[i].path, [i]() { webServer.dispatch(server, i); });
+  }
   apiServer.onNotFound([]() { webServer.handleNotFound(apiServer); });
-  apiServer.on("/controller", []() { webServer.handleController(apiServer); });
-  apiServer.on("/shadeCommand", []() { webServer.handleShadeCommand(apiServer); });
-  apiServer.on("/groupCommand", []() { webServer.handleGroupCommand(apiServer); });
-  apiServer.on("/tiltCommand", []() { webServer.handleTiltCommand(apiServer); });
-  apiServer.on("/repeatCommand", []() { webServer.handleRepeatCommand(apiServer); });
-  apiServer.on("/room", HTTP_GET, [] () { webServer.handleRoom(apiServer); });
-  apiServer.on("/shade", HTTP_GET, [] () { webServer.handleShade(apiServer); });
-  apiServer.on("/group", HTTP_GET, [] () { webServer.handleGroup(apiServer); });
-  apiServer.on("/setPositions", []() { webServer.handleSetPositions(apiServer); });
-  apiServer.on("/setSensor", []() { webServer.handleSetSensor(apiServer); });
-  apiServer.on("/downloadFirmware", []() { webServer.handleDownloadFirmware(apiServer); });
-  apiServer.on("/backup", []() { webServer.handleBackup(apiServer); });
-  apiServer.on("/reboot", []() { webServer.handleReboot(apiServer); });
-  apiServer.on("/dinplug/settings", []() { webServer.handleDinplugSettings(apiServer); });
-  apiServer.on("/dinplug/mappings", []() { webServer.handleDinplugMappings(apiServer); });
-  apiServer.on("/dinplug/connect", []() { webServer.handleDinplugConnect(apiServer); });
   
   // Web Interface
-  server.on("/tiltCommand", []() { webServer.handleTiltCommand(server); });
-  server.on("/repeatCommand", []() { webServer.handleRepeatCommand(server); });
-  server.on("/shadeCommand", []() { webServer.handleShadeCommand(server); });
-  server.on("/groupCommand", []() { webServer.handleGroupCommand(server); });
-  server.on("/setPositions", []() { webServer.handleSetPositions(server); });
-  server.on("/setSensor", []() { webServer.handleSetSensor(server); });
   server.on("/upnp.xml", []() { SSDP.schema(server.client()); });
-  server.on("/", []() { webServer.handleStreamFile(server, "/index.html", _encoding_html); });
+  server.on("/", []() { webServer.sendCacheHeaders(0); webServer.handleStreamFile(server, "/index.html", _encoding_html); });
+  server.on(UriBraces("/assets/{}"), []() { webServer.handleAsset(server); });
   server.on("/dinplug", []() { webServer.handleStreamFile(server, "/dinplug.html", _encoding_html); });
-  server.on("/login", []() { webServer.handleLogin(server); });
-  server.on("/loginContext", []() { webServer.handleLoginContext(server); });
   server.on("/shades.cfg", []() { webServer.handleStreamFile(server, "/shades.cfg", _encoding_text); });
   server.on("/shades.tmp", []() { webServer.handleStreamFile(server, "/shades.tmp", _encoding_text); });
   server.on("/getReleases", []() {
@@ -1226,7 +1539,6 @@ void Web::begin() {
     resp.endObject();
     resp.endResponse();
   });
-  server.on("/downloadFirmware", []() { webServer.handleDownloadFirmware(server); });
   server.on("/cancelFirmware", []() {
     webServer.sendCORSHeaders(server);
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
@@ -1245,7 +1557,6 @@ void Web::begin() {
       server.send(500, _encoding_json, F("{\"status\":\"ERROR\",\"desc\":\"Cannot cancel during filesystem update.\"}"));
     }
   });
-  server.on("/backup", []() { webServer.handleBackup(server, true); });
   server.on("/restore", HTTP_POST, []() {
     webServer.sendCORSHeaders(server);
     server.sendHeader("Connection", "close");
@@ -1274,48 +1585,44 @@ void Web::begin() {
       rebootDelay.reboot = true;
       rebootDelay.rebootTime = millis() + 1000;
     }
+    else {
+      snprintf(g_content, sizeof(g_content), "{\"status\":\"ERROR\",\"desc\":\"Invalid backup file: %s\"}", restoreStream.error);
+      server.send(500, _encoding_json, g_content);
+    }
     }, []() {
       esp_task_wdt_reset();
       HTTPUpload& upload = server.upload();
       if (upload.status == UPLOAD_FILE_START) {
         webServer.uploadSuccess = false;
         Serial.printf("Restore: %s\n", upload.filename.c_str());
-        // Begin by opening a new temporary file.
-        File fup = LittleFS.open("/shades.tmp", "w");
-        fup.close();
+        // Keep the temporary file open for the whole upload and validate
+        // the records as the chunks arrive.
+        restoreStream.begin("/shades.tmp");
       }
       else if (upload.status == UPLOAD_FILE_WRITE) {
-        File fup = LittleFS.open("/shades.tmp", "a");
-        //upload.buf[upload.currentSize] = 0x00;
-        //Serial.print((char *)upload.buf);
-        fup.write(upload.buf, upload.currentSize);
-        fup.close();
+        if(!restoreStream.failed) {
+          restoreStream.write(upload.buf, upload.currentSize);
+          emitRestoreProgress();
+        }
       }
       else if (upload.status == UPLOAD_FILE_END) {
-        webServer.uploadSuccess = true;
+        webServer.uploadSuccess = restoreStream.end();
+        emitRestoreProgress();
+      }
+      else if (upload.status == UPLOAD_FILE_ABORTED) {
+        restoreStream.abort();
       }
-
     });
-  server.on("/index.js", []() { webServer.sendCacheHeaders(604800); webServer.handleStreamFile(server, "/index.js", "text/javascript"); });
-  server.on("/main.css", []() { webServer.sendCacheHeaders(604800); webServer.handleStreamFile(server, "/main.css", "text/css"); });
-  server.on("/widgets.css", []() { webServer.sendCacheHeaders(604800); webServer.handleStreamFile(server, "/widgets.css", "text/css"); });
-  server.on("/icons.css", []() {  webServer.sendCacheHeaders(604800); webServer.handleStreamFile(server, "/icons.css", "text/css"); });
+  server.on("/index.js", []() { webServer.sendCacheHeaders(0); webServer.handleStreamFile(server, "/index.js", "text/javascript"); });
+  server.on("/main.css", []() { webServer.sendCacheHeaders(0); webServer.handleStreamFile(server, "/main.css", "text/css"); });
+  server.on("/widgets.css", []() { webServer.sendCacheHeaders(0); webServer.handleStreamFile(server, "/widgets.css", "text/css"); });
+  server.on("/icons.css", []() { webServer.sendCacheHeaders(0); webServer.handleStreamFile(server, "/icons.css", "text/css"); });
   server.on("/favicon.png", []() { webServer.sendCacheHeaders(604800); webServer.handleStreamFile(server, "/favicon.png", "image/png"); });
   server.on("/icon.png", []() { webServer.sendCacheHeaders(604800); webServer.handleStreamFile(server, "/icon.png", "image/png"); });
   server.on("/icon.svg", []() { webServer.sendCacheHeaders(604800); webServer.handleStreamFile(server, "/icon.svg", "image/svg+xml"); });
   server.on("/apple-icon.png", []() { webServer.sendCacheHeaders(604800); webServer.handleStreamFile(server, "/apple-icon.png", "image/png"); });
   server.on("/dinplug.html", []() { webServer.sendCacheHeaders(60); webServer.handleStreamFile(server, "/dinplug.html", _encoding_html); });
-  server.on("/dinplug/settings", []() { webServer.handleDinplugSettings(server); });
-  server.on("/dinplug/mappings", []() { webServer.handleDinplugMappings(server); });
-  server.on("/dinplug/connect", []() { webServer.handleDinplugConnect(server); });
   server.onNotFound([]() { webServer.handleNotFound(server); });
-  server.on("/controller", []() { webServer.handleController(server); });
-  server.on("/rooms", []() { webServer.handleGetRooms(server); });
-  server.on("/shades", []() { webServer.handleGetShades(server); });
-  server.on("/groups", []() { webServer.handleGetGroups(server); });
-  server.on("/room", []() { webServer.handleRoom(server); });
-  server.on("/shade", []() { webServer.handleShade(server); });
-  server.on("/group", []() { webServer.handleGroup(server); });
   server.on("/getNextRoom", []() {
     webServer.sendCORSHeaders(server);
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
@@ -1360,7 +1667,7 @@ void Web::begin() {
     SomfyRoom * room = nullptr;
     if (method == HTTP_POST || method == HTTP_PUT) {
       Serial.println("Adding a room");
-      DynamicJsonDocument doc(512);
+      WebJsonDocument doc(512);
       DeserializationError err = deserializeJson(doc, server.arg("plain"));
       if (err) {
         webServer.handleDeserializationError(server, err);
@@ -1401,7 +1708,7 @@ void Web::begin() {
     SomfyShade* shade = nullptr;
     if (method == HTTP_POST || method == HTTP_PUT) {
       Serial.println("Adding a shade");
-      DynamicJsonDocument doc(1024);
+      WebJsonDocument doc(1024);
       DeserializationError err = deserializeJson(doc, server.arg("plain"));
       if (err) {
         webServer.handleDeserializationError(server, err);
@@ -1443,7 +1750,7 @@ void Web::begin() {
     SomfyGroup * group = nullptr;
     if (method == HTTP_POST || method == HTTP_PUT) {
       Serial.println("Adding a group");
-      DynamicJsonDocument doc(512);
+      WebJsonDocument doc(512);
       DeserializationError err = deserializeJson(doc, server.arg("plain"));
       if (err) {
         webServer.handleDeserializationError(server, err);
@@ -1529,7 +1836,7 @@ void Web::begin() {
       // We are updating an existing room.
       if (server.hasArg("plain")) {
         Serial.println("Updating a room");
-        DynamicJsonDocument doc(512);
+        WebJsonDocument doc(512);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -1566,7 +1873,7 @@ void Web::begin() {
       // We are updating an existing shade.
       if (server.hasArg("plain")) {
         Serial.println("Updating a shade");
-        DynamicJsonDocument doc(1024);
+        WebJsonDocument doc(1024);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -1608,7 +1915,7 @@ void Web::begin() {
       // We are updating an existing shade.
       if (server.hasArg("plain")) {
         Serial.println("Updating a group");
-        DynamicJsonDocument doc(512);
+        WebJsonDocument doc(512);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -1650,7 +1957,7 @@ void Web::begin() {
         if(server.hasArg("tilt")) tilt = atoi(server.arg("tilt").c_str());
       }
       else if (server.hasArg("plain")) {
-        DynamicJsonDocument doc(256);
+        WebJsonDocument doc(256);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -1733,7 +2040,7 @@ void Web::begin() {
     uint8_t shadeId = 255;
     bool paired = false;
     if(server.hasArg("plain")) {
-      DynamicJsonDocument doc(512);
+      WebJsonDocument doc(512);
       DeserializationError err = deserializeJson(doc, server.arg("plain"));
       if(err) {
           webServer.handleDeserializationError(server, err);
@@ -1773,7 +2080,7 @@ void Web::begin() {
       uint8_t shadeId = 255;
       if (server.hasArg("plain")) {
         // Its coming in the body.
-        DynamicJsonDocument doc(512);
+        WebJsonDocument doc(512);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -1816,7 +2123,7 @@ void Web::begin() {
       uint32_t address = 0;
       if (server.hasArg("plain")) {
         Serial.println("Linking a repeater");
-        DynamicJsonDocument doc(512);
+        WebJsonDocument doc(512);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -1852,7 +2159,7 @@ void Web::begin() {
       uint32_t address = 0;
       if (server.hasArg("plain")) {
         Serial.println("Unlinking a repeater");
-        DynamicJsonDocument doc(512);
+        WebJsonDocument doc(512);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -1887,7 +2194,7 @@ void Web::begin() {
     if (method == HTTP_PUT || method == HTTP_POST) {
       // We are updating an existing shade by adding a linked remote.
       if (server.hasArg("plain")) {
-        DynamicJsonDocument doc(512);
+        WebJsonDocument doc(512);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -1927,7 +2234,7 @@ void Web::begin() {
       // We are updating an existing shade by adding a linked remote.
       if (server.hasArg("plain")) {
         Serial.println("Linking a remote");
-        DynamicJsonDocument doc(512);
+        WebJsonDocument doc(512);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -1967,7 +2274,7 @@ void Web::begin() {
     if (method == HTTP_PUT || method == HTTP_POST) {
       if (server.hasArg("plain")) {
         Serial.println("Linking a shade to a group");
-        DynamicJsonDocument doc(512);
+        WebJsonDocument doc(512);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -2014,7 +2321,7 @@ void Web::begin() {
     if (method == HTTP_PUT || method == HTTP_POST) {
       if (server.hasArg("plain")) {
         Serial.println("Unlinking a shade from a group");
-        DynamicJsonDocument doc(512);
+        WebJsonDocument doc(512);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           switch (err.code()) {
@@ -2074,7 +2381,7 @@ void Web::begin() {
       }
       else if (server.hasArg("plain")) {
         Serial.println("Deleting a Room");
-        DynamicJsonDocument doc(256);
+        WebJsonDocument doc(256);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -2106,7 +2413,7 @@ void Web::begin() {
       }
       else if (server.hasArg("plain")) {
         Serial.println("Deleting a shade");
-        DynamicJsonDocument doc(256);
+        WebJsonDocument doc(256);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -2141,7 +2448,7 @@ void Web::begin() {
       }
       else if (server.hasArg("plain")) {
         Serial.println("Deleting a group");
-        DynamicJsonDocument doc(256);
+        WebJsonDocument doc(256);
         DeserializationError err = deserializeJson(doc, server.arg("plain"));
         if (err) {
           webServer.handleDeserializationError(server, err);
@@ -2291,10 +2598,8 @@ void Web::begin() {
     esp_task_wdt_reset();
     
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    esp_task_wdt_delete(NULL);
     if(net.softAPOpened) WiFi.disconnect(false);
     int n = WiFi.scanNetworks(false, true);
-    esp_task_wdt_add(NULL);
     
     Serial.print("Scanned ");
     Serial.print(n);
@@ -2323,11 +2628,10 @@ void Web::begin() {
     resp.endObject();
     resp.endResponse();
     });
-  server.on("/reboot", []() { webServer.handleReboot(server);});
   server.on("/saveSecurity", []() {
     webServer.sendCORSHeaders(server);
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    DynamicJsonDocument doc(512);
+    WebJsonDocument doc(512);
     DeserializationError err = deserializeJson(doc, server.arg("plain"));
     if (err) {
       Serial.print("Error parsing JSON ");
@@ -2344,7 +2648,7 @@ void Web::begin() {
         char token[65];
         webServer.createAPIToken(server.client().remoteIP(), token);
         obj["apiKey"] = token;
-        DynamicJsonDocument sdoc(1024);
+        WebJsonDocument sdoc(1024);
         JsonObject sobj = sdoc.to<JsonObject>();
         settings.Security.toJSON(sobj);
         serializeJson(sdoc, g_content);
@@ -2357,7 +2661,7 @@ void Web::begin() {
     });
   server.on("/getSecurity", []() {
     webServer.sendCORSHeaders(server);
-    DynamicJsonDocument doc(512);
+    WebJsonDocument doc(512);
     JsonObject obj = doc.to<JsonObject>();
     settings.Security.toJSON(obj);
     serializeJson(doc, g_content);
@@ -2366,7 +2670,7 @@ void Web::begin() {
   server.on("/saveRadio", []() {
     webServer.sendCORSHeaders(server);
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    DynamicJsonDocument doc(512);
+    WebJsonDocument doc(512);
     DeserializationError err = deserializeJson(doc, server.arg("plain"));
     if (err) {
       Serial.print("Error parsing JSON ");
@@ -2444,7 +2748,7 @@ void Web::begin() {
   server.on("/setgeneral", []() {
     webServer.sendCORSHeaders(server);
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    DynamicJsonDocument doc(512);
+    WebJsonDocument doc(512);
     
     Serial.print("Plain: ");
     Serial.print(server.method());
@@ -2459,7 +2763,7 @@ void Web::begin() {
       HTTPMethod method = server.method();
       if (method == HTTP_POST || method == HTTP_PUT) {
         // Parse out all the inputs.
-        if (obj.containsKey("hostname") || obj.containsKey("ssdpBroadcast") || obj.containsKey("checkForUpdate")) {
+        if (obj.containsKey("hostname") || obj.containsKey("ssdpBroadcast") || obj.containsKey("checkForUpdate") || obj.containsKey("apiKeepAlive") || obj.containsKey("apiMaxRequests")) {
           bool checkForUpdate = settings.checkForUpdate;
           settings.fromJSON(obj);
           settings.save();
@@ -2480,7 +2784,7 @@ void Web::begin() {
   server.on("/setNetwork", []() {
     webServer.sendCORSHeaders(server);
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    DynamicJsonDocument doc(1024);
+    WebJsonDocument doc(1024);
     DeserializationError err = deserializeJson(doc, server.arg("plain"));
     if (err) {
       Serial.print("Error parsing JSON ");
@@ -2537,7 +2841,7 @@ void Web::begin() {
     webServer.sendCORSHeaders(server);
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
     Serial.println("Setting IP...");
-    DynamicJsonDocument doc(1024);
+    WebJsonDocument doc(1024);
     DeserializationError err = deserializeJson(doc, server.arg("plain"));
     if (err) {
       webServer.handleDeserializationError(server, err);
@@ -2560,7 +2864,7 @@ void Web::begin() {
     webServer.sendCORSHeaders(server);
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
     Serial.println("Settings WIFI connection...");
-    DynamicJsonDocument doc(512);
+    WebJsonDocument doc(512);
     DeserializationError err = deserializeJson(doc, server.arg("plain"));
     if (err) {
       webServer.handleDeserializationError(server, err);
@@ -2611,7 +2915,7 @@ void Web::begin() {
     resp.endObject();
     resp.endResponse();
     /*
-    DynamicJsonDocument doc(512);
+    WebJsonDocument doc(512);
     JsonObject obj = doc.to<JsonObject>();
     doc["fwVersion"] = settings.fwVersion.name;
     settings.toJSON(obj);
@@ -2642,7 +2946,7 @@ void Web::begin() {
     resp.endResponse();
     
     /*
-    DynamicJsonDocument doc(2048);
+    WebJsonDocument doc(2048);
     JsonObject obj = doc.to<JsonObject>();
     doc["fwVersion"] = settings.fwVersion.name;
     settings.toJSON(obj);
@@ -2658,7 +2962,7 @@ void Web::begin() {
     });
   server.on("/connectmqtt", []() {
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    DynamicJsonDocument doc(1024);
+    WebJsonDocument doc(1024);
     DeserializationError err = deserializeJson(doc, server.arg("plain"));
     if (err) {
       webServer.handleDeserializationError(server, err);
@@ -2681,7 +2985,7 @@ void Web::begin() {
         resp.endObject();
         resp.endResponse();
         /*
-        DynamicJsonDocument sdoc(1024);
+        WebJsonDocument sdoc(1024);
         JsonObject sobj = sdoc.to<JsonObject>();
         settings.MQTT.toJSON(sobj);
         serializeJson(sdoc, g_content);
@@ -2703,7 +3007,7 @@ void Web::begin() {
     resp.endResponse();
     
     /*
-    DynamicJsonDocument doc(1024);
+    WebJsonDocument doc(1024);
     JsonObject obj = doc.to<JsonObject>();
     settings.MQTT.toJSON(obj);
     serializeJson(doc, g_content);
@@ -2712,7 +3016,7 @@ void Web::begin() {
     });
   server.on("/roomSortOrder", []() {
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    DynamicJsonDocument doc(512);
+    WebJsonDocument doc(512);
     Serial.print("Plain: ");
     Serial.print(server.method());
     Serial.println(server.arg("plain"));
@@ -2743,7 +3047,7 @@ void Web::begin() {
   });
   server.on("/shadeSortOrder", []() {
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    DynamicJsonDocument doc(512);
+    WebJsonDocument doc(512);
     Serial.print("Plain: ");
     Serial.print(server.method());
     Serial.println(server.arg("plain"));
@@ -2774,7 +3078,7 @@ void Web::begin() {
   });
   server.on("/groupSortOrder", []() {
     if(server.method() == HTTP_OPTIONS) { server.send(200, "OK"); return; }
-    DynamicJsonDocument doc(512);
+    WebJsonDocument doc(512);
     Serial.print("Plain: ");
     Serial.print(server.method());
     Serial.println(server.arg("plain"));
@@ -2813,7 +3117,7 @@ void Web::begin() {
     resp.endObject();
     resp.endResponse();
     /*
-    DynamicJsonDocument doc(1024);
+    WebJsonDocument doc(1024);
     JsonObject obj = doc.to<JsonObject>();
     somfy.transceiver.toJSON(obj);
     serializeJson(doc, g_content);
@@ -2830,7 +3134,7 @@ void Web::begin() {
     resp.endObject();
     resp.endResponse();
     /*
-    DynamicJsonDocument doc(1024);
+    WebJsonDocument doc(1024);
     JsonObject obj = doc.to<JsonObject>();
     somfy.transceiver.toJSON(obj);
     serializeJson(doc, g_content);
@@ -2851,4 +3155,21 @@ void Web::begin() {
   });
   server.begin();
   apiServer.begin();
+  // The loop task takes the state lock here and holds it for the life of the
+  // process except while Web::loop opens a window for the web task.
+  this->stateLock = xSemaphoreCreateMutex();
+  this->commands = xQueueCreate(WEB_CMD_QUEUE_SIZE, sizeof(web_command_t));
+  if(this->stateLock && this->commands) {
+    xSemaphoreTake(this->stateLock, portMAX_DELAY);
+    if(xTaskCreatePinnedToCore(webTask, "WebServer", WEB_TASK_STACK, nullptr, 1, &this->task, 0) != pdPASS) {
+      Serial.println("Unable to start the web task; polling from the loop");
+      this->task = nullptr;
+    }
+  }
+  if(!this->task) {
+    if(this->stateLock) vSemaphoreDelete(this->stateLock);
+    if(this->commands) vQueueDelete(this->commands);
+    this->stateLock = nullptr;
+    this->commands = nullptr;
+  }
 }
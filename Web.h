@@ -1,39 +1,187 @@
 #include <WebServer.h>
 #include "Somfy.h"
+#include "HeapTracker.h"
 #ifndef webserver_h
 #define webserver_h
+#define WEB_TASK_STACK 8192
+#define WEB_CMD_QUEUE_SIZE 16
+#define WEB_ARENA_SIZE 1024
+#define WEB_BODY_SIZE 1024
+#define WEB_TOKEN_CACHE_SIZE 4
+#define WEB_KEEPALIVE_MAX 1
+#define WEB_METHOD_GET 0x01
+#define WEB_METHOD_POST 0x02
+#define WEB_METHOD_PUT 0x04
+#define WEB_METHOD_DELETE 0x08
+#define WEB_METHOD_READ (WEB_METHOD_GET | WEB_METHOD_POST)
+#define WEB_METHOD_WRITE (WEB_METHOD_POST | WEB_METHOD_PUT)
+#define WEB_METHOD_ANY (WEB_METHOD_GET | WEB_METHOD_POST | WEB_METHOD_PUT | WEB_METHOD_DELETE)
+
+enum class web_cmd_types_t : uint8_t {
+  shade = 0,
+  shadeTarget = 1,
+  tilt = 2,
+  tiltTarget = 3,
+  group = 4,
+  shadeRepeat = 5,
+  groupRepeat = 6
+};
+// A command received over http that is handed to the loop task to be sent so the
+// web task can answer the request without waiting on the radio.
+struct web_command_t {
+  web_cmd_types_t type = web_cmd_types_t::shade;
+  uint8_t id = 255;
+  somfy_commands command = somfy_commands::My;
+  uint8_t target = 255;
+  int8_t repeat = -1;
+  uint8_t stepSize = 0;
+};
+enum class web_auth_t : uint8_t {
+  none = 0,
+  api = 1,
+  config = 2
+};
+// An api token computed for a client address.  The token is only good for the
+// security revision it was computed from.
+struct web_token_t {
+  uint32_t ip = 0;
+  uint32_t revision = 0;
+  uint32_t lastUsed = 0;
+  char token[65] = "";
+};
+// Runs every handler under the state lock and nothing else.  The request line, headers,
+// body and upload chunks are read with the lock free and it is given up again around
+// each write to the client so a slow client never holds up the loop task.
+class LockingServer : public WebServer {
+  protected:
+    size_t _currentClientWrite(const char *b, size_t l) override;
+    size_t _currentClientWrite_P(PGM_P b, size_t l) override;
+  public:
+    LockingServer(int port) : WebServer(port) {}
+    const char *argPtr(const char *name);
+    void on(const Uri &uri, THandlerFunction fn);
+    void on(const Uri &uri, HTTPMethod method, THandlerFunction fn);
+    void on(const Uri &uri, HTTPMethod method, THandlerFunction fn, THandlerFunction ufn);
+    void onNotFound(THandlerFunction fn);
+};
+// Serves the api port over persistent connections.  The stock server answers every
+// request with Connection: close and then waits on the client to hang up, so a client
+// that asked to keep the connection is parked here until its next request arrives or
+// it sits idle for longer than the configured timeout.
+class KeepAliveServer : public LockingServer {
+  protected:
+    WiFiClient parked[WEB_KEEPALIVE_MAX];
+    uint32_t parkedAt[WEB_KEEPALIVE_MAX] = {0};
+    uint16_t parkedRequests[WEB_KEEPALIVE_MAX] = {0};
+    uint16_t requests = 0;
+    bool headerPending = false;
+    bool keepAlive = false;
+    bool canKeepAlive();
+    bool resumeClient();
+    void parkClient();
+    size_t _currentClientWrite(const char *b, size_t l) override;
+  public:
+    KeepAliveServer(int port) : LockingServer(port) {}
+    uint32_t reused = 0;
+    uint8_t parkedCount();
+    void handleClient() override;
+};
+class Web;
+// Backs the request document with a static arena so parsing the body of a command does
+// not touch the heap.  The body is copied into a static buffer beside the arena and
+// parsed in place.  Only the web task parses requests so a single arena is enough and
+// it is released when the request document goes out of scope.  A document that does not
+// fit or a nested request falls back to the tracked heap.
+struct WebArenaAllocator {
+  static uint32_t hits;
+  static uint32_t misses;
+  void *allocate(size_t size);
+  void deallocate(void *ptr);
+  void *reallocate(void *ptr, size_t size);
+};
+typedef BasicJsonDocument<WebArenaAllocator> WebRequestDocument;
+// The arguments for a routed request.  Query string and form values are read first
+// and the JSON body is parsed once by the router so a handler reads a value the same
+// way no matter how the client sent it.
+class WebRequest {
+  public:
+    WebRequest(LockingServer &server, size_t docSize);
+    LockingServer &server;
+    HTTPMethod method;
+    WebRequestDocument doc;
+    JsonObject body;
+    DeserializationError parse(char *json);
+    bool hasBody() { return !this->body.isNull(); }
+    bool hasArg(const char *name);
+    String arg(const char *name, const char *def = "");
+    const char *argStr(const char *name, const char *def = "");
+    long argInt(const char *name, long def = 0);
+    bool argBool(const char *name, bool def = false);
+};
+typedef void (Web::*web_handler_t)(WebRequest &req);
+struct web_route_t {
+  const char *path;
+  uint8_t methods;
+  web_auth_t auth;
+  uint16_t docSize;
+  web_handler_t handler;
+};
 class Web {
+  protected:
+    TaskHandle_t task = nullptr;
+    SemaphoreHandle_t stateLock = nullptr;
+    QueueHandle_t commands = nullptr;
+    web_token_t tokens[WEB_TOKEN_CACHE_SIZE];
+    void executeCommand(web_command_t &cmd);
+    void processCommands();
+    void dispatch(LockingServer &server, uint8_t index);
   public:
+    uint32_t commandsQueued = 0;
+    uint32_t commandsDropped = 0;
+    uint32_t tokenHits = 0;
+    uint32_t tokenMisses = 0;
+    bool queueCommand(web_command_t &cmd);
+    void lockState();
+    void unlockState();
+    bool serving = false;
+    void beginHandler();
+    void endHandler();
+    bool beginWrite();
+    void endWrite(bool held);
     bool uploadSuccess = false;
     void sendCORSHeaders(WebServer &server);
-    void sendCacheHeaders(uint32_t seconds=604800);
+    void sendCacheHeaders(uint32_t seconds=604800, bool immutable = false);
     void startup();
-    void handleLogin(WebServer &server);
+    void handleLogin(WebRequest &req);
     void handleLogout(WebServer &server);
     void handleStreamFile(WebServer &server, const char *filename, const char *encoding);
-    void handleController(WebServer &server);
-    void handleLoginContext(WebServer &server);
-    void handleGetRepeaters(WebServer &server);
-    void handleGetRooms(WebServer &server);
-    void handleGetShades(WebServer &server);
-    void handleGetGroups(WebServer &server);
-    void handleShadeCommand(WebServer &server);
-    void handleRepeatCommand(WebServer &server);
-    void handleGroupCommand(WebServer &server);
-    void handleTiltCommand(WebServer &server);
-    void handleDiscovery(WebServer &server);
+    void handleAsset(WebServer &server);
+    void handleController(WebRequest &req);
+    void handleBootProfile(WebRequest &req);
+    void handleMetrics(WebRequest &req);
+    void handleLoginContext(WebRequest &req);
+    void handleGetRepeaters(WebRequest &req);
+    void handleGetRooms(WebRequest &req);
+    void handleGetShades(WebRequest &req);
+    void handleGetGroups(WebRequest &req);
+    void handleShadeCommand(WebRequest &req);
+    void handleRepeatCommand(WebRequest &req);
+    void handleGroupCommand(WebRequest &req);
+    void handleTiltCommand(WebRequest &req);
+    void handleDiscovery(WebRequest &req);
     void handleNotFound(WebServer &server);
-    void handleRoom(WebServer &server);
-    void handleShade(WebServer &server);
-    void handleGroup(WebServer &server);
-    void handleSetPositions(WebServer &server);
-    void handleSetSensor(WebServer &server);
-    void handleDinplugSettings(WebServer &server);
-    void handleDinplugMappings(WebServer &server);
-    void handleDinplugConnect(WebServer &server);
-    void handleDownloadFirmware(WebServer &server);
-    void handleBackup(WebServer &server, bool attach = false);
-    void handleReboot(WebServer &server);
+    void handleRoom(WebRequest &req);
+    void handleShade(WebRequest &req);
+    void handleGroup(WebRequest &req);
+    void handleSetPositions(WebRequest &req);
+    void handleSetSensor(WebRequest &req);
+    void handleDinplugSettings(WebRequest &req);
+    void handleDinplugMappings(WebRequest &req);
+    void handleDinplugConnect(WebRequest &req);
+    void handleDownloadFirmware(WebRequest &req);
+    void handleBackup(WebRequest &req);
+    void handleProvision(WebRequest &req);
+    void handleReboot(WebRequest &req);
     void handleDeserializationError(WebServer &server, DeserializationError &err);
     void begin();
     void loop();
@@ -497,6 +497,9 @@ async function initSockets() {
                         case 'updateProgress':
                             firmware.procUpdateProgress(msg);
                             break;
+                        case 'restoreProgress':
+                            firmware.procRestoreProgress(msg);
+                            break;
                         case 'fwStatus':
                             firmware.procFwStatus(msg);
                             break;
@@ -509,6 +512,9 @@ async function initSockets() {
                         case 'shadeState':
                             somfy.procShadeState(msg);
                             break;
+                        case 'shadeSnapshot':
+                            for (let i = 0; i < msg.length; i++) somfy.procShadeState(msg[i]);
+                            break;
                         case 'shadeCommand':
                             console.log(msg);
                             break;
@@ -599,7 +605,7 @@ async function initSockets() {
                         console.log(`Initial socket did not connect try again (server was busy and timed out ${connectFailed} times)`);
                         tConnect = setTimeout(async () => { await reopenSocket(); }, timeout);
                         if (connectFailed === 5) {
-                            ui.socketError('Too many clients connected.  A maximum of 5 clients may be connected at any one time.  Close some connections to the ESP Somfy RTS device to proceed.');
+                            ui.socketError('Too many clients connected.  The device has reached its client limit.  Close some connections to the ESP Somfy RTS device to proceed.');
                         }
                         let spanAttempts = document.getElementById('spanSocketAttempts');
                         if (spanAttempts) spanAttempts.innerHTML = connectFailed.fmt("#,##0");
@@ -4335,7 +4341,8 @@ class Firmware {
                 if (typeof overlay !== 'undefined') overlay.remove();
                 reject({ htmlError: status, service: 'GET /backup' });
             };
-            xhr.open('GET', baseUrl.length > 0 ? `${baseUrl}/backup` : '/backup', true);
+            xhr.open('GET', baseUrl.length > 0 ? `${baseUrl}/backup?attach=true` : '/backup?attach=true', true);
+            xhr.setRequestHeader('apikey', security.apiKey);
             xhr.send();
         });
     }
@@ -4385,6 +4392,8 @@ class Firmware {
         if (sp) sp.innerHTML = mem.max.fmt('#,##0');
         sp = document.getElementById('spanMinMemory');
         if (sp) sp.innerHTML = mem.min.fmt('#,##0');
+        sp = document.getElementById('spanFragMemory');
+        if (sp && typeof mem.frag !== 'undefined') sp.innerHTML = `${mem.frag}%`;
 
 
     }
@@ -4464,6 +4473,11 @@ class Firmware {
         }
 
     }
+    procRestoreProgress(prog) {
+        let div = document.getElementById('divUploadFile');
+        if (!div) return;
+        if (prog.status === 'error') ui.errorMessage(div, `The backup file was rejected: ${prog.desc}`);
+    }
     async installGitRelease(div) {
         if (!this.isMobile()) {
             console.log('Starting backup');
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Bundles the web UI for the LittleFS image.
+
+The stylesheets and scripts referenced by each html page are minified and
+concatenated into a single css and js bundle per page.  The bundles are named by
+a hash of their content and written to /assets so the firmware can serve them
+with immutable caching.  A new build produces new names so browsers pick up the
+change without a hard refresh.
+
+    python3 tools/bundle_assets.py data littlefs
+
+Scripts are minified with terser when it is on the path.  Otherwise they are only
+concatenated.
+"""
+import argparse
+import hashlib
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+LINK_RE = re.compile(r'<link\s+rel="stylesheet"\s+href="([^"?]+\.css)(?:\?[^"]*)?"[^>]*/?>[ \t]*\r?\n?', re.I)
+SCRIPT_RE = re.compile(r'<script\s+type="text/javascript"\s+src="([^"?]+\.js)(?:\?[^"]*)?"\s*>\s*</script>[ \t]*\r?\n?', re.I)
+CSS_TIGHT = '{};,>'
+
+
+def minify_css(src):
+    out = []
+    i = 0
+    n = len(src)
+    while i < n:
+        c = src[i]
+        if c in '"\'':
+            j = i + 1
+            while j < n and src[j] != c:
+                j += 2 if src[j] == '\\' else 1
+            out.append(src[i:j + 1])
+            i = j + 1
+        elif src.startswith('/*', i):
+            j = src.find('*/', i + 2)
+            i = n if j < 0 else j + 2
+        elif c.isspace():
+            j = i
+            while j < n and src[j].isspace():
+                j += 1
+            prev = out[-1][-1] if out and out[-1] else ''
+            nxt = src[j] if j < n else ''
+            if prev and nxt and prev not in CSS_TIGHT and nxt not in CSS_TIGHT and not src.startswith('/*', j):
+                out.append(' ')
+            i = j
+        else:
+            out.append(c)
+            i += 1
+    return ''.join(out)
+
+
+def minify_js(path):
+    terser = shutil.which('terser')
+    if terser:
+        return subprocess.run([terser, path, '--compress', '--mangle'], check=True,
+                              capture_output=True, text=True).stdout
+    with open(path, encoding='utf-8-sig') as f:
+        return f.read()
+
+
+def write_bundle(out_dir, ext, content):
+    digest = hashlib.sha256(content.encode('utf-8')).hexdigest()[:10]
+    name = 'assets/app.{}.{}'.format(digest, ext)
+    os.makedirs(os.path.join(out_dir, 'assets'), exist_ok=True)
+    with open(os.path.join(out_dir, name), 'w', encoding='utf-8') as f:
+        f.write(content)
+    return name
+
+
+def bundle_page(src_dir, out_dir, page):
+    with open(os.path.join(src_dir, page), encoding='utf-8-sig') as f:
+        html = f.read()
+    styles = LINK_RE.findall(html)
+    scripts = SCRIPT_RE.findall(html)
+    if styles:
+        css = '\n'.join(minify_css(open(os.path.join(src_dir, s), encoding='utf-8-sig').read()) for s in styles)
+        name = write_bundle(out_dir, 'css', css)
+        tag = '<link rel="stylesheet" href="{}" type="text/css" />\n'.format(name)
+        html = LINK_RE.sub(lambda m, t=[tag]: t.pop() if t else '', html)
+        print('{}: {} -> {} ({} bytes)'.format(page, ', '.join(styles), name, len(css)))
+    if scripts:
+        js = ';\n'.join(minify_js(os.path.join(src_dir, s)) for s in scripts)
+        name = write_bundle(out_dir, 'js', js)
+        tag = '<script type="text/javascript" src="{}"></script>\n'.format(name)
+        html = SCRIPT_RE.sub(lambda m, t=[tag]: t.pop() if t else '', html)
+        print('{}: {} -> {} ({} bytes)'.format(page, ', '.join(scripts), name, len(js)))
+    with open(os.path.join(out_dir, page), 'w', encoding='utf-8') as f:
+        f.write(html)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Bundle the web UI assets for the LittleFS image.')
+    parser.add_argument('src', help='directory holding the web UI sources (data)')
+    parser.add_argument('out', help='directory to write the file system image contents to')
+    args = parser.parse_args()
+    if os.path.exists(args.out):
+        shutil.rmtree(args.out)
+    # Everything is copied so the unbundled names keep working for pages that are
+    # already open in a browser when the image is updated.
+    shutil.copytree(args.src, args.out)
+    for page in sorted(os.listdir(args.src)):
+        if page.endswith('.html'):
+            bundle_page(args.src, args.out, page)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,555 @@
+#!/usr/bin/env python3
+"""Runs the checks for firmware code that can be exercised off the device.
+
+Each check copies the functions it covers out of the firmware sources, compiles them
+with small stand-ins for the Arduino pieces they touch and runs them under the address
+and undefined behavior sanitizers.  Nothing here is built into the firmware.
+
+    python3 tools/host_check.py
+    python3 tools/host_check.py dinplug --iterations 2000000
+    python3 tools/host_check.py web --arduinojson ~/Arduino/libraries/ArduinoJson/src
+"""
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def read_source(name):
+    with open(os.path.join(ROOT, name)) as f:
+        return f.read()
+
+
+def extract_block(src, pattern):
+    """Returns the declaration or definition that starts at pattern up to its closing brace."""
+    m = re.search(pattern, src, re.M)
+    if not m:
+        raise RuntimeError('{} was not found'.format(pattern))
+    depth = 0
+    for i in range(src.index('{', m.start()), len(src)):
+        if src[i] == '{':
+            depth += 1
+        elif src[i] == '}':
+            depth -= 1
+            if depth == 0:
+                end = i + 1
+                if src[end:end + 1] == ';':
+                    end += 1
+                return src[m.start():end]
+    raise RuntimeError('{} is not closed'.format(pattern))
+
+
+def extract_line(src, pattern):
+    m = re.search(pattern + r'.*$', src, re.M)
+    if not m:
+        raise RuntimeError('{} was not found'.format(pattern))
+    return m.group(0)
+
+
+def extract_defines(src, names):
+    return '\n'.join(re.search(r'^#define {}\b.*$'.format(n), src, re.M).group(0) for n in names)
+
+
+TELNET_HARNESS = r'''
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t ch) = 0;
+    virtual size_t write(const uint8_t *data, size_t len) = 0;
+};
+
+// The socket takes whatever the window allows and fails with EAGAIN once it is full.
+static size_t g_window = 0;
+static bool g_reset = false;
+static std::string g_wire;
+static int stub_send(int, const void *data, size_t len, int flags) {
+  if(!(flags & MSG_DONTWAIT)) { fprintf(stderr, "send without MSG_DONTWAIT\n"); abort(); }
+  if(g_reset) { errno = ECONNRESET; return -1; }
+  size_t n = len < g_window ? len : g_window;
+  if(n == 0) { errno = EAGAIN; return -1; }
+  g_wire.append(static_cast<const char *>(data), n);
+  g_window -= n;
+  return static_cast<int>(n);
+}
+#define send stub_send
+@DEFINES@
+@CODE@
+#undef send
+
+#define CHECK(cond) do { if(!(cond)) { fprintf(stderr, "check failed line %d: %s\n", __LINE__, #cond); abort(); } } while(0)
+
+struct Pushed { std::string text; bool update; bool accepted; };
+
+// Shows whether an update that has not started going out is still queued.
+struct Probe : TelnetOutput {
+  bool hasDroppable() {
+    for(uint8_t i = this->sent > 0 ? 1 : 0; i < this->count; i++)
+      if(this->lines[i].update) return true;
+    return false;
+  }
+};
+
+int main(int argc, char **argv) {
+  const long iterations = argc > 1 ? atol(argv[1]) : 100000;
+  srand(argc > 2 ? atoi(argv[2]) : 1);
+  static Probe out;
+  out.begin(3);
+  std::vector<Pushed> pushed;
+  for(long i = 0; i < iterations; i++) {
+    // Every so often the client stops reading for a while.
+    const bool stalled = (i / 5000) % 4 == 3;
+    int op = rand() % 10;
+    if(op < 6) {
+      bool update = rand() % 3 != 0;
+      bool print = !update && rand() % 4 == 0;
+      std::string text = (update ? "U" : "R") + std::to_string(pushed.size()) + ":";
+      text.append(rand() % (print ? 200 : rand() % 8 == 0 ? 400 : 90), 'x');
+      text += "\n";
+      uint32_t refused = out.repliesDropped;
+      bool accepted;
+      if(print) {
+        // Replies written through Print are gathered into a line before they are queued.
+        out.write(reinterpret_cast<const uint8_t *>(text.data()), text.size());
+        accepted = out.repliesDropped == refused;
+      }
+      else accepted = out.push(text.data(), text.size(), update);
+      if(!accepted && !update) CHECK(!out.hasDroppable());
+      pushed.push_back({text, update, accepted});
+    }
+    else if(op < 9 && !stalled) {
+      g_window = rand() % (rand() % 4 == 0 ? 4096 : 64);
+      out.drain();
+    }
+    CHECK(out.queued() <= TELNET_TX_BYTES);
+    CHECK(out.highWater <= TELNET_TX_BYTES);
+    CHECK(!out.failed);
+  }
+  g_window = SIZE_MAX;
+  out.drain();
+  CHECK(out.queued() == 0);
+
+  // Every line arrives whole and in order and no accepted reply is lost.
+  size_t pos = 0;
+  size_t next = 0;
+  while(pos < g_wire.size()) {
+    size_t eol = g_wire.find('\n', pos);
+    CHECK(eol != std::string::npos);
+    std::string line = g_wire.substr(pos, eol - pos + 1);
+    pos = eol + 1;
+    size_t id = strtoul(line.c_str() + 1, nullptr, 10);
+    CHECK(id >= next && id < pushed.size());
+    for(; next < id; next++) CHECK(pushed[next].update || !pushed[next].accepted);
+    CHECK(pushed[id].accepted && pushed[id].text == line);
+    next = id + 1;
+  }
+  for(; next < pushed.size(); next++) CHECK(pushed[next].update || !pushed[next].accepted);
+  printf("telnet: %zu lines, %u updates dropped, %u replies dropped, high water %u bytes\n",
+    pushed.size(), out.updatesDropped, out.repliesDropped, out.highWater);
+
+  // A hard socket error marks the client failed and stops further writes.
+  g_reset = true;
+  out.push("R:x\n", 4, false);
+  CHECK(out.failed);
+  CHECK(!out.push("R:y\n", 4, false));
+  return 0;
+}
+'''
+
+
+def telnet_source():
+    header = read_source('TelnetServer.h')
+    source = read_source('TelnetServer.cpp')
+    code = [extract_block(header, r'^struct telnet_line_t\b'), extract_block(header, r'^class TelnetOutput\b')]
+    code += [extract_block(source, r'^[\w:*& ]*\bTelnetOutput::{}\({}'.format(fn, arg))
+             for fn, arg in (('begin', ''), ('sendNow', ''), ('removeLine', ''), ('dropUpdate', ''), ('push', ''),
+                             ('drain', ''), ('write', 'uint8_t'), ('write', 'const uint8_t'))]
+    defines = extract_defines(header, ['TELNET_TX_BYTES', 'TELNET_TX_DEPTH', 'TELNET_LINE_SIZE'])
+    return TELNET_HARNESS.replace('@DEFINES@', defines).replace('@CODE@', '\n'.join(code))
+
+
+DINPLUG_HARNESS = r'''
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <strings.h>
+
+struct DinplugBridge {
+  @ENUM@
+  bool parseButtonLine(char *line, uint8_t &action, uint16_t &keypadId, uint16_t &buttonId) const;
+  bool parseAction(const char *name, uint8_t &action) const;
+};
+@CODE@
+
+#define CHECK(cond) do { if(!(cond)) { fprintf(stderr, "check failed line %d: %s\n", __LINE__, #cond); abort(); } } while(0)
+
+// Each line is parsed from a heap copy of its exact length so a read past the end is caught.
+static bool parse(const std::string &text, uint8_t &action, uint16_t &keypadId, uint16_t &buttonId) {
+  char *line = static_cast<char *>(malloc(text.size() + 1));
+  memcpy(line, text.c_str(), text.size() + 1);
+  bool ok = DinplugBridge().parseButtonLine(line, action, keypadId, buttonId);
+  free(line);
+  return ok;
+}
+
+struct Case { const char *line; bool ok; uint8_t action; uint16_t keypad; uint16_t button; };
+static const Case cases[] = {
+  {"BTN press 12 3", true, 0, 12, 3},
+  {"R:BTN release 7 1", true, 1, 7, 1},
+  {"  R:BTN hold 65535 0  ", true, 2, 65535, 0},
+  {"BTN DOUBLE\t4\t9\t", true, 3, 4, 9},
+  {"BTN press 65536 1", false},
+  {"BTN press -1 2", false},
+  {"BTN press +1 2", false},
+  {"BTN press 1x 2", false},
+  {"BTN press 1", false},
+  {"BTN bogus 1 2", false},
+  {"BTN ", false},
+  {"BTNpress 1 2", false},
+  {"R:REFRESH 1 2 3", false},
+  {"STA 12 1", false},
+  {"", false},
+};
+
+int main(int argc, char **argv) {
+  const long iterations = argc > 1 ? atol(argv[1]) : 100000;
+  srand(argc > 2 ? atoi(argv[2]) : 1);
+  uint8_t action;
+  uint16_t keypadId, buttonId;
+  for(const Case &c : cases) {
+    bool ok = parse(c.line, action, keypadId, buttonId);
+    if(ok != c.ok || (ok && (action != c.action || keypadId != c.keypad || buttonId != c.button))) {
+      fprintf(stderr, "wrong result for \"%s\"\n", c.line);
+      abort();
+    }
+  }
+  static const char alphabet[] = " \t0123456789:+-xBTNRpresholdubRE\xff";
+  long accepted = 0;
+  for(long i = 0; i < iterations; i++) {
+    std::string text;
+    if(rand() % 2) {
+      // A good line with a few bytes changed, inserted or cut off.
+      text = cases[rand() % 4].line;
+      for(int n = rand() % 4; n > 0 && !text.empty(); n--) {
+        size_t at = rand() % text.size();
+        char ch = alphabet[rand() % (sizeof(alphabet) - 1)];
+        switch(rand() % 3) {
+          case 0: text[at] = ch; break;
+          case 1: text.insert(at, 1, ch); break;
+          default: text.resize(at); break;
+        }
+      }
+    }
+    else {
+      text.resize(rand() % (rand() % 16 == 0 ? 600 : 40));
+      for(char &ch : text) ch = alphabet[rand() % (sizeof(alphabet) - 1)];
+    }
+    if(parse(text, action, keypadId, buttonId)) {
+      CHECK(action <= 3);
+      CHECK(text.find("BTN") != std::string::npos);
+      accepted++;
+    }
+  }
+  printf("dinplug: %zu cases, %ld random lines, %ld accepted\n", sizeof(cases) / sizeof(cases[0]), iterations, accepted);
+  return 0;
+}
+'''
+
+
+def dinplug_source():
+    header = read_source('DinplugBridge.h')
+    source = read_source('DinplugBridge.cpp')
+    code = [extract_block(source, r'^static char \*nextToken\('), extract_block(source, r'^static bool parseId16\('),
+            extract_block(source, r'^bool DinplugBridge::parseButtonLine\('), extract_block(source, r'^bool DinplugBridge::parseAction\(')]
+    return DINPLUG_HARNESS.replace('@ENUM@', extract_block(header, r'^\s*enum ActionType\b').strip()).replace('@CODE@', '\n'.join(code))
+
+
+WEB_HARNESS = r'''
+#include <cctype>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <strings.h>
+#include <utility>
+#include <vector>
+
+// Every allocation in the process goes through these so the routes can be shown to
+// make none.  The sanitizers are left off for this check since they replace malloc.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+static bool g_counting = false;
+static long g_allocs = 0;
+extern "C" void *malloc(size_t size) { if(g_counting) g_allocs++; return __libc_malloc(size); }
+extern "C" void *calloc(size_t count, size_t size) { if(g_counting) g_allocs++; return __libc_calloc(count, size); }
+extern "C" void *realloc(void *ptr, size_t size) { if(g_counting) g_allocs++; return __libc_realloc(ptr, size); }
+extern "C" void free(void *ptr) { __libc_free(ptr); }
+
+#include <ArduinoJson.h>
+
+typedef uint8_t byte;
+class String;
+#define F(str) (str)
+static uint32_t micros() { return 0; }
+static struct { int printf(const char *fmt, ...) { return 0; } } Serial;
+enum class metric_families_t : uint8_t { http };
+static struct { void observe(metric_families_t, const char *, uint32_t) {} } metrics;
+enum class heap_tags_t : uint8_t { web };
+struct HeapTracker {
+  static void *alloc(heap_tags_t, size_t size) { return malloc(size); }
+  static void *realloc(heap_tags_t, void *ptr, size_t size) { return ::realloc(ptr, size); }
+  static void free(heap_tags_t, void *ptr) { ::free(ptr); }
+};
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+class WebServer {
+  public:
+    HTTPMethod _method = HTTP_GET;
+    int status = 0;
+    HTTPMethod method() { return this->_method; }
+    void send(int code, const char *type = nullptr, const char *content = nullptr) { this->status = code; }
+};
+// The server keeps its arguments as the library does and argPtr points into them.
+class LockingServer : public WebServer {
+  public:
+    std::vector<std::pair<std::string, std::string>> args;
+    const char *argPtr(const char *name) {
+      for(auto &arg : this->args) if(arg.first == name) return arg.second.c_str();
+      return nullptr;
+    }
+};
+class JsonResponse {
+  public:
+    void beginResponse(WebServer *server, char *buff, size_t size) { server->status = 200; }
+    void beginObject() {}
+    void endObject() {}
+    void endResponse() {}
+};
+static char g_content[1024];
+static const char _encoding_json[] = "application/json";
+@SOMFY@
+struct SomfyShade {
+  uint8_t shadeId = 1;
+  tilt_types tiltType = tilt_types::tiltmotor;
+  float currentPos = 0.0f, target = 0.0f, currentTiltPos = 0.0f, tiltTarget = 0.0f;
+  void emitState() {}
+  void toJSON(JsonResponse &) {}
+  void toJSONRef(JsonResponse &) {}
+};
+struct SomfyGroup {
+  void toJSONRef(JsonResponse &) {}
+};
+static struct {
+  SomfyShade shade;
+  SomfyGroup group;
+  SomfyShade *getShadeById(uint8_t id) { return id == 1 ? &this->shade : nullptr; }
+  SomfyGroup *getGroupById(uint8_t id) { return id == 2 ? &this->group : nullptr; }
+} somfy;
+@WEBH@
+static web_command_t g_queued;
+class Web {
+  public:
+    void sendCORSHeaders(WebServer &) {}
+    bool isAuthenticated(WebServer &, bool) { return true; }
+    void handleDeserializationError(WebServer &server, DeserializationError &) { server.send(500); }
+    bool queueCommand(web_command_t &cmd) { g_queued = cmd; return true; }
+    void dispatch(LockingServer &server, uint8_t index);
+    void handleShadeCommand(WebRequest &req);
+    void handleGroupCommand(WebRequest &req);
+    void handleTiltCommand(WebRequest &req);
+    void handleSetPositions(WebRequest &req);
+};
+@ROUTES@
+@WEBCPP@
+
+#define CHECK(cond) do { if(!(cond)) { fprintf(stderr, "check failed line %d: %s\n", __LINE__, #cond); abort(); } } while(0)
+
+static Web web;
+static LockingServer server;
+
+static uint8_t routeIndex(const char *path) {
+  for(uint8_t i = 0; i < sizeof(g_routes) / sizeof(g_routes[0]); i++) if(strcmp(g_routes[i].path, path) == 0) return i;
+  fprintf(stderr, "route %s was not copied\n", path);
+  abort();
+}
+// Sends one request with either query arguments or a JSON body and returns the heap
+// allocations it made.
+static long request(const char *path, HTTPMethod method, std::vector<std::pair<std::string, std::string>> args) {
+  server._method = method;
+  server.status = 0;
+  server.args = std::move(args);
+  g_queued = web_command_t();
+  uint8_t index = routeIndex(path);
+  g_allocs = 0;
+  g_counting = true;
+  web.dispatch(server, index);
+  g_counting = false;
+  CHECK(server.status == 200);
+  CHECK(!g_bodyInUse && !g_arenaInUse);
+  return g_allocs;
+}
+
+int main() {
+  struct Case { const char *path; HTTPMethod method; std::vector<std::pair<std::string, std::string>> args; };
+  std::vector<Case> cases = {
+    {"/shadeCommand", HTTP_GET, {{"shadeId", "1"}, {"command", "down"}, {"repeat", "2"}}},
+    {"/shadeCommand", HTTP_PUT, {{"plain", "{\"shadeId\":1,\"command\":\"mud\",\"stepSize\":3}"}}},
+    {"/shadeCommand", HTTP_PUT, {{"plain", "{\"shadeId\":\"1\",\"target\":40}"}}},
+    {"/groupCommand", HTTP_GET, {{"groupId", "2"}, {"command", "Up"}}},
+    {"/groupCommand", HTTP_PUT, {{"plain", "{\"groupId\":2,\"command\":\"STOP\"}"}}},
+    {"/tiltCommand", HTTP_GET, {{"shadeId", "1"}, {"target", "25"}}},
+    {"/tiltCommand", HTTP_PUT, {{"plain", "{\"shadeId\":1,\"command\":\"my\"}"}}},
+    {"/setPositions", HTTP_GET, {{"shadeId", "1"}, {"position", "60"}, {"tiltPosition", "15"}}},
+    {"/setPositions", HTTP_PUT, {{"plain", "{\"shadeId\":1,\"position\":70}"}}},
+  };
+  for(Case &c : cases) {
+    long allocs = request(c.path, c.method, c.args);
+    if(allocs != 0) {
+      fprintf(stderr, "%s %s made %ld heap allocations\n", c.path, c.method == HTTP_GET ? "query" : "body", allocs);
+      abort();
+    }
+  }
+  // The last of each route is checked for the values it was sent.
+  request("/shadeCommand", HTTP_PUT, cases[1].args);
+  CHECK(g_queued.id == 1 && g_queued.command == somfy_commands::MyUpDown && g_queued.stepSize == 3);
+  request("/shadeCommand", HTTP_PUT, cases[2].args);
+  CHECK(g_queued.type == web_cmd_types_t::shadeTarget && g_queued.target == 40);
+  request("/groupCommand", HTTP_PUT, cases[4].args);
+  CHECK(g_queued.id == 2 && g_queued.command == somfy_commands::Stop);
+  request("/tiltCommand", HTTP_GET, cases[5].args);
+  CHECK(g_queued.type == web_cmd_types_t::tiltTarget && g_queued.target == 25);
+  request("/setPositions", HTTP_GET, cases[7].args);
+  CHECK(somfy.shade.currentPos == 60 && somfy.shade.currentTiltPos == 15);
+
+  // A body too large for the static buffer still parses from the heap and gives it back.
+  std::string big = "{\"shadeId\":1,\"command\":\"up\",\"pad\":\"" + std::string(WEB_BODY_SIZE, 'x') + "\"}";
+  CHECK(request("/shadeCommand", HTTP_PUT, {{"plain", big}}) > 0);
+  CHECK(g_queued.command == somfy_commands::Up);
+  printf("web: %zu command requests made no heap allocations\n", cases.size());
+  return 0;
+}
+'''
+
+
+def find_arduinojson(path):
+    candidates = [path] if path else [os.path.expanduser('~/Arduino/libraries/ArduinoJson/src'),
+                                      os.path.expanduser('~/Documents/Arduino/libraries/ArduinoJson/src')]
+    for candidate in candidates:
+        if candidate and os.path.exists(os.path.join(candidate, 'ArduinoJson.h')):
+            return os.path.abspath(candidate)
+    return None
+
+
+def web_source():
+    somfy_h = read_source('Somfy.h')
+    somfy_cpp = read_source('Somfy.cpp')
+    web_h = read_source('Web.h')
+    web_cpp = read_source('Web.cpp')
+    somfy = [extract_block(somfy_h, r'^enum class somfy_commands\b'), extract_block(somfy_h, r'^enum class tilt_types\b'),
+             extract_block(somfy_cpp, r'^static bool commandPrefix\('),
+             extract_block(somfy_cpp, r'^somfy_commands translateSomfyCommand\(const char \*')]
+    header = [extract_defines(web_h, ['WEB_ARENA_SIZE', 'WEB_BODY_SIZE', 'WEB_METHOD_GET', 'WEB_METHOD_POST', 'WEB_METHOD_PUT',
+                                      'WEB_METHOD_DELETE', 'WEB_METHOD_READ', 'WEB_METHOD_WRITE'])]
+    header += [extract_block(web_h, r'^{}\b'.format(decl)) for decl in
+               ('enum class web_cmd_types_t', 'struct web_command_t', 'enum class web_auth_t', 'struct WebArenaAllocator')]
+    header += [extract_line(web_h, r'^typedef BasicJsonDocument<WebArenaAllocator>'), 'class Web;',
+               extract_block(web_h, r'^class WebRequest\b'), extract_line(web_h, r'^typedef void \(Web::\*web_handler_t\)'),
+               extract_block(web_h, r'^struct web_route_t\b')]
+    routes = [extract_line(web_cpp, r'^#define WEB_DOC_FROM_BODY'), 'static constexpr web_route_t g_routes[] = {']
+    routes += [extract_line(web_cpp, r'^\s*\{{"/{}",'.format(path)) for path in ('shadeCommand', 'groupCommand', 'tiltCommand', 'setPositions')]
+    routes.append('};')
+    code = [extract_line(web_cpp, r'^static char g_body\['), extract_line(web_cpp, r'^static bool g_bodyInUse'),
+            extract_line(web_cpp, r'^static uint8_t g_arena\['), extract_line(web_cpp, r'^static bool g_arenaInUse'),
+            extract_line(web_cpp, r'^uint32_t WebArenaAllocator::hits'), extract_line(web_cpp, r'^uint32_t WebArenaAllocator::misses')]
+    code += [extract_block(web_cpp, r'^[\w:*& ]*\b{}\('.format(fn)) for fn in
+             ('WebArenaAllocator::allocate', 'WebArenaAllocator::deallocate', 'WebArenaAllocator::reallocate')]
+    code.append(extract_block(web_cpp, r'^struct WebRequestBody\b'))
+    code.append(extract_line(web_cpp, r'^WebRequest::WebRequest\('))
+    code += [extract_block(web_cpp, r'^[\w:*& ]*\bWebRequest::{}\('.format(fn)) for fn in ('parse', 'hasArg', 'argStr', 'argInt')]
+    code += [extract_block(web_cpp, r'^static uint8_t webMethodFlag\('), extract_block(web_cpp, r'^void Web::dispatch\(')]
+    code += [extract_block(web_cpp, r'^void Web::{}\('.format(fn)) for fn in
+             ('handleShadeCommand', 'handleGroupCommand', 'handleTiltCommand', 'handleSetPositions')]
+    return (WEB_HARNESS.replace('@SOMFY@', '\n'.join(somfy)).replace('@WEBH@', '\n'.join(header))
+            .replace('@ROUTES@', '\n'.join(routes)).replace('@WEBCPP@', '\n'.join(code)))
+
+
+# Each check names the function that writes its source, what it covers and whether it
+# needs ArduinoJson.  The web check counts allocations so it runs without the sanitizers.
+CHECKS = {
+    'dinplug': (dinplug_source, 'the dinplug line parser against known and random lines', False),
+    'telnet': (telnet_source, 'the telnet output queue against a socket that fills and drains', False),
+    'web': (web_source, 'heap allocations made by the shade and group command routes', True),
+}
+
+
+def run_check(name, args, workdir):
+    source, _, needs_json = CHECKS[name]
+    src = os.path.join(workdir, name + '.cpp')
+    exe = os.path.join(workdir, name)
+    with open(src, 'w') as f:
+        f.write(source())
+    cmd = [args.cxx, '-std=c++17', '-g', '-O1', '-o', exe, src]
+    if needs_json:
+        cmd.insert(-3, '-I' + args.arduinojson)
+    else:
+        cmd[3:3] = ['-fsanitize=address,undefined', '-fno-sanitize-recover=all']
+    subprocess.run(cmd, check=True)
+    subprocess.run([exe] if needs_json else [exe, str(args.iterations), str(args.seed)], check=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('checks', nargs='*', help='checks to run from {}, all by default'.format(', '.join(sorted(CHECKS))))
+    parser.add_argument('--iterations', type=int, default=100000)
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--cxx', default=os.environ.get('CXX', 'c++'))
+    parser.add_argument('--keep', action='store_true', help='leave the generated sources in a temporary directory')
+    parser.add_argument('--arduinojson', help='the src directory of ArduinoJson, found in the Arduino libraries by default')
+    args = parser.parse_args()
+    for name in args.checks:
+        if name not in CHECKS:
+            parser.error('unknown check {}'.format(name))
+    checks = args.checks or sorted(CHECKS)
+    args.arduinojson = find_arduinojson(args.arduinojson)
+    if args.arduinojson is None:
+        if args.checks and any(CHECKS[name][2] for name in args.checks):
+            parser.error('ArduinoJson was not found; install it with arduino-cli or pass --arduinojson')
+        for name in [name for name in checks if CHECKS[name][2]]:
+            print('{}: skipped, ArduinoJson was not found'.format(name))
+            checks.remove(name)
+    workdir = tempfile.mkdtemp(prefix='host_check_')
+    try:
+        for name in checks:
+            print('{}: {}'.format(name, CHECKS[name][1]))
+            run_check(name, args, workdir)
+    except (RuntimeError, subprocess.CalledProcessError) as err:
+        print('error: {}'.format(err), file=sys.stderr)
+        return 1
+    finally:
+        if args.keep:
+            print('sources kept in {}'.format(workdir))
+        else:
+            subprocess.run(['rm', '-rf', workdir])
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
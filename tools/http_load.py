@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""Measures how many requests per second the controller answers.
+
+Runs a fixed number of GET requests against an endpoint across several concurrent
+connections and reports the request rate and latency percentiles.
+
+    python3 tools/http_load.py 192.168.1.50 --path /shades --port 8081 -n 500 -c 4
+"""
+import argparse
+import http.client
+import sys
+import threading
+import time
+
+
+def worker(args, count, latencies, errors, lock):
+    conn = None
+    for _ in range(count):
+        start = time.perf_counter()
+        try:
+            if conn is None:
+                conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+            headers = {'apikey': args.apikey} if args.apikey else {}
+            conn.request('GET', args.path, headers=headers)
+            resp = conn.getresponse()
+            resp.read()
+            if resp.status != 200:
+                raise RuntimeError('HTTP {}'.format(resp.status))
+            if resp.getheader('Connection', '').lower() == 'close':
+                conn.close()
+                conn = None
+            with lock:
+                latencies.append(time.perf_counter() - start)
+        except Exception as err:
+            with lock:
+                errors.append(str(err))
+            if conn is not None:
+                conn.close()
+            conn = None
+    if conn is not None:
+        conn.close()
+
+
+def percentile(values, pct):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * pct / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Measure request throughput of the controller.')
+    parser.add_argument('host')
+    parser.add_argument('--port', type=int, default=8081)
+    parser.add_argument('--path', default='/shades')
+    parser.add_argument('--apikey', default='')
+    parser.add_argument('-n', '--requests', type=int, default=200)
+    parser.add_argument('-c', '--concurrency', type=int, default=4)
+    parser.add_argument('--timeout', type=float, default=10.0)
+    args = parser.parse_args()
+
+    latencies = []
+    errors = []
+    lock = threading.Lock()
+    per = [args.requests // args.concurrency] * args.concurrency
+    for i in range(args.requests % args.concurrency):
+        per[i] += 1
+    threads = [threading.Thread(target=worker, args=(args, n, latencies, errors, lock)) for n in per]
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - start
+
+    print('{} {} requests over {} connections in {:.2f}s'.format(args.path, args.requests, args.concurrency, elapsed))
+    print('  ok: {}  errors: {}'.format(len(latencies), len(errors)))
+    print('  requests/sec: {:.1f}'.format(len(latencies) / elapsed if elapsed > 0 else 0))
+    print('  latency ms p50: {:.1f}  p90: {:.1f}  p99: {:.1f}  max: {:.1f}'.format(
+        percentile(latencies, 50) * 1000, percentile(latencies, 90) * 1000,
+        percentile(latencies, 99) * 1000, max(latencies, default=0) * 1000))
+    for err in sorted(set(errors))[:5]:
+        print('  error: {}'.format(err))
+    return 0 if not errors else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
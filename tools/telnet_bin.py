@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+"""Client for the binary protocol on the telnet port and a round trip benchmark.
+
+The client sends "binary" on the text console and then speaks length prefixed frames.
+It can be imported by an automation script or run to time queries against the text
+console on the same connection type.
+
+    python3 tools/telnet_bin.py 192.168.1.50 query 3
+    python3 tools/telnet_bin.py 192.168.1.50 move 3 50
+    python3 tools/telnet_bin.py 192.168.1.50 bench 3 -n 500
+"""
+import argparse
+import socket
+import struct
+import sys
+import time
+
+OP_MOVE = 0x01
+OP_COMMAND = 0x02
+OP_QUERY = 0x03
+OP_SUBSCRIBE = 0x04
+OP_STATE = 0x40
+OP_REMOVED = 0x41
+OP_RESPONSE = 0x80
+
+STATUS = {0: 'ok', 1: 'bad opcode', 2: 'bad length', 3: 'not found', 4: 'bad command'}
+COMMANDS = {'my': 0x01, 'up': 0x02, 'myup': 0x03, 'down': 0x04, 'mydown': 0x05, 'updown': 0x06,
+            'myupdown': 0x07, 'prog': 0x08, 'sunflag': 0x09, 'flag': 0x0A, 'stepdown': 0x0B,
+            'toggle': 0x0C, 'sensor': 0x0E, 'stepup': 0x8B, 'favorite': 0xC1, 'stop': 0xF1}
+
+
+class ProtocolError(Exception):
+    pass
+
+
+def decode_state(data):
+    shade_id, pos, target, direction, flags, tilt_pos, tilt_target, tilt_dir = struct.unpack('<BbbbBbbb', data[:8])
+    state = {'id': shade_id, 'pos': pos, 'target': target, 'dir': direction, 'flags': flags}
+    if tilt_pos != -1:
+        state.update({'tiltPos': tilt_pos, 'tiltTarget': tilt_target, 'tiltDir': tilt_dir})
+    return state
+
+
+class Client:
+    def __init__(self, host, port=23, timeout=5.0):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.buf = b''
+        self.seq = 0
+        self.events = []
+        self._read_line()  # Welcome
+        self.sock.sendall(b'binary\r\n')
+        # The shade list sent on connect arrives ahead of the handshake reply.
+        while b'"event":"binary"' not in self._read_line():
+            pass
+
+    def close(self):
+        self.sock.close()
+
+    def _fill(self):
+        chunk = self.sock.recv(4096)
+        if not chunk:
+            raise ProtocolError('connection closed')
+        self.buf += chunk
+
+    def _read_line(self):
+        while b'\n' not in self.buf:
+            self._fill()
+        line, self.buf = self.buf.split(b'\n', 1)
+        return line
+
+    def _read_frame(self):
+        while len(self.buf) < 2:
+            self._fill()
+        length = struct.unpack('<H', self.buf[:2])[0]
+        while len(self.buf) < length + 2:
+            self._fill()
+        frame, self.buf = self.buf[2:length + 2], self.buf[length + 2:]
+        op, seq = struct.unpack('<BH', frame[:3])
+        return op, seq, frame[3:]
+
+    def request(self, op, payload=b''):
+        self.seq = (self.seq + 1) & 0xFFFF or 1
+        self.sock.sendall(struct.pack('<HBH', len(payload) + 3, op, self.seq) + payload)
+        while True:
+            rop, seq, data = self._read_frame()
+            if rop == op | OP_RESPONSE and seq == self.seq:
+                if data[0] != 0:
+                    raise ProtocolError(STATUS.get(data[0], 'status {}'.format(data[0])))
+                return data[1:]
+            if rop == OP_STATE:
+                self.events.append(decode_state(data))
+            elif rop == OP_REMOVED:
+                self.events.append({'id': data[0], 'removed': True})
+
+    def move(self, shade_id, target):
+        return decode_state(self.request(OP_MOVE, struct.pack('<BB', shade_id, target)))
+
+    def command(self, shade_id, command, repeat=0, step=0):
+        cmd = COMMANDS[command.lower()] if isinstance(command, str) else command
+        return decode_state(self.request(OP_COMMAND, struct.pack('<BBBB', shade_id, cmd, repeat, step)))
+
+    def query(self, shade_id):
+        return decode_state(self.request(OP_QUERY, struct.pack('<B', shade_id)))
+
+    def subscribe(self, shade_ids=None):
+        mask = 0xFFFFFFFF if shade_ids is None else sum(1 << (i - 1) for i in shade_ids)
+        self.request(OP_SUBSCRIBE, struct.pack('<I', mask))
+
+    def next_event(self):
+        while not self.events:
+            op, _, data = self._read_frame()
+            if op == OP_STATE:
+                self.events.append(decode_state(data))
+            elif op == OP_REMOVED:
+                self.events.append({'id': data[0], 'removed': True})
+        return self.events.pop(0)
+
+
+def percentile(values, pct):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * pct / 100))]
+
+
+def bench_text(host, port, shade_id, count):
+    sock = socket.create_connection((host, port), timeout=5.0)
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    sock.sendall(b'watch none\r\n')
+    buf = b''
+    while b'"event":"watch"' not in buf:
+        buf += sock.recv(4096)
+    buf = buf[buf.index(b'"event":"watch"'):]
+    buf = buf[buf.index(b'\n') + 1:]
+    times = []
+    for _ in range(count):
+        start = time.perf_counter()
+        sock.sendall('shade {}\r\n'.format(shade_id).encode())
+        while b'\n' not in buf:
+            buf += sock.recv(4096)
+        buf = buf[buf.index(b'\n') + 1:]
+        times.append(time.perf_counter() - start)
+    sock.close()
+    return times
+
+
+def bench_binary(host, port, shade_id, count):
+    client = Client(host, port)
+    client.subscribe([])
+    times = []
+    for _ in range(count):
+        start = time.perf_counter()
+        client.query(shade_id)
+        times.append(time.perf_counter() - start)
+    client.close()
+    return times
+
+
+def report(name, times):
+    print('{:<7} {:>6} queries  {:>8.1f}/s  p50 {:>6.2f}ms  p99 {:>6.2f}ms'.format(
+        name, len(times), len(times) / sum(times), percentile(times, 50) * 1000, percentile(times, 99) * 1000))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('host')
+    parser.add_argument('op', choices=['query', 'move', 'cmd', 'watch', 'bench'])
+    parser.add_argument('args', nargs='*')
+    parser.add_argument('--port', type=int, default=23)
+    parser.add_argument('-n', type=int, default=200, help='queries per protocol for bench')
+    args = parser.parse_args()
+    try:
+        if args.op == 'bench':
+            shade_id = int(args.args[0])
+            report('text', bench_text(args.host, args.port, shade_id, args.n))
+            report('binary', bench_binary(args.host, args.port, shade_id, args.n))
+            return 0
+        client = Client(args.host, args.port)
+        if args.op == 'query':
+            print(client.query(int(args.args[0])))
+        elif args.op == 'move':
+            print(client.move(int(args.args[0]), int(args.args[1])))
+        elif args.op == 'cmd':
+            print(client.command(int(args.args[0]), args.args[1], *[int(a) for a in args.args[2:4]]))
+        elif args.op == 'watch':
+            client.subscribe([int(a) for a in args.args] or None)
+            while True:
+                print(client.next_event())
+        client.close()
+    except (OSError, ProtocolError, IndexError, KeyError, ValueError) as err:
+        print('error: {}'.format(err), file=sys.stderr)
+        return 1
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())